@@ -0,0 +1,145 @@
+#version 100
+
+/* Variants are compiled with some of these defined, one per output the program writes (see mesh_outputs in mvz.cpp):
+
+     MVZ_OUTPUT_COLOR, MVZ_OUTPUT_SEGMENTATION, MVZ_OUTPUT_DEPTH, MVZ_OUTPUT_NORMAL
+
+   With MVZ_MULTIPLE_OUTPUTS, each output is written to the color attachment its image_type indexes, otherwise to the
+   only one there is. With MVZ_GLOSSY, the color output adds the reflection of the prefiltered sky. */
+
+#ifdef MVZ_MULTIPLE_OUTPUTS
+#extension GL_EXT_draw_buffers : require
+#define OUTPUT(index) gl_FragData[index]
+#else
+#define OUTPUT(index) gl_FragColor
+#endif
+
+#ifdef MVZ_GLOSSY
+#extension GL_EXT_shader_texture_lod : enable
+#endif
+
+precision highp float;
+
+varying vec2 frag_texcoords;
+
+varying vec3 frag_normal;
+
+varying float frag_view_depth;
+
+varying vec3 frag_world_position;
+
+#ifdef MVZ_OUTPUT_COLOR
+
+uniform vec3 irradiance[9];
+
+/* The diffuse lighting of the skybox as spherical harmonics, with the cosine lobe and 1/pi folded into the
+   coefficients (see mvz_sh.h). */
+vec3 diffuse_irradiance(vec3 dir)
+{
+  vec3 n = normalize(dir);
+  return irradiance[0] + irradiance[1] * n.y + irradiance[2] * n.z + irradiance[3] * n.x +
+         irradiance[4] * (n.x * n.y) + irradiance[5] * (n.y * n.z) + irradiance[6] * (3.0 * n.z * n.z - 1.0) +
+         irradiance[7] * (n.x * n.z) + irradiance[8] * (n.x * n.x - n.y * n.y);
+}
+
+#ifdef MVZ_GLOSSY
+
+/* Level i of the chain is the sky convolved with a GGX lobe of roughness i / specular_max_level. */
+uniform samplerCube specular_environment;
+
+uniform float specular_max_level;
+
+uniform vec3 camera_position;
+
+/* The material of the mesh that is drawn. */
+uniform float specular;
+
+uniform float roughness;
+
+vec3 specular_radiance(vec3 dir)
+{
+  float level = roughness * specular_max_level;
+#ifdef GL_EXT_shader_texture_lod
+  return textureCubeLodEXT(specular_environment, dir, level).rgb;
+#else
+  /* The bias adds to the level that the derivatives select, which is about zero for a sky that is magnified. */
+  return textureCube(specular_environment, dir, level).rgb;
+#endif
+}
+
+#endif
+
+#endif
+
+#ifdef MVZ_OUTPUT_SEGMENTATION
+
+uniform vec3 instance_id;
+
+#endif
+
+#ifdef MVZ_OUTPUT_DEPTH
+
+/* (near, far) of the camera. */
+uniform vec2 depth_range;
+
+uniform bool pack_depth;
+
+vec4 encode_depth(float depth)
+{
+  if (!pack_depth) {
+    return vec4(depth, 0.0, 0.0, 1.0);
+  }
+  /* Linear depth between the clip planes, as 16-bit fixed point split across red (high) and green (low). */
+  float x = clamp((depth - depth_range.x) / (depth_range.y - depth_range.x), 0.0, 1.0);
+  float q = floor(x * 65535.0 + 0.5);
+  float hi = floor(q / 256.0);
+  float lo = q - hi * 256.0;
+  return vec4(hi / 255.0, lo / 255.0, 0.0, 1.0);
+}
+
+#endif
+
+#ifdef MVZ_OUTPUT_NORMAL
+
+/* Identity for world space normals, the view rotation for camera space normals. */
+uniform mat3 normal_space;
+
+vec4 encode_normal(vec3 n)
+{
+  return vec4(normalize(normal_space * n) * 0.5 + 0.5, 1.0);
+}
+
+#endif
+
+void
+main()
+{
+#ifdef MVZ_OUTPUT_COLOR
+  vec3 albedo = vec3(0.8, 0.8, 0.8);
+
+  if (frag_texcoords.x == 0.4242242) {
+    albedo.x = 0.4;
+  }
+
+  vec3 color = albedo * diffuse_irradiance(frag_normal);
+
+#ifdef MVZ_GLOSSY
+  vec3 view_dir = normalize(frag_world_position - camera_position);
+  color += specular * specular_radiance(reflect(view_dir, normalize(frag_normal)));
+#endif
+
+  OUTPUT(0) = vec4(color, 1.0);
+#endif
+
+#ifdef MVZ_OUTPUT_SEGMENTATION
+  OUTPUT(1) = vec4(instance_id, 1.0);
+#endif
+
+#ifdef MVZ_OUTPUT_DEPTH
+  OUTPUT(2) = encode_depth(frag_view_depth);
+#endif
+
+#ifdef MVZ_OUTPUT_NORMAL
+  OUTPUT(3) = encode_normal(frag_normal);
+#endif
+}
@@ -1,22 +1,36 @@
 #version 100
 
-attribute in vec3 position;
+attribute vec3 position;
 
-attribute in vec2 texcoord;
+attribute vec2 texcoord;
 
-attribute in vec3 normal;
+attribute vec3 normal;
 
 uniform mat4 mvp;
 
+uniform mat4 model;
+
+uniform mat4 model_view;
+
+uniform mat3 normal_matrix;
+
 varying vec2 frag_texcoords;
 
 varying vec3 frag_normal;
 
+varying vec3 frag_world_position;
+
+varying float frag_view_depth;
+
+/* The auxiliary passes depth test against the color pass with GL_EQUAL. */
+invariant gl_Position;
+
 void
 main()
 {
   frag_texcoords = texcoord;
-  /* TODO transform normal */
-  frag_normal = normal;
+  frag_normal = normal_matrix * normal;
+  frag_world_position = (model * vec4(position, 1.0)).xyz;
+  frag_view_depth = -(model_view * vec4(position, 1.0)).z;
   gl_Position = mvp * vec4(position, 1.0);
 }
@@ -0,0 +1,94 @@
+// Compares the software rasterizer with the GL session on the demo scene. The GL side needs a headless context, so it
+// is only measured when the library is built with MVZ_EGL.
+
+#include "mvz.h"
+#include "mvz_soft.h"
+
+#ifdef MVZ_BENCH_GL
+#include "mvz_egl.h"
+#endif
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+
+namespace {
+
+template<typename Session>
+auto
+measure(Session& s, const int width, const int height, const int num_frames) -> double
+{
+  const int obj_id = s.load_obj(DEMO_PATH "/scene.obj");
+
+  std::vector<mvz::mesh_instance> scene;
+
+  scene.emplace_back(s.instance(obj_id, "Ground"));
+  scene.emplace_back(s.instance(obj_id, "Suzanne"));
+
+  for (auto& inst : scene) {
+    inst.translation = { 0, 0, 0 };
+    inst.rotation = { 0, 0, 0 };
+  }
+
+  mvz::camera cam;
+  cam.position.y = 1;
+  cam.position.z = 10;
+  cam.resolution[0] = width;
+  cam.resolution[1] = height;
+  cam.aspect = static_cast<float>(width) / static_cast<float>(height);
+
+  s.set_readback_callback([&s](mvz::frame&& f) { s.recycle(std::move(f)); });
+
+  const std::vector<mvz::image_type> outputs{ mvz::image_type::color, mvz::image_type::segmentation };
+
+  const auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < num_frames; i++) {
+    s.render_offscreen(cam, scene, outputs);
+    s.read_offscreen(mvz::image_type::color, static_cast<std::uint64_t>(i));
+    s.read_offscreen(mvz::image_type::segmentation, static_cast<std::uint64_t>(i));
+    s.poll_readbacks();
+    cam.rotation.y += 0.01f;
+  }
+
+  s.poll_readbacks(true);
+
+  const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  return elapsed / num_frames;
+}
+
+} // namespace
+
+auto
+main(int argc, char** argv) -> int
+{
+  const auto width = (argc > 1) ? std::atoi(argv[1]) : 640;
+  const auto height = (argc > 2) ? std::atoi(argv[2]) : 480;
+  const auto num_frames = (argc > 3) ? std::atoi(argv[3]) : 100;
+  const auto num_threads = (argc > 4) ? std::atoi(argv[4]) : 0;
+
+  try {
+
+    mvz::soft_session soft(num_threads);
+
+    std::cout << "software: " << measure(soft, width, height, num_frames) << " ms/frame" << std::endl;
+
+#ifdef MVZ_BENCH_GL
+    mvz::headless_context context;
+
+    mvz::session gl(mvz::headless_context::get_proc_address);
+
+    std::cout << "gl:       " << measure(gl, width, height, num_frames) << " ms/frame" << std::endl;
+#endif
+
+  } catch (const mvz::runtime_error& err) {
+    std::cerr << err.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
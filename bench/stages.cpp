@@ -0,0 +1,542 @@
+// Measures each stage of producing a sample on its own: parsing OBJ files, uploading them, rendering, decoding the
+// skyboxes, reading frames back and encoding them. The GL stages need a headless context, so they are only measured
+// when the library is built with MVZ_EGL.
+//
+//   mvz_bench [--iterations <n>] [--filter <text>] [--scratch <directory>]
+//
+// The results are written to stdout as JSON, one entry per benchmark and set of parameters, with the median and
+// percentiles of the samples in milliseconds. Benchmarks whose name does not contain the filter text are skipped. The
+// generated OBJ files are written to the scratch directory.
+
+#include "mvz.h"
+#include "mvz_encoder.h"
+#include "mvz_obj.h"
+#include "mvz_skybox.h"
+#include "mvz_soft.h"
+#include "mvz_stb.h"
+
+#ifdef MVZ_BENCH_GL
+#include "mvz_egl.h"
+
+#include <glad/glad.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+struct options final
+{
+  int iterations{ 15 };
+
+  std::string filter;
+
+  std::string scratch{ "." };
+};
+
+struct result final
+{
+  std::string name;
+
+  std::vector<std::pair<std::string, std::string>> params;
+
+  std::vector<double> samples;
+};
+
+template<typename Func>
+auto
+time_ms(Func&& func) -> double
+{
+  const auto start = std::chrono::steady_clock::now();
+
+  func();
+
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Nearest rank, on sorted samples.
+auto
+get_percentile(const std::vector<double>& sorted, const double p) -> double
+{
+  const auto rank = static_cast<std::size_t>(std::ceil(p / 100.0 * static_cast<double>(sorted.size())));
+
+  return sorted[std::min(std::max(rank, static_cast<std::size_t>(1)), sorted.size()) - 1];
+}
+
+auto
+get_median(const std::vector<double>& sorted) -> double
+{
+  const auto n = sorted.size();
+
+  return (n % 2) ? sorted[n / 2] : ((sorted[n / 2 - 1] + sorted[n / 2]) * 0.5);
+}
+
+auto
+escape_json(const std::string& text) -> std::string
+{
+  std::string escaped;
+
+  for (const auto c : text) {
+    if ((c == '"') || (c == '\\')) {
+      escaped += '\\';
+      escaped += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      escaped += ' ';
+    } else {
+      escaped += c;
+    }
+  }
+
+  return escaped;
+}
+
+class suite final
+{
+public:
+  explicit suite(options opts)
+    : m_options(std::move(opts))
+  {
+  }
+
+  auto enabled(const char* name) const -> bool
+  {
+    return m_options.filter.empty() || (std::strstr(name, m_options.filter.c_str()) != nullptr);
+  }
+
+  // Calls 'sample' once to warm up and then once per iteration. Each call returns the milliseconds it measured, so that
+  // it can leave its setup out.
+  template<typename Func>
+  void run(const char* name, std::vector<std::pair<std::string, std::string>> params, Func&& sample)
+  {
+    if (!enabled(name)) {
+      return;
+    }
+
+    std::cerr << name;
+    for (const auto& p : params) {
+      std::cerr << ' ' << p.first << '=' << p.second;
+    }
+    std::cerr << std::endl;
+
+    sample();
+
+    result r;
+    r.name = name;
+    r.params = std::move(params);
+
+    for (int i = 0; i < m_options.iterations; i++) {
+      r.samples.emplace_back(sample());
+    }
+
+    m_results.emplace_back(std::move(r));
+  }
+
+  void set_context(const std::string& key, const std::string& value) { m_context.emplace_back(key, value); }
+
+  auto get_options() const -> const options& { return m_options; }
+
+  void write_json(std::ostream& stream) const
+  {
+    stream << "{\n  \"context\": {";
+
+    for (std::size_t i = 0; i < m_context.size(); i++) {
+      stream << (i ? ", " : "") << '"' << escape_json(m_context[i].first) << "\": \""
+             << escape_json(m_context[i].second) << '"';
+    }
+
+    stream << "},\n  \"benchmarks\": [";
+
+    for (std::size_t i = 0; i < m_results.size(); i++) {
+
+      const auto& r = m_results[i];
+
+      auto sorted = r.samples;
+
+      std::sort(sorted.begin(), sorted.end());
+
+      double sum{};
+
+      for (const auto s : sorted) {
+        sum += s;
+      }
+
+      stream << (i ? ",\n" : "\n") << "    { \"name\": \"" << escape_json(r.name) << "\", \"params\": {";
+
+      for (std::size_t j = 0; j < r.params.size(); j++) {
+        stream << (j ? ", " : "") << '"' << escape_json(r.params[j].first) << "\": \""
+               << escape_json(r.params[j].second) << '"';
+      }
+
+      stream << "}, \"unit\": \"ms\", \"iterations\": " << sorted.size();
+
+      if (!sorted.empty()) {
+        stream << ", \"median\": " << get_median(sorted) << ", \"mean\": " << (sum / static_cast<double>(sorted.size()))
+               << ", \"min\": " << sorted.front() << ", \"p90\": " << get_percentile(sorted, 90)
+               << ", \"p99\": " << get_percentile(sorted, 99) << ", \"max\": " << sorted.back();
+      }
+
+      stream << " }";
+    }
+
+    stream << "\n  ]\n}" << std::endl;
+  }
+
+private:
+  options m_options;
+
+  std::vector<std::pair<std::string, std::string>> m_context;
+
+  std::vector<result> m_results;
+};
+
+// A wavy grid of 2 * n * n triangles with normals and texture coordinates, as a single shape named "grid".
+auto
+write_grid_obj(const std::string& path, const int n) -> bool
+{
+  std::ofstream file(path, std::ios::trunc);
+
+  file << "o grid\n";
+
+  for (int y = 0; y <= n; y++) {
+    for (int x = 0; x <= n; x++) {
+      const auto u = static_cast<float>(x) / static_cast<float>(n);
+      const auto v = static_cast<float>(y) / static_cast<float>(n);
+      const auto h = 0.05f * std::sin(u * 20.0f) * std::cos(v * 20.0f);
+      file << "v " << (u * 2.0f - 1.0f) << ' ' << h << ' ' << (v * 2.0f - 1.0f) << '\n';
+      file << "vt " << u << ' ' << v << '\n';
+      file << "vn 0 1 0\n";
+    }
+  }
+
+  const auto index = [n](const int x, const int y) { return y * (n + 1) + x + 1; };
+
+  for (int y = 0; y < n; y++) {
+    for (int x = 0; x < n; x++) {
+      const int corners[4]{ index(x, y), index(x + 1, y), index(x + 1, y + 1), index(x, y + 1) };
+      for (const auto& tri : { std::array<int, 3>{ 0, 2, 1 }, std::array<int, 3>{ 0, 3, 2 } }) {
+        file << 'f';
+        for (const auto c : tri) {
+          file << ' ' << corners[c] << '/' << corners[c] << '/' << corners[c];
+        }
+        file << '\n';
+      }
+    }
+  }
+
+  return static_cast<bool>(file.flush());
+}
+
+auto
+get_grid_sizes() -> std::vector<int>
+{
+  // About a thousand, sixteen thousand and a quarter million triangles.
+  return { 23, 91, 362 };
+}
+
+auto
+get_grid_path(const options& opts, const int n) -> std::string
+{
+  return opts.scratch + "/mvz_bench_grid_" + std::to_string(n) + ".obj";
+}
+
+void
+bench_obj_parse(suite& s)
+{
+  for (const auto n : get_grid_sizes()) {
+    const auto path = get_grid_path(s.get_options(), n);
+    s.run("obj_parse", { { "triangles", std::to_string(2 * n * n) } }, [&path]() {
+      return time_ms([&path]() {
+        mvz::obj_file file;
+        if (!file.load(path.c_str())) {
+          throw mvz::runtime_error("Failed to load '" + path + "'.");
+        }
+      });
+    });
+  }
+}
+
+// Each sample decodes the images of the skybox and, for equirectangular ones, resamples them into faces.
+void
+bench_skybox_decode(suite& s)
+{
+  for (const auto& path : mvz::list_rc_skyboxes()) {
+
+    const auto kind = mvz::is_equirect_skybox(path) ? "equirect" : "faces";
+
+    s.run("skybox_decode", { { "skybox", path }, { "kind", kind } }, [&path]() {
+      return time_ms([&path]() {
+        mvz::rc_image_decoder decoder(mvz::get_skybox_images(path));
+        mvz::skybox_faces faces;
+        faces.load(decoder, path);
+      });
+    });
+  }
+}
+
+auto
+get_demo_camera(const int width, const int height) -> mvz::camera
+{
+  mvz::camera cam;
+  cam.position.y = 1;
+  cam.position.z = 10;
+  cam.resolution[0] = width;
+  cam.resolution[1] = height;
+  cam.aspect = static_cast<float>(width) / static_cast<float>(height);
+  return cam;
+}
+
+// The encoders do not depend on where frames come from, so they are fed by the software rasterizer, which needs no
+// context.
+void
+bench_encode(suite& s)
+{
+  if (!s.enabled("encode")) {
+    return;
+  }
+
+  mvz::soft_session soft;
+
+  const int obj_id = soft.load_obj(DEMO_PATH "/scene.obj");
+
+  const std::vector<mvz::mesh_instance> scene{ soft.instance(obj_id, "Ground"), soft.instance(obj_id, "Suzanne") };
+
+  std::vector<mvz::frame> frames;
+
+  soft.set_readback_callback([&frames](mvz::frame&& f) { frames.emplace_back(std::move(f)); });
+
+  soft.render_offscreen(get_demo_camera(640, 480), scene, { mvz::image_type::color, mvz::image_type::segmentation });
+  soft.read_offscreen(mvz::image_type::color, 0);
+  soft.read_offscreen(mvz::image_type::segmentation, 0);
+  soft.poll_readbacks(true);
+
+  const std::vector<std::pair<const char*, std::shared_ptr<const mvz::image_encoder>>> encoders{
+    { "png", mvz::make_png_encoder() },
+    { "qoi", mvz::make_qoi_encoder() },
+    { "jpg", mvz::make_jpg_encoder() },
+    { "raw", mvz::make_raw_encoder() }
+  };
+
+  for (const auto& f : frames) {
+    for (const auto& encoder : encoders) {
+
+      std::vector<unsigned char> output;
+
+      const auto type = (f.type == mvz::image_type::color) ? "color" : "segmentation";
+
+      s.run("encode", { { "format", encoder.first }, { "type", type }, { "width", std::to_string(f.width) } }, [&]() {
+        return time_ms([&]() {
+          output.clear();
+          encoder.second->encode(f, output);
+        });
+      });
+    }
+  }
+}
+
+#ifdef MVZ_BENCH_GL
+
+// Each sample uploads into resources of its own, which are deleted afterwards, so that memory does not grow with the
+// number of iterations. The time includes parsing, since that is what load_obj() does before uploading.
+void
+bench_obj_upload(suite& s)
+{
+  for (const auto n : get_grid_sizes()) {
+    const auto path = get_grid_path(s.get_options(), n);
+    s.run("obj_load_gl", { { "triangles", std::to_string(2 * n * n) } }, [&path]() {
+      mvz::shared_resources resources(mvz::headless_context::get_proc_address);
+      return time_ms([&]() { resources.load_obj(path.c_str()); });
+    });
+  }
+}
+
+// Instances of the demo mesh in a square grid facing the camera, rendered into the default framebuffer of the context.
+void
+bench_render(suite& s, mvz::session& gl)
+{
+  if (!s.enabled("render_current_fbo")) {
+    return;
+  }
+
+  const int obj_id = gl.load_obj(DEMO_PATH "/scene.obj");
+
+  const auto cam = get_demo_camera(640, 480);
+
+  for (const auto count : { 1, 16, 256, 1024 }) {
+
+    std::vector<mvz::mesh_instance> instances;
+
+    const auto side = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(count))));
+
+    for (int i = 0; i < count; i++) {
+      auto inst = gl.instance(obj_id, "Suzanne");
+      const auto spacing = 8.0f / static_cast<float>(side);
+      inst.translation = { (static_cast<float>(i % side) - static_cast<float>(side - 1) * 0.5f) * spacing,
+                           (static_cast<float>(i / side) - static_cast<float>(side - 1) * 0.5f) * spacing + 1.0f,
+                           0.0f };
+      inst.rotation = { 0, 0, 0 };
+      inst.scale = { spacing * 0.4f, spacing * 0.4f, spacing * 0.4f };
+      instances.emplace_back(inst);
+    }
+
+    for (const auto type : { mvz::image_type::color, mvz::image_type::segmentation }) {
+
+      const auto type_name = (type == mvz::image_type::color) ? "color" : "segmentation";
+
+      s.run("render_current_fbo", { { "instances", std::to_string(count) }, { "type", type_name } }, [&]() {
+        // Auxiliary outputs depth test against the color render of the same scene.
+        if (type != mvz::image_type::color) {
+          gl.render(cam, instances, mvz::image_type::color);
+          glFinish();
+        }
+        return time_ms([&]() {
+          gl.render(cam, instances, type);
+          glFinish();
+        });
+      });
+    }
+  }
+}
+
+// Renders once and then measures reading each output back, including the conversion to the frame format.
+void
+bench_readback(suite& s, mvz::session& gl)
+{
+  if (!s.enabled("readback")) {
+    return;
+  }
+
+  const int obj_id = gl.load_obj(DEMO_PATH "/scene.obj");
+
+  const std::vector<mvz::mesh_instance> scene{ gl.instance(obj_id, "Ground"), gl.instance(obj_id, "Suzanne") };
+
+  const std::vector<std::pair<const char*, mvz::image_type>> outputs{ { "color", mvz::image_type::color },
+                                                                      { "segmentation", mvz::image_type::segmentation },
+                                                                      { "depth", mvz::image_type::depth },
+                                                                      { "normal", mvz::image_type::normal } };
+
+  gl.set_readback_callback([&gl](mvz::frame&& f) { gl.recycle(std::move(f)); });
+
+  for (const auto& size : { std::array<int, 2>{ 640, 480 }, std::array<int, 2>{ 1920, 1080 } }) {
+
+    const auto cam = get_demo_camera(size[0], size[1]);
+
+    std::vector<mvz::image_type> types;
+
+    for (const auto& output : outputs) {
+      types.emplace_back(output.second);
+    }
+
+    gl.render_offscreen(cam, scene, types);
+
+    glFinish();
+
+    for (const auto& output : outputs) {
+      s.run("readback",
+            { { "type", output.first }, { "width", std::to_string(size[0]) }, { "height", std::to_string(size[1]) } },
+            [&]() {
+              return time_ms([&]() {
+                gl.read_offscreen(output.second, 0);
+                gl.poll_readbacks(true);
+              });
+            });
+    }
+  }
+}
+
+#endif
+
+auto
+parse_options(const int argc, char** argv, options& opts) -> bool
+{
+  for (int i = 1; i < argc; i++) {
+
+    const std::string arg = argv[i];
+
+    if ((i + 1) >= argc) {
+      return false;
+    }
+
+    if (arg == "--iterations") {
+      opts.iterations = std::atoi(argv[++i]);
+    } else if (arg == "--filter") {
+      opts.filter = argv[++i];
+    } else if (arg == "--scratch") {
+      opts.scratch = argv[++i];
+    } else {
+      return false;
+    }
+  }
+
+  return opts.iterations > 0;
+}
+
+} // namespace
+
+auto
+main(int argc, char** argv) -> int
+{
+  options opts;
+
+  if (!parse_options(argc, argv, opts)) {
+    std::cerr << "usage: " << argv[0] << " [--iterations <n>] [--filter <text>] [--scratch <directory>]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  suite s(opts);
+
+  try {
+
+    if (s.enabled("obj_")) {
+      for (const auto n : get_grid_sizes()) {
+        if (!write_grid_obj(get_grid_path(opts, n), n)) {
+          std::cerr << "Failed to write '" << get_grid_path(opts, n) << "'." << std::endl;
+          return EXIT_FAILURE;
+        }
+      }
+    }
+
+    bench_obj_parse(s);
+
+    bench_skybox_decode(s);
+
+    bench_encode(s);
+
+#ifdef MVZ_BENCH_GL
+    mvz::headless_context context(640, 480);
+
+    mvz::session gl(mvz::headless_context::get_proc_address);
+
+    for (const auto name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+      const auto* value = reinterpret_cast<const char*>(glGetString(name));
+      s.set_context((name == GL_VENDOR) ? "gl_vendor" : ((name == GL_RENDERER) ? "gl_renderer" : "gl_version"),
+                    value ? value : "");
+    }
+
+    bench_obj_upload(s);
+
+    bench_render(s, gl);
+
+    bench_readback(s, gl);
+#endif
+
+  } catch (const mvz::runtime_error& err) {
+    std::cerr << err.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  s.write_json(std::cout);
+
+  return EXIT_SUCCESS;
+}
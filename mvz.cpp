@@ -1,7 +1,15 @@
 #include "mvz.h"
 
+#include "mvz_etc.h"
+#include "mvz_gl.h"
 #include "mvz_obj.h"
+#include "mvz_pool.h"
+#include "mvz_program_cache.h"
+#include "mvz_sh.h"
+#include "mvz_skybox.h"
+#include "mvz_specular.h"
 #include "mvz_stb.h"
+#include "mvz_transform.h"
 
 #include <glad/glad.h>
 
@@ -11,12 +19,17 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
 #include <array>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
 
 #include <cstddef>
+#include <cstring>
 
 CMRC_DECLARE(mvz_assets);
 
@@ -83,6 +96,21 @@ constexpr GLint diffuse_irradiance_texture_index{ 3 };
 
 constexpr GLint specular_irradiance_texture_index{ 4 };
 
+constexpr GLint depth_texture_index{ 5 };
+
+constexpr GLint normal_texture_index{ 6 };
+
+constexpr GLint num_image_types{ 4 };
+
+const std::array<std::pair<GLenum, const char*>, 6> skybox_face_files{
+  { { GL_TEXTURE_CUBE_MAP_POSITIVE_X, "/px.png" },
+    { GL_TEXTURE_CUBE_MAP_NEGATIVE_X, "/nx.png" },
+    { GL_TEXTURE_CUBE_MAP_POSITIVE_Y, "/py.png" },
+    { GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, "/ny.png" },
+    { GL_TEXTURE_CUBE_MAP_POSITIVE_Z, "/pz.png" },
+    { GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, "/nz.png" } }
+};
+
 auto
 create_texture(GLenum active_texture) -> GLuint
 {
@@ -110,7 +138,7 @@ create_cubemap(GLenum active_texture) -> GLuint
 
   CHECK_GL(glGenTextures(1, &texture));
 
-  CHECK_GL(glActiveTexture(GL_TEXTURE0 + skybox_texture_index));
+  CHECK_GL(glActiveTexture(active_texture));
 
   CHECK_GL(glBindTexture(GL_TEXTURE_CUBE_MAP, texture));
 
@@ -166,35 +194,110 @@ private:
   bool m_initialized{ false };
 };
 
+struct texture_format final
+{
+  GLint internal_format{ GL_RGBA };
+
+  GLenum format{ GL_RGBA };
+
+  GLenum type{ GL_UNSIGNED_BYTE };
+};
+
 template<GLenum texture_target, bool HasDepth>
 class framebuffer final : public gl_object
 {
 public:
-  framebuffer(const GLint w, const GLint h)
+  framebuffer(const GLint w, const GLint h, const texture_format& fmt = texture_format{}, GLenum depth_format = 0)
     : m_width(w)
     , m_height(h)
+    , m_format(fmt)
+    , m_depth_format(depth_format)
   {
   }
 
-protected:
-  void init_impl()
+  ~framebuffer() override { cleanup(); }
+
+  void bind() { CHECK_GL(glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer)); }
+
+  // Attaches a texture owned by another framebuffer, so that one pass can write to several targets.
+  void attach_color(const GLenum attachment, const GLuint texture)
   {
-    CHECK_GL(glGenTextures(1, &m_texture));
+    bind();
 
-    if (HasDepth) {
-      CHECK_GL(glGenRenderbuffers(1, &m_renderbuffer));
+    CHECK_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture, 0));
+  }
+
+  // Attaches a depth buffer owned by another framebuffer, so that a later pass can depth test against an earlier one.
+  void attach_depth(const GLuint renderbuffer)
+  {
+    bind();
+
+    CHECK_GL(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffer));
+  }
+
+  void check_status()
+  {
+    bind();
+
+    GLenum status{};
+
+    CHECK_GL_EXPR(status, glCheckFramebufferStatus, GL_FRAMEBUFFER);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+      std::ostringstream stream;
+      stream << "Framebuffer is incomplete (status 0x" << std::hex << status << ").";
+      throw open_gl_error(stream.str());
     }
+  }
+
+  auto texture() const -> GLuint { return m_texture; }
+
+  auto renderbuffer() const -> GLuint { return m_renderbuffer; }
+
+  auto width() const -> GLint { return m_width; }
+
+  auto height() const -> GLint { return m_height; }
+
+protected:
+  void init_impl() override
+  {
+    m_texture = create_texture(texture_target);
+
+    try {
+      CHECK_GL(glTexImage2D(
+        GL_TEXTURE_2D, 0, m_format.internal_format, m_width, m_height, 0, m_format.format, m_format.type, nullptr));
+
+      if (HasDepth) {
+        CHECK_GL(glGenRenderbuffers(1, &m_renderbuffer));
+        CHECK_GL(glBindRenderbuffer(GL_RENDERBUFFER, m_renderbuffer));
+        CHECK_GL(glRenderbufferStorage(GL_RENDERBUFFER, m_depth_format, m_width, m_height));
+      }
+
+      CHECK_GL(glGenFramebuffers(1, &m_framebuffer));
+
+      bind();
 
-    CHECK_GL(glGenFramebuffers(1, &m_framebuffer));
+      CHECK_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texture, 0));
+
+      if (HasDepth) {
+        CHECK_GL(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_renderbuffer));
+      }
+    } catch (...) {
+      cleanup_impl();
+      throw;
+    }
   }
 
-  void cleanup_impl()
+  void cleanup_impl() override
   {
-    CHECK_GL(glDeleteFramebuffers(1, &m_framebuffer));
-    CHECK_GL(glDeleteTextures(1, &m_texture));
+    glDeleteFramebuffers(1, &m_framebuffer);
+    glDeleteTextures(1, &m_texture);
     if (HasDepth) {
-      CHECK_GL(glDeleteRenderbuffers(1, &m_renderbuffer));
+      glDeleteRenderbuffers(1, &m_renderbuffer);
     }
+    m_framebuffer = 0;
+    m_texture = 0;
+    m_renderbuffer = 0;
   }
 
 private:
@@ -207,51 +310,98 @@ private:
   GLint m_width{};
 
   GLint m_height{};
+
+  texture_format m_format;
+
+  GLenum m_depth_format{};
 };
 
-class shader final
+// A #line directive that makes the line after it 'next_line'. GLSL ES 1.00, like desktop GLSL before 3.30, numbers
+// that line one past the value of the directive, and later versions with the value itself.
+auto
+get_line_directive(const std::string& version_line, const int next_line) -> std::string
 {
-public:
-  shader() = default;
+  std::istringstream stream(version_line);
 
-  shader(const shader&) = delete;
+  std::string directive;
+
+  int version{};
+
+  stream >> directive >> version;
+
+  const auto old_numbering = (directive != "#version") || (version < 300);
+
+  return "#line " + std::to_string(old_numbering ? (next_line - 1) : next_line) + "\n";
+}
 
-  void init(GLenum type, const char* path)
+// A shader submitted for compilation, deleted along with the object. Drivers with GL_KHR_parallel_shader_compile may
+// compile it in the background, so its status is only queried by check(), which waits for it.
+class shader final
+{
+public:
+  // The 'defines' are inserted after the #version line, which has to come first, and are followed by a #line directive
+  // so that the info log still refers to the lines of the file.
+  shader(GLenum type, const char* path, const std::string& defines = std::string())
+    : m_path(path)
   {
     const auto fs = cmrc::mvz_assets::get_filesystem();
 
     const auto file = fs.open(path);
 
-    const char* source_ptr = file.begin();
+    const std::string source(file.begin(), file.size());
+
+    const auto newline = source.find('\n');
+
+    const auto version_end = (newline == std::string::npos) ? source.size() : (newline + 1);
+
+    const auto preamble =
+      defines.empty() ? std::string() : (defines + get_line_directive(source.substr(0, version_end), 2));
+
+    const std::array<const char*, 3> source_ptrs{ source.data(), preamble.data(), source.data() + version_end };
 
-    const GLint source_len = static_cast<GLint>(file.size());
+    const std::array<GLint, 3> source_lens{ static_cast<GLint>(version_end),
+                                            static_cast<GLint>(preamble.size()),
+                                            static_cast<GLint>(source.size() - version_end) };
 
     CHECK_GL_EXPR(m_id, glCreateShader, type);
 
     try {
-      CHECK_GL(glShaderSource(m_id, 1, &source_ptr, &source_len));
+      CHECK_GL(glShaderSource(m_id, 3, source_ptrs.data(), source_lens.data()));
       CHECK_GL(glCompileShader(m_id));
-      GLint compile_status{ GL_FALSE };
-      CHECK_GL(glGetShaderiv(m_id, GL_COMPILE_STATUS, &compile_status));
-      if (compile_status == GL_TRUE) {
-        return;
-      }
     } catch (...) {
       glDeleteShader(m_id);
       throw;
     }
+  }
 
-    GLint log_length{};
+  shader(const shader&) = delete;
 
-    try {
-      CHECK_GL(glGetShaderiv(m_id, GL_INFO_LOG_LENGTH, &log_length));
-    } catch (...) {
-      glDeleteShader(m_id);
-      throw;
+  shader(shader&&) = delete;
+
+  auto operator=(const shader&) -> shader& = delete;
+
+  auto operator=(shader&&) -> shader& = delete;
+
+  ~shader() { glDeleteShader(m_id); }
+
+  auto id() const -> GLuint { return m_id; }
+
+  // Throws a glsl_error with the info log and the source as it was compiled if the shader did not compile.
+  void check() const
+  {
+    GLint compile_status{ GL_FALSE };
+
+    CHECK_GL(glGetShaderiv(m_id, GL_COMPILE_STATUS, &compile_status));
+
+    if (compile_status == GL_TRUE) {
+      return;
     }
 
+    GLint log_length{};
+
+    CHECK_GL(glGetShaderiv(m_id, GL_INFO_LOG_LENGTH, &log_length));
+
     if (log_length < 0) {
-      glDeleteShader(m_id);
       std::ostringstream stream;
       stream << "Shader log length of '" << log_length << "' is invalid.";
       throw runtime_error(stream.str());
@@ -263,15 +413,9 @@ public:
 
     GLsizei read_size{};
 
-    try {
-      CHECK_GL(glGetShaderInfoLog(m_id, log_length, &read_size, &log[0]));
-    } catch (...) {
-      glDeleteShader(m_id);
-      throw;
-    }
+    CHECK_GL(glGetShaderInfoLog(m_id, log_length, &read_size, &log[0]));
 
     if (read_size < 0) {
-      glDeleteShader(m_id);
       std::ostringstream stream;
       stream << "Shader log read size of '" << read_size << "' is invalid.";
       throw runtime_error(stream.str());
@@ -279,61 +423,155 @@ public:
 
     log.resize(static_cast<size_t>(read_size));
 
-    CHECK_GL(glDeleteShader(m_id));
+    GLint source_length{};
 
-    throw glsl_error(std::move(log), path, std::string(file.begin(), file.size()));
-  }
+    CHECK_GL(glGetShaderiv(m_id, GL_SHADER_SOURCE_LENGTH, &source_length));
+
+    std::string source;
+
+    source.resize(static_cast<size_t>(std::max(source_length, 1)));
+
+    GLsizei source_size{};
+
+    CHECK_GL(glGetShaderSource(m_id, static_cast<GLsizei>(source.size()), &source_size, &source[0]));
 
-  void cleanup() { glDeleteShader(m_id); }
+    source.resize(static_cast<size_t>(std::max(source_size, 0)));
 
-  auto id() -> GLuint { return m_id; }
+    throw glsl_error(std::move(log), m_path, std::move(source));
+  }
 
 private:
   GLuint m_id{};
+
+  std::string m_path;
 };
 
+// A program, deleted along with the object. Programs linked from shaders may also be linked in the background, see
+// is_complete() and check(). The shaders can be deleted once the program is checked.
 class program final
 {
 public:
-  void init(GLuint vert_shader, GLuint frag_shader)
+  program(const shader& vert_shader, const shader& frag_shader)
   {
     CHECK_GL_EXPR(m_id, glCreateProgram);
 
     try {
-      CHECK_GL(glAttachShader(m_id, vert_shader));
-      CHECK_GL(glAttachShader(m_id, frag_shader));
+      CHECK_GL(glAttachShader(m_id, vert_shader.id()));
+      CHECK_GL(glAttachShader(m_id, frag_shader.id()));
       CHECK_GL(glLinkProgram(m_id));
-      CHECK_GL(glDetachShader(m_id, vert_shader));
-      CHECK_GL(glDetachShader(m_id, frag_shader));
+      CHECK_GL(glDetachShader(m_id, vert_shader.id()));
+      CHECK_GL(glDetachShader(m_id, frag_shader.id()));
     } catch (...) {
       glDeleteProgram(m_id);
       throw;
     }
+  }
 
-    GLint link_status{};
+  // Loads a binary saved by get_binary(). Throws an open_gl_error if the driver does not take it, which can happen even
+  // when it made it, for example after an update.
+  explicit program(const program_binary& binary)
+  {
+    CHECK_GL_EXPR(m_id, glCreateProgram);
 
     try {
-      CHECK_GL(glGetProgramiv(m_id, GL_LINK_STATUS, &link_status));
+      CHECK_GL(glProgramBinary(
+        m_id, static_cast<GLenum>(binary.format), binary.data.data(), static_cast<GLsizei>(binary.data.size())));
+      check_link_status();
     } catch (...) {
       glDeleteProgram(m_id);
       throw;
     }
+  }
+
+  program(const program&) = delete;
+
+  program(program&&) = delete;
+
+  auto operator=(const program&) -> program& = delete;
+
+  auto operator=(program&&) -> program& = delete;
+
+  ~program() { glDeleteProgram(m_id); }
+
+  // Requires gl_features::parallel_shader_compile. Returns whether the shaders have been compiled and linked, so that
+  // check() would not have to wait.
+  auto is_complete() const -> bool
+  {
+    GLint status{ GL_FALSE };
+
+    CHECK_GL(glGetProgramiv(m_id, GL_COMPLETION_STATUS_KHR, &status));
+
+    return status == GL_TRUE;
+  }
+
+  // Waits for the shaders to be compiled and the program to be linked. Throws the glsl_error of a shader that did not
+  // compile, or an open_gl_error with the info log if the program did not link.
+  void check(const shader& vert_shader, const shader& frag_shader)
+  {
+    GLint link_status{};
+
+    CHECK_GL(glGetProgramiv(m_id, GL_LINK_STATUS, &link_status));
 
     if (link_status == GL_TRUE) {
       return;
     }
 
-    GLint log_length{};
+    vert_shader.check();
 
-    try {
-      CHECK_GL(glGetProgramiv(m_id, GL_INFO_LOG_LENGTH, &log_length));
-    } catch (...) {
-      glDeleteProgram(m_id);
-      throw;
+    frag_shader.check();
+
+    check_link_status();
+  }
+
+  // Requires gl_features::program_binary. Returns false if the driver has no binary to give.
+  auto get_binary(program_binary& binary) -> bool
+  {
+    GLint length{};
+
+    CHECK_GL(glGetProgramiv(m_id, GL_PROGRAM_BINARY_LENGTH, &length));
+
+    if (length <= 0) {
+      return false;
     }
 
+    binary.data.resize(static_cast<std::size_t>(length));
+
+    GLsizei written{};
+
+    GLenum format{};
+
+    CHECK_GL(glGetProgramBinary(m_id, length, &written, &format, binary.data.data()));
+
+    binary.data.resize(static_cast<std::size_t>(std::max(written, 0)));
+
+    binary.format = format;
+
+    return !binary.data.empty();
+  }
+
+  void use() { CHECK_GL(glUseProgram(m_id)); }
+
+  auto get_uniform_location(const char* name) -> GLint { return glGetUniformLocation(m_id, name); }
+
+  auto get_attribute_location(const char* name) -> GLint { return glGetAttribLocation(m_id, name); }
+
+private:
+  // Throws an open_gl_error with the info log if the program did not link.
+  void check_link_status()
+  {
+    GLint link_status{};
+
+    CHECK_GL(glGetProgramiv(m_id, GL_LINK_STATUS, &link_status));
+
+    if (link_status == GL_TRUE) {
+      return;
+    }
+
+    GLint log_length{};
+
+    CHECK_GL(glGetProgramiv(m_id, GL_INFO_LOG_LENGTH, &log_length));
+
     if (log_length < 0) {
-      glDeleteProgram(m_id);
       std::ostringstream stream;
       stream << "Invalid log length '" << log_length << "' for shader program.";
       throw runtime_error(stream.str());
@@ -345,34 +583,39 @@ public:
 
     GLsizei read_size{};
 
-    try {
-      CHECK_GL(glGetProgramInfoLog(m_id, log_length, &read_size, &info_log[0]));
-    } catch (...) {
-      glDeleteProgram(m_id);
-      throw;
-    }
+    CHECK_GL(glGetProgramInfoLog(m_id, log_length, &read_size, &info_log[0]));
 
     if (read_size < 0) {
-      glDeleteProgram(m_id);
       std::ostringstream stream;
       stream << "Invalid log read size '" << read_size << "' for shader program.";
       throw runtime_error(stream.str());
     }
 
-    CHECK_GL(glDeleteProgram(m_id));
-
     info_log.resize(static_cast<std::size_t>(read_size));
 
     throw open_gl_error(info_log);
   }
 
-  void cleanup() { glDeleteProgram(m_id); }
+  GLuint m_id{};
+};
 
-  void use() { CHECK_GL(glUseProgram(m_id)); }
+// A buffer object, deleted along with the object.
+class gl_buffer final
+{
+public:
+  gl_buffer() { CHECK_GL(glGenBuffers(1, &m_id)); }
 
-  auto get_uniform_location(const char* name) -> GLint { return glGetUniformLocation(m_id, name); }
+  gl_buffer(const gl_buffer&) = delete;
 
-  auto get_attribute_location(const char* name) -> GLint { return glGetAttribLocation(m_id, name); }
+  gl_buffer(gl_buffer&&) = delete;
+
+  auto operator=(const gl_buffer&) -> gl_buffer& = delete;
+
+  auto operator=(gl_buffer&&) -> gl_buffer& = delete;
+
+  ~gl_buffer() { glDeleteBuffers(1, &m_id); }
+
+  auto id() const -> GLuint { return m_id; }
 
 private:
   GLuint m_id{};
@@ -383,6 +626,8 @@ struct gl_obj_shape final
   std::vector<GLuint> meshes;
 
   std::vector<int> num_vertices;
+
+  std::vector<obj_material> materials;
 };
 
 struct gl_obj_file final
@@ -398,162 +643,242 @@ struct gl_obj_file final
 
 namespace {
 
+// Projects the diffuse irradiance of each skybox to spherical harmonics on the CPU, once per skybox. Shading a fragment
+// then takes evaluating a polynomial instead of integrating the sky, and switching skyboxes needs no GPU work.
 class irradiance_integrator final
 {
 public:
-private:
-  framebuffer<GL_TEXTURE0 + diffuse_irradiance_texture_index, false> m_diffuse_framebuffer;
+  auto integrate(const int skybox_id, const std::array<cube_face_view, 6>& faces) -> const sh9_irradiance&
+  {
+    auto it = m_cache.find(skybox_id);
 
-  framebuffer<GL_TEXTURE0 + specular_irradiance_texture_index, false> m_specular_framebuffer;
+    if (it == m_cache.end()) {
+      it = m_cache.emplace(skybox_id, project_irradiance(faces)).first;
+    }
+
+    return it->second;
+  }
+
+private:
+  std::map<int, sh9_irradiance> m_cache;
 };
 
+// The offscreen targets of a session. Every target shares the depth buffer of the color target: on contexts with MRT
+// the color framebuffer has all targets attached and one pass writes them all, otherwise each target has its own
+// framebuffer and is rendered in a depth-equal pass after the color pass.
 struct render_target final
 {
   framebuffer<GL_TEXTURE0 + color_texture_index, true> color;
 
-  framebuffer<GL_TEXTURE0 + segmentation_texture_index, true> segmentation;
+  framebuffer<GL_TEXTURE0 + segmentation_texture_index, false> segmentation;
+
+  framebuffer<GL_TEXTURE0 + depth_texture_index, false> depth;
 
-  render_target(GLint w, GLint h)
-    : color(w, h)
+  framebuffer<GL_TEXTURE0 + normal_texture_index, false> normal;
+
+  render_target(GLint w, GLint h, const texture_format& depth_fmt, GLenum depth_buffer_format)
+    : color(w, h, texture_format{}, depth_buffer_format)
     , segmentation(w, h)
+    , depth(w, h, depth_fmt)
+    , normal(w, h)
   {
   }
 
-  void init()
+  void init(const bool multiple_outputs)
   {
     color.init();
     segmentation.init();
+    depth.init();
+    normal.init();
+
+    segmentation.attach_depth(color.renderbuffer());
+    depth.attach_depth(color.renderbuffer());
+    normal.attach_depth(color.renderbuffer());
+
+    if (multiple_outputs) {
+      color.attach_color(GL_COLOR_ATTACHMENT0 + static_cast<GLenum>(image_type::segmentation), segmentation.texture());
+      color.attach_color(GL_COLOR_ATTACHMENT0 + static_cast<GLenum>(image_type::depth), depth.texture());
+      color.attach_color(GL_COLOR_ATTACHMENT0 + static_cast<GLenum>(image_type::normal), normal.texture());
+    }
+
+    color.check_status();
+    segmentation.check_status();
+    depth.check_status();
+    normal.check_status();
+  }
+
+  void bind(const image_type type)
+  {
+    switch (type) {
+      case image_type::color:
+        color.bind();
+        break;
+      case image_type::segmentation:
+        segmentation.bind();
+        break;
+      case image_type::depth:
+        depth.bind();
+        break;
+      case image_type::normal:
+        normal.bind();
+        break;
+    }
   }
+
+  auto width() const -> GLint { return color.width(); }
+
+  auto height() const -> GLint { return color.height(); }
 };
 
 } // namespace
 
-//============//
-// Public API //
-//============//
+//==========//
+// Readback //
+//==========//
 
-class session_impl final
+namespace {
+
+constexpr std::size_t readback_ring_size{ 3 };
+
+// Targets are always read as RGBA, which GLES guarantees to support, and compacted while being copied into the frame.
+struct readback_format final
 {
-public:
-  session_impl()
-  {
-    m_color_framebuffer.init();
+  GLenum type{ GL_UNSIGNED_BYTE };
 
-    try {
-      m_segmentation_framebuffer.init();
-    } catch (...) {
-      m_color_framebuffer.cleanup();
-      throw;
-    }
+  int source_pixel_size{ 4 };
 
-    try {
-      create_skybox_texture();
-    } catch (...) {
-      m_segmentation_framebuffer.cleanup();
-      m_color_framebuffer.cleanup();
-      throw;
-    }
+  int channels{ 3 };
 
-    try {
-      create_screen_quad();
-    } catch (...) {
-      m_segmentation_framebuffer.cleanup();
-      m_color_framebuffer.cleanup();
-      glDeleteTextures(1, &m_skybox_texture);
-      throw;
-    }
+  int channel_size{ 1 };
+};
 
-    try {
-      create_shaders();
-    } catch (...) {
-      glDeleteTextures(1, &m_skybox_texture);
-      glDeleteBuffers(1, &m_screen_quad);
-      m_segmentation_framebuffer.cleanup();
-      m_color_framebuffer.cleanup();
-      throw;
-    }
+auto
+get_readback_format(const image_type type, const depth_format fmt) -> readback_format
+{
+  if (type != image_type::depth) {
+    return readback_format{};
   }
 
-  ~session_impl()
-  {
-    m_color_framebuffer.cleanup();
-    m_segmentation_framebuffer.cleanup();
-    glDeleteTextures(1, &m_skybox_texture);
-    glDeleteBuffers(1, &m_screen_quad);
-    m_skybox_color_program.cleanup();
-    m_mesh_color_program.cleanup();
+  if (fmt == depth_format::float32) {
+    return readback_format{ GL_FLOAT, 16, 1, 4 };
   }
 
-  void render_current_fbo(const camera& cam, const std::vector<mesh_instance>& instances)
-  {
-    CHECK_GL(glEnable(GL_DEPTH_TEST));
+  return readback_format{ GL_UNSIGNED_BYTE, 4, 1, 2 };
+}
 
-    CHECK_GL(glViewport(0, 0, cam.resolution[0], cam.resolution[1]));
+// Converts the pixels of a target, which GL returns bottom row first, into the frame layout.
+void
+convert_pixels(const unsigned char* src, const readback_format& fmt, frame& dst)
+{
+  const auto w = static_cast<std::size_t>(dst.width);
+  const auto h = static_cast<std::size_t>(dst.height);
 
-    CHECK_GL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+  const auto src_stride = w * fmt.source_pixel_size;
+  const auto dst_stride = w * fmt.channels * fmt.channel_size;
 
-    render_skybox(cam);
+  for (std::size_t y = 0; y < h; y++) {
 
-    CHECK_GL(glClear(GL_DEPTH_BUFFER_BIT));
+    const auto* src_row = src + (h - 1 - y) * src_stride;
 
-    m_mesh_color_program.use();
+    auto* dst_row = dst.pixels.data() + y * dst_stride;
 
-    const auto pos_loc = m_mesh_color_program.get_attribute_location("position");
-    const auto texcoords_loc = m_mesh_color_program.get_attribute_location("texcoord");
-    const auto normal_loc = m_mesh_color_program.get_attribute_location("normal");
+    if (fmt.type == GL_FLOAT) {
+      for (std::size_t x = 0; x < w; x++) {
+        std::memcpy(dst_row + x * 4, src_row + x * 16, 4);
+      }
+    } else if (fmt.channel_size == 2) {
+      for (std::size_t x = 0; x < w; x++) {
+        const auto value = static_cast<std::uint16_t>((src_row[x * 4] << 8) | src_row[x * 4 + 1]);
+        std::memcpy(dst_row + x * 2, &value, 2);
+      }
+    } else {
+      for (std::size_t x = 0; x < w; x++) {
+        dst_row[x * 3 + 0] = src_row[x * 4 + 0];
+        dst_row[x * 3 + 1] = src_row[x * 4 + 1];
+        dst_row[x * 3 + 2] = src_row[x * 4 + 2];
+      }
+    }
+  }
+}
 
-    CHECK_GL(glEnableVertexAttribArray(pos_loc));
-    CHECK_GL(glEnableVertexAttribArray(texcoords_loc));
-    CHECK_GL(glEnableVertexAttribArray(normal_loc));
+struct pending_readback final
+{
+  GLuint buffer{};
 
-    CHECK_GL(glActiveTexture(GL_TEXTURE0 + skybox_texture_index));
-    CHECK_GL(glBindTexture(GL_TEXTURE_CUBE_MAP, m_skybox_texture));
-    CHECK_GL(glUniform1i(m_mesh_color_program.get_uniform_location("skybox"), skybox_texture_index));
+  GLsync fence{};
 
-    constexpr auto stride{ sizeof(float) * 8 };
+  readback_format format;
 
-    auto ptr_offset = [](std::size_t i) -> void* { return reinterpret_cast<void*>(i); };
+  frame result;
+};
 
-    const auto proj = glm::perspective(cam.fovy, cam.aspect, cam.near, cam.far);
+// A program whose shaders were submitted for compilation and linking, and whose status was not checked yet. The
+// shaders are kept for the info log in case it failed.
+struct pending_program final
+{
+  std::unique_ptr<program>* slot{};
 
-    const auto cam_pos = glm::vec3(cam.position.x, cam.position.y, cam.position.z);
-    const auto cam_rot = glm::mat3(get_rotation_matrix(cam));
+  std::shared_ptr<shader> vert_shader;
 
-    const auto view = glm::lookAt(cam_pos, cam_pos + cam_rot * glm::vec3(0, 0, -1), glm::vec3(0, 1, 0));
+  std::unique_ptr<shader> frag_shader;
 
-    const auto mvp_loc = m_mesh_color_program.get_uniform_location("mvp");
+  std::string cache_path;
+};
 
-    for (const auto& inst : instances) {
+} // namespace
 
-      continue;
+//===========//
+// Resources //
+//===========//
 
-      const glm::mat4 model_transform(1.0) /* TODO */;
+// A skybox of the pool, which is uploaded along with everything derived from it once, so that switching skyboxes only
+// binds different textures.
+struct gl_skybox final
+{
+  std::string path;
 
-      const glm::mat4 mvp = proj * view * model_transform;
+  GLuint texture{};
 
-      glUniformMatrix4fv(mvp_loc, 1, GL_FALSE, glm::value_ptr(mvp));
+  sh9_irradiance irradiance{};
 
-      const auto& file = m_gl_obj_files.at(inst.obj_id);
+  GLuint specular_texture{};
 
-      const auto& shp = file.shapes.at(inst.shape_index);
+  int specular_levels{};
+};
 
-      for (std::size_t i = 0; i < shp.meshes.size(); i++) {
+// The objects that sessions only read from, which can be shared by the contexts of a share group: the vertex buffers of
+// loaded OBJ files and the skybox. Loading is serialized, and objects are finished before they are published, so that
+// sessions on other contexts can use them right away.
+class resource_set final
+{
+public:
+  explicit resource_set(const gl_features& features)
+    : m_features(features)
+  {
+    for (const auto& path : list_rc_skyboxes()) {
+      m_skyboxes.emplace_back();
+      m_skyboxes.back().path = path;
+    }
 
-        const auto& m = shp.meshes.at(i);
+    if (m_skyboxes.empty()) {
+      throw runtime_error("There are no skyboxes built into the library.");
+    }
+  }
 
-        CHECK_GL(glBindBuffer(GL_ARRAY_BUFFER, m));
+  resource_set(const resource_set&) = delete;
 
-        CHECK_GL(glVertexAttribPointer(pos_loc, 3, GL_FLOAT, GL_FALSE, stride, ptr_offset(0)));
-        CHECK_GL(glVertexAttribPointer(texcoords_loc, 2, GL_FLOAT, GL_FALSE, stride, ptr_offset(sizeof(float) * 3)));
-        CHECK_GL(glVertexAttribPointer(normal_loc, 3, GL_FLOAT, GL_FALSE, stride, ptr_offset(sizeof(float) * 5)));
+  resource_set(resource_set&&) = delete;
 
-        CHECK_GL(glDrawArrays(GL_TRIANGLES, 0, shp.num_vertices.at(i)));
-      }
-    }
+  auto operator=(const resource_set&) -> resource_set& = delete;
+
+  auto operator=(resource_set&&) -> resource_set& = delete;
 
-    CHECK_GL(glDisableVertexAttribArray(pos_loc));
-    CHECK_GL(glDisableVertexAttribArray(texcoords_loc));
-    CHECK_GL(glDisableVertexAttribArray(normal_loc));
+  ~resource_set()
+  {
+    for (auto& entry : m_gl_obj_files) {
+      delete_gl_obj_file(entry.second);
+    }
+    delete_skybox_textures();
   }
 
   auto load_obj(const char* path) -> int
@@ -568,6 +893,11 @@ public:
 
     auto gl_file = create_gl_obj_file(file);
 
+    // Other contexts of the share group only see the buffers once they are complete.
+    glFinish();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
     const auto id = m_next_obj_id++;
 
     m_obj_files.emplace(id, std::move(file));
@@ -581,6 +911,8 @@ public:
 
   auto instance(const int obj_id, const char* shape) -> mesh_instance
   {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
     const auto& file = m_obj_files.at(obj_id);
 
     const auto shape_idx = file.find_shape(shape);
@@ -596,77 +928,178 @@ public:
     return instance;
   }
 
-  void set_development_mode(const bool state) { m_development_mode = state; }
+  // Files are never unloaded, so the shape stays valid after the lock is released.
+  auto get_shape(const int obj_id, const int shape_index) -> const gl_obj_shape&
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
 
-protected:
-  static auto get_rotation_matrix(const camera& cam) -> glm::mat4
+    return m_gl_obj_files.at(obj_id).shapes.at(shape_index);
+  }
+
+  // The pool does not change size after construction, so counting it needs no lock.
+  auto num_skyboxes() const -> int { return static_cast<int>(m_skyboxes.size()); }
+
+  auto skybox_texture(const int index) -> GLuint { return get_skybox(index).texture; }
+
+  auto skybox_irradiance(const int index) -> const sh9_irradiance& { return get_skybox(index).irradiance; }
+
+  // Loads the skyboxes that were not used yet, all at once, instead of each on first use.
+  void warmup()
   {
-    const auto x_rot = glm::rotate(glm::mat4(1.0), cam.rotation.x, glm::vec3(1, 0, 0));
-    const auto y_rot = glm::rotate(glm::mat4(1.0), cam.rotation.y, glm::vec3(0, 1, 0));
-    const auto z_rot = glm::rotate(glm::mat4(1.0), cam.rotation.z, glm::vec3(0, 0, 1));
-    return z_rot * y_rot * x_rot;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::vector<std::size_t> indices;
+
+    for (std::size_t i = 0; i < m_skyboxes.size(); i++) {
+      if (m_skyboxes[i].texture == 0) {
+        indices.emplace_back(i);
+      }
+    }
+
+    load_skyboxes(indices);
   }
 
-  void render_skybox(const camera& cam)
+  void set_cache_directory(std::string directory)
   {
-    CHECK_GL(glBindBuffer(GL_ARRAY_BUFFER, m_screen_quad));
+    std::lock_guard<std::mutex> lock(m_mutex);
 
-    m_skybox_color_program.use();
+    m_cache_directory = std::move(directory);
+  }
 
-    const auto pos_loc = m_skybox_color_program.get_attribute_location("position");
-    const auto rot_loc = m_skybox_color_program.get_uniform_location("camera_rotation");
-    const auto sky_loc = m_skybox_color_program.get_uniform_location("skybox");
+  auto cache_directory() -> std::string
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
 
-    CHECK_GL(glActiveTexture(GL_TEXTURE0 + skybox_texture_index));
+    return m_cache_directory;
+  }
 
-    CHECK_GL(glBindTexture(GL_TEXTURE_CUBE_MAP, m_skybox_texture));
+  // The prefiltered specular cube map is made on first use, or read from the cache directory if an earlier run left it
+  // there. The skybox that is returned has it, along with the number of levels of its chain.
+  auto specular_skybox(const int index) -> const gl_skybox&
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
 
-    CHECK_GL(glUniform1i(sky_loc, skybox_texture_index));
+    auto& sky = m_skyboxes.at(index);
 
-    const glm::mat3 rotation = get_rotation_matrix(cam);
+    if (sky.specular_texture == 0) {
+      sky.specular_texture = create_specular_texture(sky.path.c_str(), sky.specular_levels);
+    }
 
-    CHECK_GL(glUniformMatrix3fv(rot_loc, 1, GL_FALSE, glm::value_ptr(rotation)));
+    return sky;
+  }
 
-    CHECK_GL(glEnableVertexAttribArray(pos_loc));
+protected:
+  // Loaded skyboxes do not change other than gaining a specular texture, so the reference stays valid without the lock.
+  auto get_skybox(const int index) -> const gl_skybox&
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
 
-    CHECK_GL(glVertexAttribPointer(pos_loc, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, reinterpret_cast<void*>(0)));
+    auto& sky = m_skyboxes.at(index);
 
-    CHECK_GL(glDrawArrays(GL_TRIANGLES, 0, 6));
+    if (sky.texture == 0) {
+      load_skyboxes({ static_cast<std::size_t>(index) });
+    }
 
-    glDisableVertexAttribArray(pos_loc);
+    return sky;
   }
 
-  void open_internal_skybox(const char* prefix)
+  void open_internal_skybox(const int id, rc_image_decoder& decoder, gl_skybox& sky)
   {
-    const std::array<std::pair<GLenum, const char*>, 6> entries{ { { GL_TEXTURE_CUBE_MAP_POSITIVE_X, "/px.png" },
-                                                                   { GL_TEXTURE_CUBE_MAP_NEGATIVE_X, "/nx.png" },
-                                                                   { GL_TEXTURE_CUBE_MAP_POSITIVE_Y, "/py.png" },
-                                                                   { GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, "/ny.png" },
-                                                                   { GL_TEXTURE_CUBE_MAP_POSITIVE_Z, "/pz.png" },
-                                                                   { GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, "/nz.png" } } };
+    skybox_faces faces;
+
+    faces.load(decoder, sky.path);
 
     glActiveTexture(GL_TEXTURE0 + skybox_texture_index);
 
-    CHECK_GL(glBindTexture(GL_TEXTURE_CUBE_MAP, m_skybox_texture));
+    CHECK_GL(glBindTexture(GL_TEXTURE_CUBE_MAP, sky.texture));
+
+    for (std::size_t i = 0; i < faces.views().size(); i++) {
+      const auto& face = faces.views()[i];
+      CHECK_GL(glTexImage2D(
+        skybox_face_files[i].first, 0, GL_RGBA, face.width, face.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, face.pixels));
+    }
+
+    sky.irradiance = m_irradiance.integrate(id, faces.views());
+  }
+
+  // Only succeeds for skyboxes with an ETC copy that the context can sample.
+  auto open_rc_compressed_skybox(const std::string& prefix, ktx_cubemap& cubemap) const -> bool
+  {
+    return m_features.etc1 && open_rc_ktx_cubemap((prefix + "/cubemap.ktx").c_str(), cubemap) &&
+           is_complete_etc1(cubemap);
+  }
+
+  static auto is_complete_etc1(const ktx_cubemap& cubemap) -> bool
+  {
+    if ((cubemap.internal_format != etc1_internal_format) || (cubemap.num_levels < 1)) {
+      return false;
+    }
+
+    if ((cubemap.size >> (cubemap.num_levels - 1)) != 1) {
+      return false;
+    }
+
+    for (int level = 0; level < cubemap.num_levels; level++) {
+      const auto size = cubemap.size >> level;
+      for (int face = 0; face < 6; face++) {
+        if (cubemap.faces[level * 6 + face].size() != get_etc1_size(size, size)) {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
 
-    for (const auto& entry : entries) {
+  // Uploads the blocks as they are. ETC1 is a subset of ETC2, which every GLES 3.0 context supports, so the extension
+  // is only needed on GLES 2.0. The irradiance is projected from a decoded level of about the size it would be reduced
+  // to anyway.
+  void open_compressed_skybox(const int id, const ktx_cubemap& cubemap, gl_skybox& sky)
+  {
+    glActiveTexture(GL_TEXTURE0 + skybox_texture_index);
 
-      const std::string path = std::string(prefix) + entry.second;
+    CHECK_GL(glBindTexture(GL_TEXTURE_CUBE_MAP, sky.texture));
 
-      const GLenum target = entry.first;
+    const GLenum format = m_features.gles3 ? GL_COMPRESSED_RGB8_ETC2 : GL_ETC1_RGB8_OES;
 
-      int w{};
-      int h{};
+    CHECK_GL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
 
-      const auto data = open_rc_image(path.c_str(), &w, &h);
-      if (!data) {
-        std::ostringstream stream;
-        stream << "Failed to open internal skybox '" << path << "'.";
-        throw runtime_error(stream.str());
+    for (int level = 0; level < cubemap.num_levels; level++) {
+      const auto size = cubemap.size >> level;
+      for (int face = 0; face < 6; face++) {
+        const auto& data = cubemap.faces[level * 6 + face];
+        CHECK_GL(glCompressedTexImage2D(skybox_face_files[face].first,
+                                        level,
+                                        format,
+                                        size,
+                                        size,
+                                        0,
+                                        static_cast<GLsizei>(data.size()),
+                                        data.data()));
       }
+    }
+
+    int level{};
+
+    while (((cubemap.size >> level) > 128) && ((level + 1) < cubemap.num_levels)) {
+      level++;
+    }
 
-      CHECK_GL(glTexImage2D(target, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data.get()));
+    const auto size = cubemap.size >> level;
+
+    std::vector<unsigned char> pixels(static_cast<std::size_t>(size) * size * 4 * 6);
+
+    std::array<cube_face_view, 6> faces;
+
+    for (int face = 0; face < 6; face++) {
+      auto* face_pixels = pixels.data() + static_cast<std::size_t>(size) * size * 4 * face;
+      decode_etc1(cubemap.faces[level * 6 + face].data(), size, size, face_pixels);
+      faces[face].pixels = face_pixels;
+      faces[face].width = size;
+      faces[face].height = size;
     }
+
+    sky.irradiance = m_irradiance.integrate(id, faces);
   }
 
   auto create_gl_obj_file(const obj_file& f) -> gl_obj_file
@@ -687,27 +1120,31 @@ protected:
 
       shp.num_vertices.resize(num_meshes);
 
+      shp.materials.resize(num_meshes);
+
       for (std::size_t j = 0; j < num_meshes; j++) {
 
         try {
           CHECK_GL(glGenBuffers(1, &shp.meshes.at(j)));
         } catch (...) {
-          if (j > 0) {
-            glDeleteBuffers(j - 1, shp.meshes.data());
-          }
+          delete_gl_obj_file(file);
+          throw;
         }
 
         auto id = shp.meshes.at(j);
 
         shp.num_vertices[j] = f.shapes.at(i).meshes.at(j).num_vertices;
 
+        shp.materials[j] = f.shapes.at(i).meshes.at(j).material;
+
         const auto& data = f.shapes.at(i).meshes.at(j).vertices;
 
         try {
           CHECK_GL(glBindBuffer(GL_ARRAY_BUFFER, id));
           CHECK_GL(glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(data[0]), data.data(), GL_STATIC_DRAW));
         } catch (...) {
-          glDeleteBuffers(j, shp.meshes.data());
+          delete_gl_obj_file(file);
+          throw;
         }
       }
     }
@@ -715,111 +1152,177 @@ protected:
     return file;
   }
 
-  // initialization routines
-
-  void create_mesh_shaders()
+  static void delete_gl_obj_file(gl_obj_file& file)
   {
-    shader mesh_vert_shader;
-    mesh_vert_shader.init(GL_VERTEX_SHADER, "assets/shaders/mesh.vert");
+    for (auto& shp : file.shapes) {
+      for (auto& buffer : shp.meshes) {
+        if (buffer != 0) {
+          glDeleteBuffers(1, &buffer);
+        }
+        buffer = 0;
+      }
+    }
+  }
 
-    shader mesh_color_frag_shader;
+  // Cube map arrays would need GLES 3.2 or an extension, so every skybox is a cube map of its own.
+  //
+  // The faces of the skyboxes without a usable compressed copy are decoded on worker threads up front, and uploaded in
+  // order on this thread as they come in. Has to be called with the lock held.
+  void load_skyboxes(const std::vector<std::size_t>& indices)
+  {
+    if (indices.empty()) {
+      return;
+    }
 
     try {
-      mesh_color_frag_shader.init(GL_FRAGMENT_SHADER, "assets/shaders/mesh_color.frag");
-    } catch (...) {
-      mesh_vert_shader.cleanup();
+      std::vector<ktx_cubemap> compressed(indices.size());
+
+      std::vector<std::string> face_paths;
+
+      for (std::size_t i = 0; i < indices.size(); i++) {
+        const auto& path = m_skyboxes.at(indices[i]).path;
+        if (!open_rc_compressed_skybox(path, compressed[i])) {
+          compressed[i].num_levels = 0;
+          for (auto& image_path : get_skybox_images(path)) {
+            face_paths.emplace_back(std::move(image_path));
+          }
+        }
+      }
+
+      rc_image_decoder decoder(std::move(face_paths));
+
+      for (std::size_t i = 0; i < indices.size(); i++) {
+
+        const auto id = static_cast<int>(indices[i]);
+
+        auto& sky = m_skyboxes[indices[i]];
+
+        sky.texture = create_cubemap(GL_TEXTURE0 + skybox_texture_index);
+
+        if (compressed[i].num_levels > 0) {
+          open_compressed_skybox(id, compressed[i], sky);
+          compressed[i] = ktx_cubemap();
+        } else {
+          open_internal_skybox(id, decoder, sky);
+        }
+      }
+    } catch (const std::exception&) {
+      for (const auto index : indices) {
+        auto& sky = m_skyboxes[index];
+        if (sky.texture != 0) {
+          glDeleteTextures(1, &sky.texture);
+          sky.texture = 0;
+        }
+      }
       throw;
     }
 
-    try {
-      m_mesh_color_program.init(mesh_vert_shader.id(), mesh_color_frag_shader.id());
-    } catch (...) {
-      mesh_vert_shader.cleanup();
-      mesh_color_frag_shader.cleanup();
-    }
+    // Other contexts of the share group only see the textures once they are complete.
+    glFinish();
   }
 
-  void create_skybox_texture()
+  void delete_skybox_textures()
   {
-    m_skybox_texture = create_cubemap(GL_TEXTURE0 + skybox_texture_index);
-
-    try {
-      open_internal_skybox("assets/skyboxes/DaySkyHDRI017B");
-    } catch (const std::exception&) {
-      glDeleteTextures(1, &m_skybox_texture);
-      throw;
+    for (auto& sky : m_skyboxes) {
+      if (sky.texture != 0) {
+        glDeleteTextures(1, &sky.texture);
+      }
+      if (sky.specular_texture != 0) {
+        glDeleteTextures(1, &sky.specular_texture);
+      }
     }
+    m_skyboxes.clear();
   }
 
-  void create_skybox_shaders()
+  auto get_specular_chain(const char* prefix) -> specular_chain
   {
-    shader skybox_vert_shader;
-    skybox_vert_shader.init(GL_VERTEX_SHADER, "assets/shaders/skybox.vert");
+    const auto fs = cmrc::mvz_assets::get_filesystem();
 
-    shader skybox_color_frag_shader;
-    try {
-      skybox_color_frag_shader.init(GL_FRAGMENT_SHADER, "assets/shaders/skybox_color.frag");
-    } catch (...) {
-      skybox_vert_shader.cleanup();
-      throw;
+    const auto image_paths = get_skybox_images(prefix);
+
+    auto hash = hash_bytes(nullptr, 0);
+
+    for (const auto& path : image_paths) {
+      const auto file = fs.open(path);
+      hash = hash_bytes(file.begin(), file.size(), hash);
     }
 
-    try {
-      m_skybox_color_program.init(skybox_vert_shader.id(), skybox_color_frag_shader.id());
-    } catch (...) {
-      skybox_color_frag_shader.cleanup();
-      skybox_vert_shader.cleanup();
+    std::string cache_path;
+
+    if (!m_cache_directory.empty()) {
+
+      cache_path = m_cache_directory + "/" + get_specular_cache_name(hash);
+
+      specular_chain chain;
+
+      if (load_specular_chain(cache_path, chain)) {
+        return chain;
+      }
+    }
+
+    rc_image_decoder decoder(image_paths);
+
+    skybox_faces faces;
+
+    faces.load(decoder, prefix);
+
+    auto chain = prefilter_specular(faces.views());
+
+    // A cache that cannot be written only costs the next session the time to prefilter again.
+    if (!cache_path.empty()) {
+      save_specular_chain(cache_path, chain);
     }
 
-    skybox_vert_shader.cleanup();
-    skybox_color_frag_shader.cleanup();
+    return chain;
   }
 
-  void create_shaders()
+  auto create_specular_texture(const char* prefix, int& num_levels) -> GLuint
   {
-    create_skybox_shaders();
+    const auto chain = get_specular_chain(prefix);
+
+    const auto texture = create_cubemap(GL_TEXTURE0 + specular_irradiance_texture_index);
 
     try {
-      create_mesh_shaders();
+      CHECK_GL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
+      CHECK_GL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+
+      for (int level = 0; level < chain.num_levels; level++) {
+        const auto size = chain.size >> level;
+        for (int face = 0; face < 6; face++) {
+          CHECK_GL(glTexImage2D(skybox_face_files[face].first,
+                                level,
+                                GL_RGBA,
+                                size,
+                                size,
+                                0,
+                                GL_RGBA,
+                                GL_UNSIGNED_BYTE,
+                                chain.face(level, face).data()));
+        }
+      }
     } catch (...) {
-      m_skybox_color_program.cleanup();
+      glDeleteTextures(1, &texture);
       throw;
-      // TODO : add the segmentation fragment shader as well
     }
-  }
 
-  void create_screen_quad()
-  {
-    CHECK_GL(glGenBuffers(1, &m_screen_quad));
-
-    glBindBuffer(GL_ARRAY_BUFFER, m_screen_quad);
+    // Other contexts of the share group only see the texture once it is complete.
+    glFinish();
 
-    const std::array<float, 12> data{
-      // clang-format off
-      0, 0,
-      0, 1,
-      1, 1,
-      1, 1,
-      1, 0,
-      0, 0
-      // clang-format on
-    };
+    num_levels = chain.num_levels;
 
-    glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(data[0]), data.data(), GL_STATIC_DRAW);
+    return texture;
   }
 
 private:
-  framebuffer<GL_TEXTURE0 + color_texture_index, true> m_color_framebuffer;
+  gl_features m_features;
 
-  framebuffer<GL_TEXTURE0 + segmentation_texture_index, true> m_segmentation_framebuffer;
+  std::mutex m_mutex;
 
-  program m_skybox_color_program;
+  std::string m_cache_directory;
 
-  program m_mesh_color_program;
+  std::vector<gl_skybox> m_skyboxes;
 
-  GLuint m_skybox_texture{};
-
-  GLuint m_screen_quad{};
+  irradiance_integrator m_irradiance;
 
   std::map<int, obj_file> m_obj_files;
 
@@ -828,44 +1331,1125 @@ private:
   std::map<int, gl_obj_file> m_gl_obj_files;
 
   int m_next_obj_id{};
-
-  bool m_development_mode{ false };
 };
 
-session::session(gl_get_func func)
-{
-  gladLoadGLES2Loader(reinterpret_cast<GLADloadproc>(func));
+//============//
+// Public API //
+//============//
 
-  m_impl = new session_impl();
-}
+namespace {
 
-session::~session()
+// Selects the variant of mesh.frag that a draw needs: one bit per image_type for the outputs it writes,
+// multiple_outputs_bit to write them through GL_EXT_draw_buffers, and glossy_bit for the meshes with glossy materials.
+// Variants are compiled the first time they are drawn with, so only the combinations that a session renders are ever
+// compiled.
+using mesh_outputs = unsigned int;
+
+constexpr mesh_outputs multiple_outputs_bit{ 1u << num_image_types };
+
+constexpr mesh_outputs glossy_bit{ multiple_outputs_bit << 1 };
+
+constexpr std::size_t num_mesh_variants{ glossy_bit << 1 };
+
+// Which meshes of the instances a draw covers.
+enum class mesh_selection
 {
-  delete m_impl;
-}
+  all,
+  matte,
+  glossy
+};
 
-void
-session::set_development_mode(const bool enabled)
+auto
+get_output_bit(const image_type type) -> mesh_outputs
 {
-  m_impl->set_development_mode(enabled);
+  return 1u << static_cast<unsigned int>(type);
 }
 
 auto
-session::load_obj(const char* path) -> int
+get_mesh_defines(const mesh_outputs outputs) -> std::string
 {
-  return m_impl->load_obj(path);
+  const std::array<const char*, num_image_types> names{
+    "MVZ_OUTPUT_COLOR", "MVZ_OUTPUT_SEGMENTATION", "MVZ_OUTPUT_DEPTH", "MVZ_OUTPUT_NORMAL"
+  };
+
+  std::string defines;
+
+  for (std::size_t i = 0; i < names.size(); i++) {
+    if (outputs & get_output_bit(static_cast<image_type>(i))) {
+      defines += std::string("#define ") + names[i] + "\n";
+    }
+  }
+
+  if (outputs & multiple_outputs_bit) {
+    defines += "#define MVZ_MULTIPLE_OUTPUTS\n";
+  }
+
+  if (outputs & glossy_bit) {
+    defines += "#define MVZ_GLOSSY\n";
+  }
+
+  return defines;
 }
 
-auto
-session::instance(int obj_id, const char* shape) -> mesh_instance
+} // namespace
+
+class session_impl final
 {
-  return m_impl->instance(obj_id, shape);
+public:
+  session_impl(const gl_features& features, std::shared_ptr<resource_set> resources)
+    : m_resources(resources ? std::move(resources) : std::make_shared<resource_set>(features))
+    , m_features(features)
+  {
+  }
+
+  ~session_impl()
+  {
+    for (auto& r : m_pending_readbacks) {
+      glDeleteSync(r.fence);
+    }
+    if (m_readback_buffers[0] != 0) {
+      glDeleteBuffers(static_cast<GLsizei>(m_readback_buffers.size()), m_readback_buffers.data());
+    }
+  }
+
+  // Creates what renders would otherwise create on first use, except for the render targets, which depend on the
+  // camera resolution.
+  //
+  // All the programs are submitted before the skyboxes are decoded, so that a driver that compiles in the background
+  // does so meanwhile. Programs that are still compiling afterwards are checked on first use, which leaves the driver
+  // time until then, for example while meshes are loaded.
+  void warmup()
+  {
+    get_screen_quad();
+
+    submit_program(
+      m_skybox_color_program, "assets/shaders/skybox.vert", "assets/shaders/skybox_color.frag", nullptr, std::string());
+
+    mesh_outputs all_outputs{};
+
+    for (GLint i = 0; i < num_image_types; i++) {
+      const auto bit = get_output_bit(static_cast<image_type>(i));
+      submit_mesh_program(bit);
+      all_outputs |= bit;
+    }
+
+    if (supports_multiple_outputs()) {
+      submit_mesh_program(all_outputs | multiple_outputs_bit);
+    }
+
+    m_resources->warmup();
+
+    check_programs(!m_features.parallel_shader_compile);
+  }
+
+  void render_offscreen(const camera& cam,
+                        const std::vector<mesh_instance>& instances,
+                        const std::vector<image_type>& outputs)
+  {
+    GLint prev_framebuffer{};
+
+    CHECK_GL(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_framebuffer));
+
+    try {
+      prepare_render_target(cam.resolution[0], cam.resolution[1]);
+
+      m_render_target->bind(image_type::color);
+
+      if (supports_multiple_outputs()) {
+        render_multiple(cam, instances, outputs);
+      } else {
+        render_separate(cam, instances, outputs);
+      }
+    } catch (...) {
+      glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(prev_framebuffer));
+      throw;
+    }
+
+    CHECK_GL(glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(prev_framebuffer)));
+  }
+
+  void render_current_fbo(const camera& cam, const std::vector<mesh_instance>& instances, const image_type type)
+  {
+    if (type == image_type::color) {
+      render_color(cam, instances);
+    } else {
+      render_auxiliary(cam, instances, type);
+    }
+  }
+
+  void render_current_fbo(const camera& cam,
+                          const std::vector<mesh_instance>& instances,
+                          const std::vector<image_type>& outputs)
+  {
+    if (outputs.size() == 1) {
+      render_current_fbo(cam, instances, outputs[0]);
+      return;
+    }
+
+    if (!supports_multiple_outputs()) {
+      throw runtime_error("Rendering several outputs in one pass requires GL_EXT_draw_buffers.");
+    }
+
+    render_multiple(cam, instances, outputs);
+  }
+
+  void read_offscreen(const image_type type, const std::uint64_t index)
+  {
+    if (!m_render_target) {
+      throw runtime_error("There is no offscreen render to read back.");
+    }
+
+    if (!m_readback_callback) {
+      throw runtime_error("A readback callback has to be set before reading back.");
+    }
+
+    frame f;
+    f.type = type;
+    f.index = index;
+    f.width = m_render_target->width();
+    f.height = m_render_target->height();
+
+    const auto fmt = get_readback_format(type, m_depth_format);
+
+    f.channels = fmt.channels;
+    f.channel_size = fmt.channel_size;
+
+    GLint prev_framebuffer{};
+
+    CHECK_GL(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_framebuffer));
+
+    try {
+      m_render_target->bind(type);
+
+      if (m_features.async_readback) {
+        queue_readback(std::move(f), fmt);
+      } else {
+        read_pixels(f, fmt);
+      }
+    } catch (...) {
+      glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(prev_framebuffer));
+      throw;
+    }
+
+    CHECK_GL(glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(prev_framebuffer)));
+
+    if (!m_features.async_readback) {
+      m_readback_callback(std::move(f));
+    }
+  }
+
+  void poll_readbacks(const bool wait)
+  {
+    while (!m_pending_readbacks.empty() && complete_readback(wait)) {
+    }
+  }
+
+  void set_readback_callback(readback_callback callback) { m_readback_callback = std::move(callback); }
+
+  void recycle(frame&& f) { m_pixel_pool.release(std::move(f.pixels)); }
+
+  auto supports_multiple_outputs() const -> bool
+  {
+    return m_features.draw_buffers && (m_features.max_draw_buffers >= num_image_types);
+  }
+
+  void set_depth_format(const depth_format format)
+  {
+    if ((format == depth_format::float32) && !m_features.color_buffer_float) {
+      throw runtime_error("Floating point depth output requires GL_EXT_color_buffer_float.");
+    }
+
+    if (m_depth_format != format) {
+      m_depth_format = format;
+      m_render_target.reset();
+    }
+  }
+
+  void set_normal_space(const normal_space space) { m_normal_space = space; }
+
+  auto load_obj(const char* path) -> int { return m_resources->load_obj(path); }
+
+  auto instance(const int obj_id, const char* shape) -> mesh_instance { return m_resources->instance(obj_id, shape); }
+
+  void set_development_mode(const bool state) { m_development_mode = state; }
+
+  void set_cache_directory(const char* path) { m_resources->set_cache_directory(path); }
+
+  auto num_skyboxes() const -> int { return m_resources->num_skyboxes(); }
+
+  void set_skybox(const int index)
+  {
+    if ((index < 0) || (index >= m_resources->num_skyboxes())) {
+      std::ostringstream stream;
+      stream << "Skybox index '" << index << "' is out of range, there are " << m_resources->num_skyboxes() << '.';
+      throw runtime_error(stream.str());
+    }
+
+    m_skybox_index = index;
+  }
+
+protected:
+  // Segmentation IDs are spread eight bits per channel across RGB, so that they survive an RGB8 color buffer exactly.
+  static auto pack_instance_id(const std::size_t instance_index) -> glm::vec3
+  {
+    const auto id = get_instance_id(instance_index);
+    const auto r = static_cast<float>(id & 0xff);
+    const auto g = static_cast<float>((id >> 8) & 0xff);
+    const auto b = static_cast<float>((id >> 16) & 0xff);
+    return glm::vec3(r, g, b) / 255.0f;
+  }
+
+  // Synchronous fallback for contexts without pixel pack buffers.
+  void read_pixels(frame& f, const readback_format& fmt)
+  {
+    m_readback_scratch.resize(static_cast<std::size_t>(f.width) * f.height * fmt.source_pixel_size);
+
+    CHECK_GL(glReadPixels(0, 0, f.width, f.height, GL_RGBA, fmt.type, m_readback_scratch.data()));
+
+    f.pixels = m_pixel_pool.acquire(static_cast<std::size_t>(f.width) * f.height * fmt.channels * fmt.channel_size);
+
+    convert_pixels(m_readback_scratch.data(), fmt, f);
+  }
+
+  void queue_readback(frame&& f, const readback_format& fmt)
+  {
+    if (m_readback_buffers[0] == 0) {
+      CHECK_GL(glGenBuffers(static_cast<GLsizei>(m_readback_buffers.size()), m_readback_buffers.data()));
+    }
+
+    // The ring is used in order, so the buffer to write to next is free once the oldest readback has completed.
+    if (m_pending_readbacks.size() == m_readback_buffers.size()) {
+      complete_readback(true);
+    }
+
+    const auto slot = m_next_readback_buffer;
+
+    const auto size = static_cast<std::size_t>(f.width) * f.height * fmt.source_pixel_size;
+
+    pending_readback r;
+    r.buffer = m_readback_buffers[slot];
+    r.format = fmt;
+    r.result = std::move(f);
+
+    CHECK_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, r.buffer));
+
+    try {
+      if (m_readback_buffer_sizes[slot] < size) {
+        CHECK_GL(glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(size), nullptr, GL_STREAM_READ));
+        m_readback_buffer_sizes[slot] = size;
+      }
+
+      CHECK_GL(glReadPixels(0, 0, r.result.width, r.result.height, GL_RGBA, fmt.type, nullptr));
+
+      CHECK_GL_EXPR(r.fence, glFenceSync, GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    } catch (...) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      throw;
+    }
+
+    CHECK_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+    // Makes sure the fence gets submitted, so that polling without a flush can eventually see it signaled.
+    CHECK_GL(glFlush());
+
+    m_pending_readbacks.emplace_back(std::move(r));
+
+    m_next_readback_buffer = (slot + 1) % m_readback_buffers.size();
+  }
+
+  auto complete_readback(const bool wait) -> bool
+  {
+    auto& r = m_pending_readbacks.front();
+
+    constexpr GLuint64 wait_timeout{ 1000000000 };
+
+    GLenum status{};
+
+    do {
+      CHECK_GL_EXPR(status, glClientWaitSync, r.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? wait_timeout : 0);
+    } while (wait && (status == GL_TIMEOUT_EXPIRED));
+
+    if (status == GL_TIMEOUT_EXPIRED) {
+      return false;
+    }
+
+    if (status == GL_WAIT_FAILED) {
+      throw open_gl_error("Failed to wait for a readback to complete.");
+    }
+
+    auto f = std::move(r.result);
+
+    const auto fmt = r.format;
+
+    const auto buffer = r.buffer;
+
+    glDeleteSync(r.fence);
+
+    m_pending_readbacks.pop_front();
+
+    const auto size = static_cast<std::size_t>(f.width) * f.height * fmt.source_pixel_size;
+
+    f.pixels = m_pixel_pool.acquire(static_cast<std::size_t>(f.width) * f.height * fmt.channels * fmt.channel_size);
+
+    CHECK_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer));
+
+    try {
+      const void* src{};
+
+      CHECK_GL_EXPR(src, glMapBufferRange, GL_PIXEL_PACK_BUFFER, 0, static_cast<GLsizeiptr>(size), GL_MAP_READ_BIT);
+
+      convert_pixels(static_cast<const unsigned char*>(src), fmt, f);
+
+      CHECK_GL(glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+    } catch (...) {
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      throw;
+    }
+
+    CHECK_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+    m_readback_callback(std::move(f));
+
+    return true;
+  }
+
+  void prepare_render_target(const GLint w, const GLint h)
+  {
+    if (m_render_target && (m_render_target->width() == w) && (m_render_target->height() == h)) {
+      return;
+    }
+
+    m_render_target.reset();
+
+    const auto depth_fmt = (m_depth_format == depth_format::float32) ? texture_format{ GL_R32F, GL_RED, GL_FLOAT }
+                                                                     : texture_format{};
+
+    const GLenum depth_buffer_format = m_features.depth24 ? GL_DEPTH_COMPONENT24_OES : GL_DEPTH_COMPONENT16;
+
+    auto target = std::make_unique<render_target>(w, h, depth_fmt, depth_buffer_format);
+
+    target->init(supports_multiple_outputs());
+
+    m_render_target = std::move(target);
+  }
+
+  // The first pass fills the shared depth buffer, and the others only shade what it left visible. When color is not
+  // requested, the first pass is one of the other outputs, so that jobs without color never need the sky.
+  void render_separate(const camera& cam,
+                       const std::vector<mesh_instance>& instances,
+                       const std::vector<image_type>& outputs)
+  {
+    const auto wants_color =
+      outputs.empty() || (std::find(outputs.begin(), outputs.end(), image_type::color) != outputs.end());
+
+    if (wants_color) {
+      render_color(cam, instances);
+    }
+
+    for (const auto type : outputs) {
+      if (type == image_type::color) {
+        continue;
+      }
+      m_render_target->bind(type);
+      render_auxiliary(cam, instances, type, wants_color || (type != outputs.front()));
+    }
+  }
+
+  void render_color(const camera& cam, const std::vector<mesh_instance>& instances)
+  {
+    CHECK_GL(glEnable(GL_DEPTH_TEST));
+    CHECK_GL(glDepthFunc(GL_LESS));
+    CHECK_GL(glDepthMask(GL_TRUE));
+
+    CHECK_GL(glViewport(0, 0, cam.resolution[0], cam.resolution[1]));
+
+    CHECK_GL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+
+    render_skybox(cam);
+
+    CHECK_GL(glClear(GL_DEPTH_BUFFER_BIT));
+
+    render_meshes(get_output_bit(image_type::color), cam, instances);
+  }
+
+  // Reuses the depth buffer left behind by the color pass of the same scene. With GL_EQUAL and depth writes off, only
+  // the surfaces that were visible in the color pass get shaded, which keeps this pass cheap on contexts without MRT.
+  // Without 'depth_equal', the pass fills the depth buffer itself, the way the color pass would.
+  void render_auxiliary(const camera& cam,
+                        const std::vector<mesh_instance>& instances,
+                        const image_type type,
+                        const bool depth_equal = true)
+  {
+    CHECK_GL(glEnable(GL_DEPTH_TEST));
+    CHECK_GL(glDepthFunc(depth_equal ? GL_EQUAL : GL_LESS));
+    CHECK_GL(glDepthMask(depth_equal ? GL_FALSE : GL_TRUE));
+
+    CHECK_GL(glViewport(0, 0, cam.resolution[0], cam.resolution[1]));
+
+    CHECK_GL(glClearColor(0, 0, 0, 0));
+    CHECK_GL(glClear(depth_equal ? GL_COLOR_BUFFER_BIT : (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT)));
+
+    try {
+      render_meshes(get_output_bit(type), cam, instances);
+    } catch (...) {
+      glDepthFunc(GL_LESS);
+      glDepthMask(GL_TRUE);
+      throw;
+    }
+
+    CHECK_GL(glDepthFunc(GL_LESS));
+    CHECK_GL(glDepthMask(GL_TRUE));
+  }
+
+  void render_multiple(const camera& cam,
+                       const std::vector<mesh_instance>& instances,
+                       const std::vector<image_type>& outputs)
+  {
+    std::array<GLenum, num_image_types> draw_buffers{ GL_NONE, GL_NONE, GL_NONE, GL_NONE };
+
+    mesh_outputs variant{ multiple_outputs_bit };
+
+    for (const auto type : outputs) {
+      const auto index = static_cast<GLenum>(type);
+      draw_buffers.at(index) = GL_COLOR_ATTACHMENT0 + index;
+      variant |= get_output_bit(type);
+    }
+
+    const GLenum first_buffer{ GL_COLOR_ATTACHMENT0 };
+
+    CHECK_GL(glDrawBuffers(num_image_types, draw_buffers.data()));
+
+    try {
+      CHECK_GL(glEnable(GL_DEPTH_TEST));
+      CHECK_GL(glDepthFunc(GL_LESS));
+      CHECK_GL(glDepthMask(GL_TRUE));
+
+      CHECK_GL(glViewport(0, 0, cam.resolution[0], cam.resolution[1]));
+
+      CHECK_GL(glClearColor(0, 0, 0, 0));
+      CHECK_GL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+
+      if (draw_buffers[0] != GL_NONE) {
+        CHECK_GL(glDrawBuffers(1, &first_buffer));
+        render_skybox(cam);
+        CHECK_GL(glClear(GL_DEPTH_BUFFER_BIT));
+        CHECK_GL(glDrawBuffers(num_image_types, draw_buffers.data()));
+      }
+
+      render_meshes(variant, cam, instances);
+    } catch (...) {
+      glDrawBuffers(1, &first_buffer);
+      throw;
+    }
+
+    CHECK_GL(glDrawBuffers(1, &first_buffer));
+  }
+
+  // Draws the instances with the program for 'outputs'. When that includes color, the meshes with glossy materials are
+  // drawn with the glossy variant, which is only compiled, and the sky only prefiltered, for scenes that have them.
+  void render_meshes(const mesh_outputs outputs, const camera& cam, const std::vector<mesh_instance>& instances)
+  {
+    const auto split = (outputs & get_output_bit(image_type::color)) && has_glossy_meshes(instances);
+
+    auto& prg = get_mesh_program(outputs);
+
+    setup_mesh_program(prg, cam);
+
+    draw_meshes(prg, cam, instances, split ? mesh_selection::matte : mesh_selection::all);
+
+    if (split) {
+      auto& glossy_prg = get_mesh_program(outputs | glossy_bit);
+
+      setup_mesh_program(glossy_prg, cam);
+
+      draw_meshes(glossy_prg, cam, instances, mesh_selection::glossy);
+    }
+  }
+
+  auto has_glossy_meshes(const std::vector<mesh_instance>& instances) -> bool
+  {
+    for (const auto& inst : instances) {
+      const auto& shp = m_resources->get_shape(inst.obj_id, inst.shape_index);
+      for (const auto& mat : shp.materials) {
+        if (mat.is_glossy()) {
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  // Sets the per-frame uniforms of a mesh program. Uniforms that the program does not declare are ignored by GL. The
+  // sky is only loaded for programs that are lit by it, which are the ones that output color.
+  void setup_mesh_program(program& prg, const camera& cam)
+  {
+    prg.use();
+
+    const auto skybox_loc = prg.get_uniform_location("skybox");
+
+    if (skybox_loc >= 0) {
+      CHECK_GL(glActiveTexture(GL_TEXTURE0 + skybox_texture_index));
+      CHECK_GL(glBindTexture(GL_TEXTURE_CUBE_MAP, m_resources->skybox_texture(m_skybox_index)));
+      CHECK_GL(glUniform1i(skybox_loc, skybox_texture_index));
+    }
+
+    // Only programs with glossy materials read the prefiltered sky, and it is not made until one of them is used.
+    const auto specular_loc = prg.get_uniform_location("specular_environment");
+
+    if (specular_loc >= 0) {
+      const auto& sky = m_resources->specular_skybox(m_skybox_index);
+      CHECK_GL(glActiveTexture(GL_TEXTURE0 + specular_irradiance_texture_index));
+      CHECK_GL(glBindTexture(GL_TEXTURE_CUBE_MAP, sky.specular_texture));
+      CHECK_GL(glUniform1i(specular_loc, specular_irradiance_texture_index));
+      const auto max_level = static_cast<float>(sky.specular_levels - 1);
+      CHECK_GL(glUniform1f(prg.get_uniform_location("specular_max_level"), max_level));
+      const auto& pos = cam.position;
+      CHECK_GL(glUniform3f(prg.get_uniform_location("camera_position"), pos.x, pos.y, pos.z));
+    }
+
+    const auto irradiance_loc = prg.get_uniform_location("irradiance");
+
+    if (irradiance_loc >= 0) {
+      const auto& irradiance = m_resources->skybox_irradiance(m_skybox_index);
+      CHECK_GL(glUniform3fv(irradiance_loc, static_cast<GLsizei>(irradiance.size()), glm::value_ptr(irradiance[0])));
+    }
+
+    CHECK_GL(glUniform2f(prg.get_uniform_location("depth_range"), cam.near, cam.far));
+
+    CHECK_GL(glUniform1i(prg.get_uniform_location("pack_depth"), m_depth_format == depth_format::unorm16));
+
+    const glm::mat3 space = (m_normal_space == normal_space::camera) ? glm::mat3(get_view_matrix(cam)) : glm::mat3(1.0);
+
+    CHECK_GL(glUniformMatrix3fv(prg.get_uniform_location("normal_space"), 1, GL_FALSE, glm::value_ptr(space)));
+  }
+
+  void draw_meshes(program& prg,
+                   const camera& cam,
+                   const std::vector<mesh_instance>& instances,
+                   const mesh_selection selection)
+  {
+    // Attributes that a program does not read are optimized out and have no location.
+    const std::array<std::pair<GLint, GLint>, 3> attribs{ { { prg.get_attribute_location("position"), 3 },
+                                                            { prg.get_attribute_location("texcoord"), 2 },
+                                                            { prg.get_attribute_location("normal"), 3 } } };
+
+    for (const auto& attrib : attribs) {
+      if (attrib.first >= 0) {
+        CHECK_GL(glEnableVertexAttribArray(attrib.first));
+      }
+    }
+
+    constexpr auto stride{ sizeof(float) * 8 };
+
+    const auto view = get_view_matrix(cam);
+
+    const auto proj = get_projection_matrix(cam);
+
+    const auto mvp_loc = prg.get_uniform_location("mvp");
+    const auto model_view_loc = prg.get_uniform_location("model_view");
+    const auto normal_matrix_loc = prg.get_uniform_location("normal_matrix");
+    const auto id_loc = prg.get_uniform_location("instance_id");
+    const auto model_loc = prg.get_uniform_location("model");
+    const auto specular_loc = prg.get_uniform_location("specular");
+    const auto roughness_loc = prg.get_uniform_location("roughness");
+
+    for (std::size_t inst_index = 0; inst_index < instances.size(); inst_index++) {
+
+      const auto& inst = instances[inst_index];
+
+      const auto model = get_model_matrix(inst);
+
+      const glm::mat4 model_view = view * model;
+
+      const glm::mat4 mvp = proj * model_view;
+
+      const glm::mat3 normal_matrix = glm::transpose(glm::inverse(glm::mat3(model)));
+
+      CHECK_GL(glUniformMatrix4fv(mvp_loc, 1, GL_FALSE, glm::value_ptr(mvp)));
+      CHECK_GL(glUniformMatrix4fv(model_view_loc, 1, GL_FALSE, glm::value_ptr(model_view)));
+      CHECK_GL(glUniformMatrix3fv(normal_matrix_loc, 1, GL_FALSE, glm::value_ptr(normal_matrix)));
+
+      if (model_loc >= 0) {
+        CHECK_GL(glUniformMatrix4fv(model_loc, 1, GL_FALSE, glm::value_ptr(model)));
+      }
+
+      if (id_loc >= 0) {
+        CHECK_GL(glUniform3fv(id_loc, 1, glm::value_ptr(pack_instance_id(inst_index))));
+      }
+
+      const auto& shp = m_resources->get_shape(inst.obj_id, inst.shape_index);
+
+      for (std::size_t i = 0; i < shp.meshes.size(); i++) {
+
+        const auto& mat = shp.materials.at(i);
+
+        if ((selection != mesh_selection::all) && (mat.is_glossy() != (selection == mesh_selection::glossy))) {
+          continue;
+        }
+
+        if (specular_loc >= 0) {
+          CHECK_GL(glUniform1f(specular_loc, mat.specular));
+          CHECK_GL(glUniform1f(roughness_loc, mat.roughness));
+        }
+
+        const auto& m = shp.meshes.at(i);
+
+        CHECK_GL(glBindBuffer(GL_ARRAY_BUFFER, m));
+
+        std::size_t offset{};
+
+        for (const auto& attrib : attribs) {
+          if (attrib.first >= 0) {
+            CHECK_GL(glVertexAttribPointer(
+              attrib.first, attrib.second, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void*>(offset)));
+          }
+          offset += sizeof(float) * attrib.second;
+        }
+
+        CHECK_GL(glDrawArrays(GL_TRIANGLES, 0, shp.num_vertices.at(i)));
+      }
+    }
+
+    for (const auto& attrib : attribs) {
+      if (attrib.first >= 0) {
+        CHECK_GL(glDisableVertexAttribArray(attrib.first));
+      }
+    }
+  }
+
+  void render_skybox(const camera& cam)
+  {
+    auto& prg = get_skybox_program();
+
+    CHECK_GL(glBindBuffer(GL_ARRAY_BUFFER, get_screen_quad()));
+
+    prg.use();
+
+    const auto pos_loc = prg.get_attribute_location("position");
+    const auto rot_loc = prg.get_uniform_location("camera_rotation");
+    const auto sky_loc = prg.get_uniform_location("skybox");
+
+    CHECK_GL(glActiveTexture(GL_TEXTURE0 + skybox_texture_index));
+
+    CHECK_GL(glBindTexture(GL_TEXTURE_CUBE_MAP, m_resources->skybox_texture(m_skybox_index)));
+
+    CHECK_GL(glUniform1i(sky_loc, skybox_texture_index));
+
+    const glm::mat3 rotation = get_rotation_matrix(cam.rotation);
+
+    CHECK_GL(glUniformMatrix3fv(rot_loc, 1, GL_FALSE, glm::value_ptr(rotation)));
+
+    CHECK_GL(glEnableVertexAttribArray(pos_loc));
+
+    CHECK_GL(glVertexAttribPointer(pos_loc, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, reinterpret_cast<void*>(0)));
+
+    CHECK_GL(glDrawArrays(GL_TRIANGLES, 0, 6));
+
+    glDisableVertexAttribArray(pos_loc);
+  }
+
+  // Programs and buffers are created on first use, so that a session only pays for what it renders.
+
+  auto get_mesh_program(const mesh_outputs outputs) -> program&
+  {
+    submit_mesh_program(outputs);
+
+    return check_program(m_mesh_programs.at(outputs));
+  }
+
+  auto get_skybox_program() -> program&
+  {
+    submit_program(
+      m_skybox_color_program, "assets/shaders/skybox.vert", "assets/shaders/skybox_color.frag", nullptr, std::string());
+
+    return check_program(m_skybox_color_program);
+  }
+
+  void submit_mesh_program(const mesh_outputs outputs)
+  {
+    submit_program(m_mesh_programs.at(outputs),
+                   "assets/shaders/mesh.vert",
+                   "assets/shaders/mesh.frag",
+                   &m_mesh_vert_shader,
+                   get_mesh_defines(outputs));
+  }
+
+  // Puts a program into 'slot' unless it already holds one. If an earlier session saved the program in the cache
+  // directory, it is loaded from there. Otherwise its shaders are submitted for compilation and linking, and it is
+  // pending until check_program() or check_programs(). The vertex shader is kept in 'shared_vert_shader', if given, so
+  // that programs with the same vertex shader can share it. The 'frag_defines' select the variant of the fragment
+  // shader.
+  void submit_program(std::unique_ptr<program>& slot,
+                      const char* vert_path,
+                      const char* frag_path,
+                      std::shared_ptr<shader>* shared_vert_shader,
+                      const std::string& frag_defines)
+  {
+    if (slot) {
+      return;
+    }
+
+    pending_program pending;
+
+    pending.slot = &slot;
+
+    pending.cache_path = get_program_cache_path(vert_path, frag_path, frag_defines);
+
+    if (!pending.cache_path.empty()) {
+
+      program_binary binary;
+
+      if (load_program_binary(pending.cache_path, binary)) {
+        try {
+          slot = std::make_unique<program>(binary);
+          return;
+        } catch (const open_gl_error&) {
+          // The binary is compiled again below, and replaced.
+        }
+      }
+    }
+
+    if (shared_vert_shader && *shared_vert_shader) {
+      pending.vert_shader = *shared_vert_shader;
+    } else {
+      pending.vert_shader = std::make_shared<shader>(GL_VERTEX_SHADER, vert_path);
+    }
+
+    if (shared_vert_shader) {
+      *shared_vert_shader = pending.vert_shader;
+    }
+
+    pending.frag_shader = std::make_unique<shader>(GL_FRAGMENT_SHADER, frag_path, frag_defines);
+
+    auto prg = std::make_unique<program>(*pending.vert_shader, *pending.frag_shader);
+
+    m_pending_programs.emplace_back(std::move(pending));
+
+    slot = std::move(prg);
+  }
+
+  // Waits for the program in the slot if it is pending, and checks it.
+  auto check_program(std::unique_ptr<program>& slot) -> program&
+  {
+    const auto it = std::find_if(m_pending_programs.begin(),
+                                 m_pending_programs.end(),
+                                 [&slot](const pending_program& pending) { return pending.slot == &slot; });
+
+    if (it != m_pending_programs.end()) {
+      complete_program(it);
+    }
+
+    return *slot;
+  }
+
+  // Checks the pending programs that the driver has finished with, or all of them if 'wait'. Without
+  // GL_KHR_parallel_shader_compile, there is no asking whether a program is done without waiting for it.
+  void check_programs(const bool wait)
+  {
+    auto it = m_pending_programs.begin();
+
+    while (it != m_pending_programs.end()) {
+      if (wait || (*it->slot)->is_complete()) {
+        it = complete_program(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // Checks a pending program and saves it to the cache. The slot is emptied if it failed, so that it is submitted again
+  // on the next use.
+  auto complete_program(std::vector<pending_program>::iterator it) -> std::vector<pending_program>::iterator
+  {
+    auto pending = std::move(*it);
+
+    it = m_pending_programs.erase(it);
+
+    auto& prg = **pending.slot;
+
+    try {
+      prg.check(*pending.vert_shader, *pending.frag_shader);
+    } catch (...) {
+      pending.slot->reset();
+      throw;
+    }
+
+    // A cache that cannot be written only costs the next session the time to compile again.
+    if (!pending.cache_path.empty()) {
+      program_binary binary;
+      if (prg.get_binary(binary)) {
+        save_program_binary(pending.cache_path, binary);
+      }
+    }
+
+    return it;
+  }
+
+  // Binaries are only valid for the driver that made them, so the driver is part of the key, along with the sources and
+  // the defines of the variant. Returns an empty path if programs are not cached.
+  auto get_program_cache_path(const char* vert_path, const char* frag_path, const std::string& frag_defines)
+    -> std::string
+  {
+    if (!m_features.program_binary) {
+      return std::string();
+    }
+
+    const auto directory = m_resources->cache_directory();
+
+    if (directory.empty()) {
+      return std::string();
+    }
+
+    const auto fs = cmrc::mvz_assets::get_filesystem();
+
+    auto key = hash_bytes(m_features.driver.data(), m_features.driver.size());
+
+    for (const auto* path : { vert_path, frag_path }) {
+      const auto file = fs.open(path);
+      const auto size = static_cast<std::uint64_t>(file.size());
+      key = hash_bytes(&size, sizeof(size), key);
+      key = hash_bytes(file.begin(), file.size(), key);
+    }
+
+    const auto defines_size = static_cast<std::uint64_t>(frag_defines.size());
+
+    key = hash_bytes(&defines_size, sizeof(defines_size), key);
+
+    key = hash_bytes(frag_defines.data(), frag_defines.size(), key);
+
+    return directory + "/" + get_program_cache_name(key);
+  }
+
+  auto get_screen_quad() -> GLuint
+  {
+    if (m_screen_quad) {
+      return m_screen_quad->id();
+    }
+
+    auto buffer = std::make_unique<gl_buffer>();
+
+    CHECK_GL(glBindBuffer(GL_ARRAY_BUFFER, buffer->id()));
+
+    const std::array<float, 12> data{
+      // clang-format off
+      0, 0,
+      0, 1,
+      1, 1,
+      1, 1,
+      1, 0,
+      0, 0
+      // clang-format on
+    };
+
+    CHECK_GL(glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(data[0]), data.data(), GL_STATIC_DRAW));
+
+    m_screen_quad = std::move(buffer);
+
+    return m_screen_quad->id();
+  }
+
+private:
+  std::unique_ptr<render_target> m_render_target;
+
+  std::array<GLuint, readback_ring_size> m_readback_buffers{};
+
+  std::array<std::size_t, readback_ring_size> m_readback_buffer_sizes{};
+
+  std::size_t m_next_readback_buffer{};
+
+  std::deque<pending_readback> m_pending_readbacks;
+
+  std::vector<unsigned char> m_readback_scratch;
+
+  pixel_storage_pool m_pixel_pool;
+
+  readback_callback m_readback_callback;
+
+  std::unique_ptr<program> m_skybox_color_program;
+
+  std::shared_ptr<shader> m_mesh_vert_shader;
+
+  std::array<std::unique_ptr<program>, num_mesh_variants> m_mesh_programs;
+
+  std::unique_ptr<gl_buffer> m_screen_quad;
+
+  std::vector<pending_program> m_pending_programs;
+
+  std::shared_ptr<resource_set> m_resources;
+
+  int m_skybox_index{};
+
+  gl_features m_features;
+
+  depth_format m_depth_format{ depth_format::unorm16 };
+
+  normal_space m_normal_space{ normal_space::world };
+
+  bool m_development_mode{ false };
+};
+
+shared_resources::shared_resources(gl_get_func func)
+{
+  const auto loader = reinterpret_cast<GLADloadproc>(func);
+
+  load_gl_functions(loader);
+
+  m_set = std::make_shared<resource_set>(query_gl_features());
+}
+
+auto
+shared_resources::load_obj(const char* path) -> int
+{
+  return m_set->load_obj(path);
+}
+
+auto
+shared_resources::instance(const int obj_id, const char* name) -> mesh_instance
+{
+  return m_set->instance(obj_id, name);
+}
+
+void
+shared_resources::set_cache_directory(const char* path)
+{
+  m_set->set_cache_directory(path);
+}
+
+void
+shared_resources::warmup()
+{
+  m_set->warmup();
+}
+
+session::session(gl_get_func func)
+{
+  const auto loader = reinterpret_cast<GLADloadproc>(func);
+
+  load_gl_functions(loader);
+
+  m_impl = new session_impl(query_gl_features(), nullptr);
+}
+
+session::session(gl_get_func func, const shared_resources& resources)
+{
+  const auto loader = reinterpret_cast<GLADloadproc>(func);
+
+  load_gl_functions(loader);
+
+  m_impl = new session_impl(query_gl_features(), resources.m_set);
+}
+
+session::~session()
+{
+  delete m_impl;
+}
+
+void
+session::warmup()
+{
+  m_impl->warmup();
+}
+
+void
+session::set_development_mode(const bool enabled)
+{
+  m_impl->set_development_mode(enabled);
+}
+
+void
+session::set_cache_directory(const char* path)
+{
+  m_impl->set_cache_directory(path);
+}
+
+auto
+session::num_skyboxes() const -> int
+{
+  return m_impl->num_skyboxes();
+}
+
+void
+session::set_skybox(const int index)
+{
+  m_impl->set_skybox(index);
+}
+
+auto
+session::load_obj(const char* path) -> int
+{
+  return m_impl->load_obj(path);
+}
+
+auto
+session::instance(int obj_id, const char* shape) -> mesh_instance
+{
+  return m_impl->instance(obj_id, shape);
+}
+
+void
+session::render(const camera& cam, const std::vector<mesh_instance>& instances, const image_type type)
+{
+  m_impl->render_current_fbo(cam, instances, type);
+}
+
+void
+session::render(const camera& cam,
+                const std::vector<mesh_instance>& instances,
+                const std::vector<image_type>& outputs)
+{
+  m_impl->render_current_fbo(cam, instances, outputs);
+}
+
+void
+session::render_offscreen(const camera& cam,
+                          const std::vector<mesh_instance>& instances,
+                          const std::vector<image_type>& outputs)
+{
+  m_impl->render_offscreen(cam, instances, outputs);
+}
+
+void
+session::read_offscreen(const image_type type, const std::uint64_t index)
+{
+  m_impl->read_offscreen(type, index);
+}
+
+void
+session::poll_readbacks(const bool wait)
+{
+  m_impl->poll_readbacks(wait);
+}
+
+void
+session::set_readback_callback(readback_callback callback)
+{
+  m_impl->set_readback_callback(std::move(callback));
+}
+
+void
+session::recycle(frame&& f)
+{
+  m_impl->recycle(std::move(f));
+}
+
+auto
+session::supports_multiple_outputs() const -> bool
+{
+  return m_impl->supports_multiple_outputs();
+}
+
+void
+session::set_depth_format(const depth_format format)
+{
+  m_impl->set_depth_format(format);
 }
 
 void
-session::render(const camera& cam, const std::vector<mesh_instance>& instances)
+session::set_normal_space(const normal_space space)
 {
-  m_impl->render_current_fbo(cam, instances);
+  m_impl->set_normal_space(space);
 }
 
 glsl_error::glsl_error(std::string what, std::string path, std::string source)
@@ -1,15 +1,35 @@
 #pragma once
 
+#include <functional>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
+#include <cstdint>
+
 namespace mvz {
 
 enum class image_type
 {
   color,
-  segmentation
+  segmentation,
+  depth,
+  normal
+};
+
+enum class depth_format
+{
+  // Linear depth between the near and far plane, as 16-bit fixed point in the red (high) and green (low) channels.
+  unorm16,
+  // Linear depth in scene units in the red channel, for floating point color attachments.
+  float32
+};
+
+enum class normal_space
+{
+  world,
+  camera
 };
 
 struct vec3 final
@@ -52,6 +72,29 @@ using gl_get_func = gl_func (*)(const char* name);
 
 class session_impl;
 
+class resource_set;
+
+// Pixels read back from an offscreen target, with rows ordered top to bottom. Color, segmentation and normals have
+// three 8-bit channels, depth has one channel that is either a 16-bit integer or a 32-bit float (see depth_format).
+struct frame final
+{
+  image_type type{ image_type::color };
+
+  std::uint64_t index{};
+
+  int width{};
+
+  int height{};
+
+  int channels{};
+
+  int channel_size{};
+
+  std::vector<unsigned char> pixels;
+};
+
+using readback_callback = std::function<void(frame&&)>;
+
 struct camera final
 {
   vec3 position{};
@@ -82,11 +125,42 @@ struct mesh_instance final
   int shape_index{};
 };
 
+// Geometry and skybox textures that several sessions render from, such as one session per thread, each with a context
+// of its own. All of the contexts have to be in one share group (see headless_context), and one of them has to be
+// current when this is created. Loading is thread safe, and objects loaded by any of the sessions end up here.
+//
+// The GL objects are deleted along with the last session or copy of this that refers to them, which has to happen
+// while a context of the share group is current.
+class shared_resources final
+{
+public:
+  explicit shared_resources(gl_get_func getter);
+
+  auto load_obj(const char* path) -> int;
+
+  auto instance(int obj_id, const char* name) -> mesh_instance;
+
+  // See session::set_cache_directory().
+  void set_cache_directory(const char* path);
+
+  // Loads every skybox now instead of on first use.
+  void warmup();
+
+private:
+  friend class session;
+
+  std::shared_ptr<resource_set> m_set;
+};
+
 class session final
 {
 public:
   session(gl_get_func getter);
 
+  // Renders from shared resources instead of loading its own. Everything else, from shaders to render targets, belongs
+  // to the session's context.
+  session(gl_get_func getter, const shared_resources& resources);
+
   session(const session&) = delete;
 
   session(session&&) = delete;
@@ -97,14 +171,73 @@ public:
 
   ~session();
 
+  // Shaders, skyboxes and render targets are created on first use, so that a session only pays for what it renders.
+  // This creates them up front instead (render targets aside, since they depend on the camera resolution), for callers
+  // that would rather not have the first frames take longer. The mesh shaders are compiled for each output on its own,
+  // and for all outputs in one pass where that is supported; other combinations are still compiled on first use.
+  void warmup();
+
+  // Materials of the MTL file whose illumination model has reflections on ('illum' 3 to 9) are glossy: their color
+  // adds the sky reflected with the strength of 'Ks' and blurred by the roughness that 'Ns' stands for. The glossy
+  // shaders and the prefiltered sky are made the first time a glossy mesh is rendered.
   auto load_obj(const char* path) -> int;
 
   auto instance(int obj_id, const char* name) -> mesh_instance;
 
-  void render(const camera& cam, const std::vector<mesh_instance>& mesh_instances);
+  // Anything other than color reuses the depth buffer of the framebuffer, so it has to follow a color render of the
+  // same scene.
+  void render(const camera& cam,
+              const std::vector<mesh_instance>& mesh_instances,
+              image_type type = image_type::color);
+
+  // Renders several outputs in one geometry pass. Each output is written to the color attachment of the bound
+  // framebuffer whose index is the value of its image type. Requires supports_multiple_outputs().
+  void render(const camera& cam,
+              const std::vector<mesh_instance>& mesh_instances,
+              const std::vector<image_type>& outputs);
+
+  // Renders into framebuffers owned by the session, sized to the camera resolution, without touching the framebuffer
+  // bound by the caller.
+  void render_offscreen(const camera& cam,
+                        const std::vector<mesh_instance>& mesh_instances,
+                        const std::vector<image_type>& outputs);
+
+  // Queues a copy of one target of the last offscreen render. When the context supports it, the copy goes through a
+  // ring of pixel pack buffers and is delivered to the readback callback once the GPU is done with it, so that the next
+  // frame can render in the meantime. Otherwise the pixels are read and delivered right away. The index is passed
+  // through to the frame.
+  void read_offscreen(image_type type, std::uint64_t index);
+
+  // Delivers the readbacks that have completed, or all of them when waiting.
+  void poll_readbacks(bool wait = false);
+
+  void set_readback_callback(readback_callback callback);
+
+  // Hands the pixel storage of a delivered frame back to the session for reuse. Can be called from any thread.
+  void recycle(frame&& f);
+
+  auto supports_multiple_outputs() const -> bool;
+
+  void set_depth_format(depth_format format);
+
+  void set_normal_space(normal_space space);
 
   void set_development_mode(bool enabled);
 
+  // Keeps data derived from assets, such as prefiltered skyboxes and linked shader programs, in the directory between
+  // runs, so that it is only computed once. The directory has to exist. Files are named by a hash of the assets they
+  // were derived from (and of the driver, for programs), and sessions in several processes may share the directory. By
+  // default nothing is cached. Applies to the resources of the session, which may be shared.
+  void set_cache_directory(const char* path);
+
+  // The skyboxes built into the library are uploaded once, on first use, and shared by the sessions of the resources,
+  // so switching to one that was used before costs nothing. Indices are in [0, num_skyboxes()), and the first is used
+  // until another is set.
+  auto num_skyboxes() const -> int;
+
+  // Applies to the renders that follow. Throws a runtime_error if the index is out of range.
+  void set_skybox(int index);
+
 protected:
   auto impl() -> session_impl&;
 
@@ -0,0 +1,260 @@
+#include "mvz_egl.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#include <cstring>
+
+namespace mvz {
+
+namespace {
+
+auto
+has_extension(const char* extensions, const char* name) -> bool
+{
+  if (!extensions) {
+    return false;
+  }
+
+  const auto name_size = std::strlen(name);
+
+  for (const char* ptr = std::strstr(extensions, name); ptr; ptr = std::strstr(ptr + name_size, name)) {
+
+    const auto starts = (ptr == extensions) || (ptr[-1] == ' ');
+
+    const auto ends = (ptr[name_size] == ' ') || (ptr[name_size] == 0);
+
+    if (starts && ends) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+[[noreturn]] void
+throw_egl_error(const char* action)
+{
+  std::ostringstream stream;
+  stream << "Failed to " << action << " (EGL error 0x" << std::hex << eglGetError() << ").";
+  throw runtime_error(stream.str());
+}
+
+auto
+get_display() -> EGLDisplay
+{
+  const auto* client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+  if (has_extension(client_extensions, "EGL_MESA_platform_surfaceless")) {
+
+    auto get_platform_display =
+      reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+
+    if (get_platform_display) {
+      auto display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+      if (display != EGL_NO_DISPLAY) {
+        return display;
+      }
+    }
+  }
+
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+auto
+choose_config(EGLDisplay display, const EGLint renderable_type, const bool pbuffer, EGLConfig* config) -> bool
+{
+  const EGLint attribs[]{ EGL_SURFACE_TYPE,
+                          pbuffer ? EGL_PBUFFER_BIT : 0,
+                          EGL_RENDERABLE_TYPE,
+                          renderable_type,
+                          EGL_RED_SIZE,
+                          8,
+                          EGL_GREEN_SIZE,
+                          8,
+                          EGL_BLUE_SIZE,
+                          8,
+                          EGL_ALPHA_SIZE,
+                          8,
+                          EGL_DEPTH_SIZE,
+                          24,
+                          EGL_NONE };
+
+  EGLint num_configs{};
+
+  return eglChooseConfig(display, attribs, config, 1, &num_configs) && (num_configs > 0);
+}
+
+// Displays are shared by every context on them, and terminating one destroys all of its contexts, so they are only
+// terminated along with the last context.
+std::mutex display_mutex;
+
+std::map<EGLDisplay, int> display_refs;
+
+void
+acquire_display(EGLDisplay display)
+{
+  std::lock_guard<std::mutex> lock(display_mutex);
+
+  if (display_refs[display] == 0) {
+    if (!eglInitialize(display, nullptr, nullptr)) {
+      display_refs.erase(display);
+      throw_egl_error("initialize an EGL display");
+    }
+  }
+
+  display_refs[display]++;
+}
+
+void
+release_display(EGLDisplay display)
+{
+  std::lock_guard<std::mutex> lock(display_mutex);
+
+  if (--display_refs[display] == 0) {
+    display_refs.erase(display);
+    eglTerminate(display);
+  }
+}
+
+} // namespace
+
+headless_context::headless_context(const int width, const int height, const headless_context* share)
+{
+  auto display = share ? static_cast<EGLDisplay>(share->m_display) : get_display();
+
+  if (display == EGL_NO_DISPLAY) {
+    throw_egl_error("get an EGL display");
+  }
+
+  acquire_display(display);
+
+  m_display = display;
+
+  try {
+
+    if (!eglBindAPI(EGL_OPENGL_ES_API)) {
+      throw_egl_error("bind the GLES API");
+    }
+
+    const auto* extensions = eglQueryString(display, EGL_EXTENSIONS);
+
+    const auto surfaceless = has_extension(extensions, "EGL_KHR_surfaceless_context");
+
+    // A pbuffer is created whenever there is a config for one, so that render() has a framebuffer to draw into.
+    const struct
+    {
+      EGLint renderable_type;
+      EGLint client_version;
+    } versions[]{ { EGL_OPENGL_ES3_BIT_KHR, 3 }, { EGL_OPENGL_ES2_BIT, 2 } };
+
+    for (const auto& version : versions) {
+
+      // Contexts of one share group have to be of the same version.
+      if (share && (share->m_client_version != version.client_version)) {
+        continue;
+      }
+
+      EGLConfig config{};
+
+      const auto pbuffer = choose_config(display, version.renderable_type, true, &config);
+
+      if (!pbuffer && !(surfaceless && choose_config(display, version.renderable_type, false, &config))) {
+        continue;
+      }
+
+      const EGLint context_attribs[]{ EGL_CONTEXT_CLIENT_VERSION, version.client_version, EGL_NONE };
+
+      const auto share_context = share ? static_cast<EGLContext>(share->m_context) : EGL_NO_CONTEXT;
+
+      m_context = eglCreateContext(display, config, share_context, context_attribs);
+
+      if (m_context == EGL_NO_CONTEXT) {
+        m_context = nullptr;
+        continue;
+      }
+
+      m_client_version = version.client_version;
+
+      if (pbuffer) {
+
+        const EGLint surface_attribs[]{ EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+
+        m_surface = eglCreatePbufferSurface(display, config, surface_attribs);
+
+        if (m_surface == EGL_NO_SURFACE) {
+          throw_egl_error("create a pbuffer");
+        }
+      }
+
+      break;
+    }
+
+    if (!m_context) {
+      throw runtime_error("Failed to create a headless GLES context.");
+    }
+
+    make_current();
+
+  } catch (...) {
+    cleanup();
+    throw;
+  }
+}
+
+headless_context::~headless_context()
+{
+  cleanup();
+}
+
+void
+headless_context::cleanup()
+{
+  if (!m_display) {
+    return;
+  }
+
+  if (m_context && (eglGetCurrentContext() == m_context)) {
+    eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  }
+
+  if (m_surface) {
+    eglDestroySurface(m_display, m_surface);
+  }
+
+  if (m_context) {
+    eglDestroyContext(m_display, m_context);
+  }
+
+  release_display(m_display);
+
+  m_display = nullptr;
+}
+
+void
+headless_context::make_current()
+{
+  const auto surface = m_surface ? static_cast<EGLSurface>(m_surface) : EGL_NO_SURFACE;
+
+  if (!eglMakeCurrent(m_display, surface, surface, m_context)) {
+    throw_egl_error("make the headless context current");
+  }
+}
+
+void
+headless_context::release()
+{
+  eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+auto
+headless_context::get_proc_address(const char* name) -> gl_func
+{
+  return reinterpret_cast<gl_func>(eglGetProcAddress(name));
+}
+
+} // namespace mvz
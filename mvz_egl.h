@@ -0,0 +1,52 @@
+#pragma once
+
+#include "mvz.h"
+
+namespace mvz {
+
+// A GLES context that needs neither a window nor a display server, for batch jobs on headless nodes (for example Mesa's
+// llvmpipe). It uses the surfaceless EGL platform when the driver offers EGL_MESA_platform_surfaceless and the default
+// display otherwise. A GLES 3 context is preferred over GLES 2.
+//
+// The context is made current on the constructing thread. Sessions created afterwards should be given
+// headless_context::get_proc_address as their getter. Only available when built with MVZ_EGL.
+class headless_context final
+{
+public:
+  // The size of the pbuffer, which is the default framebuffer that session::render() draws into. Offscreen rendering
+  // does not need it to be larger than one pixel. Passing another context puts this one into its share group, which
+  // is what sessions on several threads need to render from one set of shared_resources.
+  explicit headless_context(int width = 1, int height = 1, const headless_context* share = nullptr);
+
+  headless_context(const headless_context&) = delete;
+
+  headless_context(headless_context&&) = delete;
+
+  auto operator=(const headless_context&) -> headless_context& = delete;
+
+  auto operator=(headless_context&&) -> headless_context& = delete;
+
+  ~headless_context();
+
+  // Makes the context current on the calling thread, after it was released from the one that created it.
+  void make_current();
+
+  // Releases the context from the calling thread.
+  void release();
+
+  static auto get_proc_address(const char* name) -> gl_func;
+
+protected:
+  void cleanup();
+
+private:
+  void* m_display{ nullptr };
+
+  void* m_surface{ nullptr };
+
+  void* m_context{ nullptr };
+
+  int m_client_version{};
+};
+
+} // namespace mvz
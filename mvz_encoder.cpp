@@ -0,0 +1,310 @@
+#include "mvz_encoder.h"
+
+#include "mvz_stb.h"
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <cstdint>
+#include <cstring>
+
+namespace mvz {
+
+namespace {
+
+void
+require_8bit(const frame& f, const char* format_name)
+{
+  if (f.channel_size != 1) {
+    std::ostringstream stream;
+    stream << "Only frames with 8-bit channels can be encoded as " << format_name << '.';
+    throw runtime_error(stream.str());
+  }
+}
+
+void
+append_u32_le(std::vector<unsigned char>& output, const std::uint32_t value)
+{
+  output.push_back(static_cast<unsigned char>(value));
+  output.push_back(static_cast<unsigned char>(value >> 8));
+  output.push_back(static_cast<unsigned char>(value >> 16));
+  output.push_back(static_cast<unsigned char>(value >> 24));
+}
+
+class png_encoder final : public image_encoder
+{
+public:
+  explicit png_encoder(const int num_threads)
+    : m_num_threads(num_threads)
+  {
+  }
+
+  auto extension() const -> const char* override { return ".png"; }
+
+  void encode(const frame& f, std::vector<unsigned char>& output) const override
+  {
+    if ((f.channel_size != 1) && (f.channel_size != 2)) {
+      throw runtime_error("Only frames with 8 or 16-bit channels can be encoded as PNG.");
+    }
+
+    auto context = take_context();
+
+    if (!encode_png(f.pixels.data(), f.width, f.height, f.channels, f.channel_size, *context, output)) {
+      throw runtime_error("Failed to encode PNG.");
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_contexts.emplace_back(std::move(context));
+  }
+
+private:
+  // Each thread that encodes takes a context of its own and puts it back for the next frame, so there are as many as
+  // threads that ever encoded at the same time. A context that an exception passed through is dropped.
+  auto take_context() const -> std::unique_ptr<png_context>
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+
+      if (!m_contexts.empty()) {
+        auto context = std::move(m_contexts.back());
+        m_contexts.pop_back();
+        return context;
+      }
+    }
+
+    return std::make_unique<png_context>(m_num_threads);
+  }
+
+  int m_num_threads{ 1 };
+
+  mutable std::mutex m_mutex;
+
+  mutable std::vector<std::unique_ptr<png_context>> m_contexts;
+};
+
+class jpg_encoder final : public image_encoder
+{
+public:
+  explicit jpg_encoder(const int quality)
+    : m_quality(quality)
+  {
+  }
+
+  auto extension() const -> const char* override { return ".jpg"; }
+
+  void encode(const frame& f, std::vector<unsigned char>& output) const override
+  {
+    require_8bit(f, "JPG");
+
+    if (!encode_jpg(f.pixels.data(), f.width, f.height, f.channels, m_quality, output)) {
+      throw runtime_error("Failed to encode JPG.");
+    }
+  }
+
+private:
+  int m_quality{};
+};
+
+// See https://qoiformat.org/qoi-specification.pdf
+class qoi_encoder final : public image_encoder
+{
+public:
+  auto extension() const -> const char* override { return ".qoi"; }
+
+  void encode(const frame& f, std::vector<unsigned char>& output) const override
+  {
+    require_8bit(f, "QOI");
+
+    if ((f.channels != 3) && (f.channels != 4)) {
+      throw runtime_error("Only RGB and RGBA frames can be encoded as QOI.");
+    }
+
+    const auto num_pixels = static_cast<std::size_t>(f.width) * static_cast<std::size_t>(f.height);
+
+    const auto channels = static_cast<std::size_t>(f.channels);
+
+    const auto start = output.size();
+
+    // Worst case, so that the loop below never reallocates.
+    output.resize(start + header_size + num_pixels * (channels + 1) + sizeof(end_marker));
+
+    unsigned char* out = output.data() + start;
+
+    std::memcpy(out, "qoif", 4);
+    write_u32_be(out + 4, static_cast<std::uint32_t>(f.width));
+    write_u32_be(out + 8, static_cast<std::uint32_t>(f.height));
+    out[12] = static_cast<unsigned char>(channels);
+    // Everything but color holds data rather than light, so it is flagged as linear.
+    out[13] = (f.type == image_type::color) ? 0 : 1;
+    out += header_size;
+
+    std::array<pixel, 64> index{};
+
+    pixel prev{ 0, 0, 0, 255 };
+
+    int run{};
+
+    const unsigned char* px = f.pixels.data();
+
+    for (std::size_t i = 0; i < num_pixels; i++, px += channels) {
+
+      const pixel p{ px[0], px[1], px[2], (channels == 4) ? px[3] : static_cast<unsigned char>(255) };
+
+      if (p == prev) {
+        run++;
+        if ((run == 62) || (i + 1 == num_pixels)) {
+          *out++ = static_cast<unsigned char>(op_run | (run - 1));
+          run = 0;
+        }
+        continue;
+      }
+
+      if (run > 0) {
+        *out++ = static_cast<unsigned char>(op_run | (run - 1));
+        run = 0;
+      }
+
+      const auto hash = (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) % 64;
+
+      if (index[hash] == p) {
+        *out++ = static_cast<unsigned char>(op_index | hash);
+      } else {
+        index[hash] = p;
+
+        if (p.a == prev.a) {
+          const auto vr = static_cast<signed char>(p.r - prev.r);
+          const auto vg = static_cast<signed char>(p.g - prev.g);
+          const auto vb = static_cast<signed char>(p.b - prev.b);
+
+          const auto vg_r = static_cast<signed char>(vr - vg);
+          const auto vg_b = static_cast<signed char>(vb - vg);
+
+          if ((vr > -3) && (vr < 2) && (vg > -3) && (vg < 2) && (vb > -3) && (vb < 2)) {
+            *out++ = static_cast<unsigned char>(op_diff | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2));
+          } else if ((vg_r > -9) && (vg_r < 8) && (vg > -33) && (vg < 32) && (vg_b > -9) && (vg_b < 8)) {
+            *out++ = static_cast<unsigned char>(op_luma | (vg + 32));
+            *out++ = static_cast<unsigned char>(((vg_r + 8) << 4) | (vg_b + 8));
+          } else {
+            *out++ = op_rgb;
+            *out++ = p.r;
+            *out++ = p.g;
+            *out++ = p.b;
+          }
+        } else {
+          *out++ = op_rgba;
+          *out++ = p.r;
+          *out++ = p.g;
+          *out++ = p.b;
+          *out++ = p.a;
+        }
+      }
+
+      prev = p;
+    }
+
+    std::memcpy(out, end_marker, sizeof(end_marker));
+    out += sizeof(end_marker);
+
+    output.resize(static_cast<std::size_t>(out - output.data()));
+  }
+
+private:
+  struct pixel final
+  {
+    unsigned char r{};
+
+    unsigned char g{};
+
+    unsigned char b{};
+
+    unsigned char a{};
+
+    auto operator==(const pixel& other) const -> bool
+    {
+      return (r == other.r) && (g == other.g) && (b == other.b) && (a == other.a);
+    }
+  };
+
+  static void write_u32_be(unsigned char* out, const std::uint32_t value)
+  {
+    out[0] = static_cast<unsigned char>(value >> 24);
+    out[1] = static_cast<unsigned char>(value >> 16);
+    out[2] = static_cast<unsigned char>(value >> 8);
+    out[3] = static_cast<unsigned char>(value);
+  }
+
+  static constexpr std::size_t header_size{ 14 };
+
+  static constexpr unsigned char op_index{ 0x00 };
+
+  static constexpr unsigned char op_diff{ 0x40 };
+
+  static constexpr unsigned char op_luma{ 0x80 };
+
+  static constexpr unsigned char op_run{ 0xc0 };
+
+  static constexpr unsigned char op_rgb{ 0xfe };
+
+  static constexpr unsigned char op_rgba{ 0xff };
+
+  static constexpr unsigned char end_marker[8]{ 0, 0, 0, 0, 0, 0, 0, 1 };
+};
+
+class raw_encoder final : public image_encoder
+{
+public:
+  auto extension() const -> const char* override { return ".raw"; }
+
+  void encode(const frame& f, std::vector<unsigned char>& output) const override
+  {
+    output.reserve(output.size() + 16 + f.pixels.size());
+
+    output.insert(output.end(), { 'M', 'V', 'Z', 'R' });
+
+    append_u32_le(output, static_cast<std::uint32_t>(f.width));
+    append_u32_le(output, static_cast<std::uint32_t>(f.height));
+
+    output.push_back(static_cast<unsigned char>(f.channels));
+    output.push_back(static_cast<unsigned char>(f.channel_size));
+    output.push_back(static_cast<unsigned char>(f.type));
+    output.push_back(0);
+
+    output.insert(output.end(), f.pixels.begin(), f.pixels.end());
+  }
+};
+
+} // namespace
+
+auto
+make_png_encoder(int num_threads) -> std::shared_ptr<const image_encoder>
+{
+  if (num_threads <= 0) {
+    num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  }
+
+  return std::make_shared<png_encoder>(num_threads);
+}
+
+auto
+make_jpg_encoder(const int quality) -> std::shared_ptr<const image_encoder>
+{
+  return std::make_shared<jpg_encoder>(quality);
+}
+
+auto
+make_qoi_encoder() -> std::shared_ptr<const image_encoder>
+{
+  return std::make_shared<qoi_encoder>();
+}
+
+auto
+make_raw_encoder() -> std::shared_ptr<const image_encoder>
+{
+  return std::make_shared<raw_encoder>();
+}
+
+} // namespace mvz
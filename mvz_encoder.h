@@ -0,0 +1,51 @@
+#pragma once
+
+#include "mvz.h"
+
+#include <memory>
+#include <vector>
+
+namespace mvz {
+
+// Turns a frame into the bytes of an image file. Encoders are shared between the threads of an image_writer, so
+// encode() has to be thread safe.
+class image_encoder
+{
+public:
+  virtual ~image_encoder() = default;
+
+  // Including the leading dot.
+  virtual auto extension() const -> const char* = 0;
+
+  // Appends the encoded frame to the output. Throws a runtime_error for frames it cannot represent.
+  virtual void encode(const frame& f, std::vector<unsigned char>& output) const = 0;
+};
+
+// 8 or 16-bit channels. Frames of several megapixels are split into bands that are compressed on up to 'num_threads'
+// threads, where zero means one per hardware thread. Smaller frames are always encoded on the calling thread. An
+// image_writer already encodes a frame per thread, so encoders given to one should use a single thread.
+//
+// The encoder keeps the buffers of each thread that calls it, and the threads it compresses bands on, for the next
+// frame, so that encoding frames of the same size allocates nothing after the first.
+auto
+make_png_encoder(int num_threads = 0) -> std::shared_ptr<const image_encoder>;
+
+// 8-bit channels only, lossy.
+auto
+make_jpg_encoder(int quality = 90) -> std::shared_ptr<const image_encoder>;
+
+// The "Quite OK Image" format: lossless and an order of magnitude faster than PNG, particularly on the flat regions of
+// segmentation masks. 8-bit channels only.
+auto
+make_qoi_encoder() -> std::shared_ptr<const image_encoder>;
+
+// The pixels as they are, after a 16 byte header:
+//
+//   char[4] magic ("MVZR"), uint32 width, uint32 height, uint8 channels, uint8 channel size, uint8 image type,
+//   uint8 reserved
+//
+// All integers are little endian, and so are the pixels of 16-bit and float frames. Handles any frame.
+auto
+make_raw_encoder() -> std::shared_ptr<const image_encoder>;
+
+} // namespace mvz
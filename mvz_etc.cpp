@@ -0,0 +1,447 @@
+#include "mvz_etc.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+
+#include <cstring>
+
+namespace mvz {
+
+namespace {
+
+constexpr int etc1_modifiers[8][2]{ { 2, 8 },   { 5, 17 },  { 9, 29 },  { 13, 42 },
+                                    { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 } };
+
+// Pixel indices 0 to 3 select +a, +b, -a and -b of the table.
+auto
+get_modifier(const int table, const int index) -> int
+{
+  const auto m = etc1_modifiers[table][index & 1];
+  return (index & 2) ? -m : m;
+}
+
+auto
+clamp_byte(const int value) -> int
+{
+  return std::min(std::max(value, 0), 255);
+}
+
+auto
+extend4(const int value) -> int
+{
+  return (value << 4) | value;
+}
+
+auto
+extend5(const int value) -> int
+{
+  return (value << 3) | (value >> 2);
+}
+
+struct block_pixels final
+{
+  // RGB of the texels, column major, which is the order of the index bits.
+  int rgb[16][3];
+};
+
+// Whether a texel (column major index) belongs to the second half of the block.
+auto
+in_second_half(const int texel, const bool flip) -> bool
+{
+  return flip ? ((texel % 4) >= 2) : ((texel / 4) >= 2);
+}
+
+struct half_fit final
+{
+  long error{ std::numeric_limits<long>::max() };
+
+  int table{};
+};
+
+// Picks the table that fits the half best around the base color, and the index of each of its texels.
+auto
+fit_half(const block_pixels& px, const bool flip, const bool second, const int base[3], int indices[16]) -> half_fit
+{
+  int texels[8]{};
+
+  int num_texels{};
+
+  for (int texel = 0; texel < 16; texel++) {
+    if (in_second_half(texel, flip) == second) {
+      texels[num_texels++] = texel;
+    }
+  }
+
+  half_fit best;
+
+  int candidate[8]{};
+
+  for (int table = 0; table < 8; table++) {
+
+    int palette[4][3]{};
+
+    for (int index = 0; index < 4; index++) {
+      for (int c = 0; c < 3; c++) {
+        palette[index][c] = clamp_byte(base[c] + get_modifier(table, index));
+      }
+    }
+
+    long error{};
+
+    for (int i = 0; (i < num_texels) && (error < best.error); i++) {
+
+      const auto* rgb = px.rgb[texels[i]];
+
+      long texel_error = std::numeric_limits<long>::max();
+
+      for (int index = 0; index < 4; index++) {
+        const long dr = palette[index][0] - rgb[0];
+        const long dg = palette[index][1] - rgb[1];
+        const long db = palette[index][2] - rgb[2];
+        const auto e = dr * dr + dg * dg + db * db;
+        if (e < texel_error) {
+          texel_error = e;
+          candidate[i] = index;
+        }
+      }
+
+      error += texel_error;
+    }
+
+    if (error < best.error) {
+      best.error = error;
+      best.table = table;
+      for (int i = 0; i < num_texels; i++) {
+        indices[texels[i]] = candidate[i];
+      }
+    }
+  }
+
+  return best;
+}
+
+void
+write_block(std::uint64_t bits, unsigned char* block)
+{
+  for (int i = 7; i >= 0; i--) {
+    block[i] = static_cast<unsigned char>(bits & 0xff);
+    bits >>= 8;
+  }
+}
+
+auto
+read_block(const unsigned char* block) -> std::uint64_t
+{
+  std::uint64_t bits{};
+  for (int i = 0; i < 8; i++) {
+    bits = (bits << 8) | block[i];
+  }
+  return bits;
+}
+
+void
+encode_block(const block_pixels& px, unsigned char* block)
+{
+  long best_error = std::numeric_limits<long>::max();
+
+  std::uint64_t best_bits{};
+
+  for (const auto flip : { false, true }) {
+
+    int sum[2][3]{};
+
+    for (int texel = 0; texel < 16; texel++) {
+      const auto half = in_second_half(texel, flip) ? 1 : 0;
+      for (int c = 0; c < 3; c++) {
+        sum[half][c] += px.rgb[texel][c];
+      }
+    }
+
+    // The average of each half, quantized for both modes. Halves have eight texels.
+    int q4[2][3]{};
+    int q5[2][3]{};
+
+    for (int half = 0; half < 2; half++) {
+      for (int c = 0; c < 3; c++) {
+        q4[half][c] = std::min((sum[half][c] * 15 + 1020) / 2040, 15);
+        q5[half][c] = std::min((sum[half][c] * 31 + 1020) / 2040, 31);
+      }
+    }
+
+    bool differential_fits = true;
+
+    for (int c = 0; c < 3; c++) {
+      const auto d = q5[1][c] - q5[0][c];
+      differential_fits = differential_fits && (d >= -4) && (d <= 3);
+    }
+
+    for (const auto differential : { false, true }) {
+
+      if (differential && !differential_fits) {
+        continue;
+      }
+
+      int base[2][3]{};
+
+      for (int half = 0; half < 2; half++) {
+        for (int c = 0; c < 3; c++) {
+          base[half][c] = differential ? extend5(q5[half][c]) : extend4(q4[half][c]);
+        }
+      }
+
+      int indices[16]{};
+
+      const auto first = fit_half(px, flip, false, base[0], indices);
+      const auto second = fit_half(px, flip, true, base[1], indices);
+
+      const auto error = first.error + second.error;
+
+      if (error >= best_error) {
+        continue;
+      }
+
+      std::uint64_t bits{};
+
+      for (int c = 0; c < 3; c++) {
+        const auto shift = 56 - c * 8;
+        if (differential) {
+          const auto delta = static_cast<std::uint64_t>((q5[1][c] - q5[0][c]) & 7);
+          bits |= (static_cast<std::uint64_t>(q5[0][c]) << (shift + 3)) | (delta << shift);
+        } else {
+          bits |= static_cast<std::uint64_t>(q4[0][c]) << (shift + 4);
+          bits |= static_cast<std::uint64_t>(q4[1][c]) << shift;
+        }
+      }
+
+      bits |= static_cast<std::uint64_t>(first.table) << 37;
+      bits |= static_cast<std::uint64_t>(second.table) << 34;
+      bits |= static_cast<std::uint64_t>(differential ? 1 : 0) << 33;
+      bits |= static_cast<std::uint64_t>(flip ? 1 : 0) << 32;
+
+      for (int texel = 0; texel < 16; texel++) {
+        bits |= static_cast<std::uint64_t>(indices[texel] & 1) << texel;
+        bits |= static_cast<std::uint64_t>(indices[texel] >> 1) << (16 + texel);
+      }
+
+      best_error = error;
+      best_bits = bits;
+    }
+  }
+
+  write_block(best_bits, block);
+}
+
+void
+decode_block(const unsigned char* block, block_pixels& px)
+{
+  const auto bits = read_block(block);
+
+  const auto flip = ((bits >> 32) & 1) != 0;
+  const auto differential = ((bits >> 33) & 1) != 0;
+
+  const int tables[2]{ static_cast<int>((bits >> 37) & 7), static_cast<int>((bits >> 34) & 7) };
+
+  int base[2][3]{};
+
+  for (int c = 0; c < 3; c++) {
+    const auto shift = 56 - c * 8;
+    if (differential) {
+      const auto first = static_cast<int>((bits >> (shift + 3)) & 31);
+      auto delta = static_cast<int>((bits >> shift) & 7);
+      delta = (delta >= 4) ? (delta - 8) : delta;
+      base[0][c] = extend5(first);
+      base[1][c] = extend5((first + delta) & 31);
+    } else {
+      base[0][c] = extend4(static_cast<int>((bits >> (shift + 4)) & 15));
+      base[1][c] = extend4(static_cast<int>((bits >> shift) & 15));
+    }
+  }
+
+  for (int texel = 0; texel < 16; texel++) {
+    const auto half = in_second_half(texel, flip) ? 1 : 0;
+    const auto index = static_cast<int>(((bits >> texel) & 1) | (((bits >> (16 + texel)) & 1) << 1));
+    const auto m = get_modifier(tables[half], index);
+    for (int c = 0; c < 3; c++) {
+      px.rgb[texel][c] = clamp_byte(base[half][c] + m);
+    }
+  }
+}
+
+void
+append_u32(std::vector<unsigned char>& output, const std::uint32_t value)
+{
+  for (int i = 0; i < 4; i++) {
+    output.push_back(static_cast<unsigned char>(value >> (i * 8)));
+  }
+}
+
+auto
+read_u32(const unsigned char* data) -> std::uint32_t
+{
+  return static_cast<std::uint32_t>(data[0]) | (static_cast<std::uint32_t>(data[1]) << 8) |
+         (static_cast<std::uint32_t>(data[2]) << 16) | (static_cast<std::uint32_t>(data[3]) << 24);
+}
+
+constexpr unsigned char ktx_identifier[12]{ 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+constexpr std::uint32_t ktx_endianness{ 0x04030201 };
+
+constexpr std::size_t ktx_header_size{ 64 };
+
+constexpr std::uint32_t gl_rgb{ 0x1907 };
+
+} // namespace
+
+auto
+get_etc1_size(const int w, const int h) -> std::size_t
+{
+  return static_cast<std::size_t>((w + 3) / 4) * static_cast<std::size_t>((h + 3) / 4) * 8;
+}
+
+auto
+encode_etc1(const unsigned char* rgba, const int w, const int h) -> std::vector<unsigned char>
+{
+  std::vector<unsigned char> output(get_etc1_size(w, h));
+
+  auto* block = output.data();
+
+  for (int by = 0; by < h; by += 4) {
+    for (int bx = 0; bx < w; bx += 4) {
+      block_pixels px;
+      for (int x = 0; x < 4; x++) {
+        for (int y = 0; y < 4; y++) {
+          const auto sx = std::min(bx + x, w - 1);
+          const auto sy = std::min(by + y, h - 1);
+          const auto* src = rgba + (static_cast<std::size_t>(sy) * w + sx) * 4;
+          for (int c = 0; c < 3; c++) {
+            px.rgb[x * 4 + y][c] = src[c];
+          }
+        }
+      }
+      encode_block(px, block);
+      block += 8;
+    }
+  }
+
+  return output;
+}
+
+void
+decode_etc1(const unsigned char* data, const int w, const int h, unsigned char* rgba)
+{
+  for (int by = 0; by < h; by += 4) {
+    for (int bx = 0; bx < w; bx += 4) {
+      block_pixels px;
+      decode_block(data, px);
+      data += 8;
+      for (int x = 0; x < 4; x++) {
+        for (int y = 0; y < 4; y++) {
+          if (((bx + x) >= w) || ((by + y) >= h)) {
+            continue;
+          }
+          auto* dst = rgba + (static_cast<std::size_t>(by + y) * w + bx + x) * 4;
+          for (int c = 0; c < 3; c++) {
+            dst[c] = static_cast<unsigned char>(px.rgb[x * 4 + y][c]);
+          }
+          dst[3] = 255;
+        }
+      }
+    }
+  }
+}
+
+auto
+write_ktx_cubemap(const ktx_cubemap& cubemap) -> std::vector<unsigned char>
+{
+  std::vector<unsigned char> output(std::begin(ktx_identifier), std::end(ktx_identifier));
+
+  append_u32(output, ktx_endianness);
+  append_u32(output, 0); // glType, zero for compressed formats
+  append_u32(output, 1); // glTypeSize
+  append_u32(output, 0); // glFormat
+  append_u32(output, cubemap.internal_format);
+  append_u32(output, gl_rgb);
+  append_u32(output, static_cast<std::uint32_t>(cubemap.size));
+  append_u32(output, static_cast<std::uint32_t>(cubemap.size));
+  append_u32(output, 0); // pixelDepth
+  append_u32(output, 0); // numberOfArrayElements
+  append_u32(output, 6); // numberOfFaces
+  append_u32(output, static_cast<std::uint32_t>(cubemap.num_levels));
+  append_u32(output, 0); // bytesOfKeyValueData
+
+  for (int level = 0; level < cubemap.num_levels; level++) {
+
+    // For cube maps, the image size is that of a single face. Compressed blocks keep every face 4-byte aligned.
+    append_u32(output, static_cast<std::uint32_t>(cubemap.faces.at(static_cast<std::size_t>(level) * 6).size()));
+
+    for (int face = 0; face < 6; face++) {
+      const auto& data = cubemap.faces.at(static_cast<std::size_t>(level) * 6 + face);
+      output.insert(output.end(), data.begin(), data.end());
+      output.resize((output.size() + 3) & ~static_cast<std::size_t>(3), 0);
+    }
+  }
+
+  return output;
+}
+
+auto
+parse_ktx_cubemap(const void* data, const std::size_t size, ktx_cubemap& cubemap) -> bool
+{
+  const auto* bytes = static_cast<const unsigned char*>(data);
+
+  if ((size < ktx_header_size) || (std::memcmp(bytes, ktx_identifier, sizeof(ktx_identifier)) != 0)) {
+    return false;
+  }
+
+  const auto field = [bytes](const int index) { return read_u32(bytes + sizeof(ktx_identifier) + index * 4); };
+
+  const auto endianness = field(0);
+  const auto gl_type = field(1);
+  const auto internal_format = field(4);
+  const auto width = field(6);
+  const auto height = field(7);
+  const auto depth = field(8);
+  const auto array_elements = field(9);
+  const auto num_faces = field(10);
+  const auto num_levels = field(11);
+  const auto key_value_size = field(12);
+
+  if ((endianness != ktx_endianness) || (gl_type != 0) || (width == 0) || (width != height) || (depth != 0) ||
+      (array_elements != 0) || (num_faces != 6) || (num_levels == 0) || (num_levels > 16) || (width > 65536)) {
+    return false;
+  }
+
+  std::size_t offset = ktx_header_size + key_value_size;
+
+  ktx_cubemap result;
+  result.internal_format = internal_format;
+  result.size = static_cast<int>(width);
+  result.num_levels = static_cast<int>(num_levels);
+  result.faces.resize(static_cast<std::size_t>(num_levels) * 6);
+
+  for (std::uint32_t level = 0; level < num_levels; level++) {
+
+    if ((offset + 4) > size) {
+      return false;
+    }
+
+    const auto image_size = static_cast<std::size_t>(read_u32(bytes + offset));
+
+    offset += 4;
+
+    for (int face = 0; face < 6; face++) {
+      if ((image_size == 0) || ((offset + image_size) > size)) {
+        return false;
+      }
+      result.faces[level * 6 + face].assign(bytes + offset, bytes + offset + image_size);
+      offset = (offset + image_size + 3) & ~static_cast<std::size_t>(3);
+    }
+  }
+
+  cubemap = std::move(result);
+
+  return true;
+}
+
+} // namespace mvz
@@ -0,0 +1,51 @@
+#pragma once
+
+#ifndef MVZ_BUILD
+#error "This header is not meant to be included outside of the build."
+#endif
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mvz {
+
+// ETC1 compression of RGB images, in 4x4 blocks of 8 bytes. ETC1 is a subset of ETC2, so the blocks can be uploaded as
+// GL_COMPRESSED_RGB8_ETC2 on GLES 3.0, or as GL_ETC1_RGB8_OES where GL_OES_compressed_ETC1_RGB8_texture is available.
+
+constexpr std::uint32_t etc1_internal_format{ 0x8D64 /* GL_ETC1_RGB8_OES */ };
+
+auto
+get_etc1_size(int w, int h) -> std::size_t;
+
+// Takes RGBA8 pixels (alpha is ignored) and picks the best of the block modes for each block. Partial blocks at the
+// edges are padded by repeating the last row and column.
+auto
+encode_etc1(const unsigned char* rgba, int w, int h) -> std::vector<unsigned char>;
+
+// Writes RGBA8 pixels with an alpha of 255.
+void
+decode_etc1(const unsigned char* data, int w, int h, unsigned char* rgba);
+
+// A cube map of square faces with a full mip chain, as stored in a KTX 1.1 file.
+struct ktx_cubemap final
+{
+  std::uint32_t internal_format{};
+
+  int size{};
+
+  int num_levels{};
+
+  // The images of each level, level major, in the order GL numbers the faces.
+  std::vector<std::vector<unsigned char>> faces;
+};
+
+auto
+write_ktx_cubemap(const ktx_cubemap& cubemap) -> std::vector<unsigned char>;
+
+// Returns false if the data is not a little endian KTX 1.1 cube map of compressed, square faces.
+auto
+parse_ktx_cubemap(const void* data, std::size_t size, ktx_cubemap& cubemap) -> bool;
+
+} // namespace mvz
@@ -0,0 +1,184 @@
+#include "mvz_gl.h"
+
+#include <mutex>
+
+#include <cstdio>
+#include <cstring>
+
+namespace mvz {
+
+PFNGLDRAWBUFFERSPROC mvz_glDrawBuffers{ nullptr };
+
+PFNGLMAPBUFFERRANGEPROC mvz_glMapBufferRange{ nullptr };
+
+PFNGLUNMAPBUFFERPROC mvz_glUnmapBuffer{ nullptr };
+
+PFNGLFENCESYNCPROC mvz_glFenceSync{ nullptr };
+
+PFNGLCLIENTWAITSYNCPROC mvz_glClientWaitSync{ nullptr };
+
+PFNGLDELETESYNCPROC mvz_glDeleteSync{ nullptr };
+
+PFNGLGETPROGRAMBINARYPROC mvz_glGetProgramBinary{ nullptr };
+
+PFNGLPROGRAMBINARYPROC mvz_glProgramBinary{ nullptr };
+
+PFNGLMAXSHADERCOMPILERTHREADSKHRPROC mvz_glMaxShaderCompilerThreadsKHR{ nullptr };
+
+namespace {
+
+auto
+has_extension(const char* extensions, const char* name) -> bool
+{
+  const auto name_len = std::strlen(name);
+
+  const char* ptr = extensions;
+
+  while ((ptr = std::strstr(ptr, name)) != nullptr) {
+
+    const bool at_start = (ptr == extensions) || (ptr[-1] == ' ');
+
+    const bool at_end = (ptr[name_len] == ' ') || (ptr[name_len] == '\0');
+
+    if (at_start && at_end) {
+      return true;
+    }
+
+    ptr += name_len;
+  }
+
+  return false;
+}
+
+template<typename Func>
+auto
+load_func(GLADloadproc loader, const char* name, const char* fallback_name = nullptr) -> Func
+{
+  auto* func = loader(name);
+  if (!func && fallback_name) {
+    func = loader(fallback_name);
+  }
+  return reinterpret_cast<Func>(func);
+}
+
+auto
+get_gl_version_and_extensions(const char** version, const char** extensions) -> bool
+{
+  *version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+
+  *extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+
+  return (*version != nullptr) && (*extensions != nullptr);
+}
+
+auto
+is_gles3(const char* version) -> bool
+{
+  int major{};
+
+  return (std::sscanf(version, "OpenGL ES %d", &major) == 1) && (major >= 3);
+}
+
+void
+load_gl_functions_once(GLADloadproc loader)
+{
+  gladLoadGLES2Loader(loader);
+
+  const char* version{};
+
+  const char* extensions{};
+
+  if (!get_gl_version_and_extensions(&version, &extensions)) {
+    return;
+  }
+
+  const auto gles3 = is_gles3(version);
+
+  if (has_extension(extensions, "GL_EXT_draw_buffers")) {
+    mvz_glDrawBuffers = load_func<PFNGLDRAWBUFFERSPROC>(loader, "glDrawBuffersEXT", "glDrawBuffers");
+  }
+
+  if (gles3) {
+    mvz_glMapBufferRange = load_func<PFNGLMAPBUFFERRANGEPROC>(loader, "glMapBufferRange");
+    mvz_glUnmapBuffer = load_func<PFNGLUNMAPBUFFERPROC>(loader, "glUnmapBuffer");
+    mvz_glFenceSync = load_func<PFNGLFENCESYNCPROC>(loader, "glFenceSync");
+    mvz_glClientWaitSync = load_func<PFNGLCLIENTWAITSYNCPROC>(loader, "glClientWaitSync");
+    mvz_glDeleteSync = load_func<PFNGLDELETESYNCPROC>(loader, "glDeleteSync");
+  }
+
+  if (gles3 || has_extension(extensions, "GL_OES_get_program_binary")) {
+    mvz_glGetProgramBinary =
+      load_func<PFNGLGETPROGRAMBINARYPROC>(loader, gles3 ? "glGetProgramBinary" : "glGetProgramBinaryOES");
+    mvz_glProgramBinary = load_func<PFNGLPROGRAMBINARYPROC>(loader, gles3 ? "glProgramBinary" : "glProgramBinaryOES");
+  }
+
+  if (has_extension(extensions, "GL_KHR_parallel_shader_compile")) {
+    mvz_glMaxShaderCompilerThreadsKHR =
+      load_func<PFNGLMAXSHADERCOMPILERTHREADSKHRPROC>(loader, "glMaxShaderCompilerThreadsKHR");
+    // Leaves the number of compiler threads to the driver, which is not the default everywhere.
+    if (mvz_glMaxShaderCompilerThreadsKHR) {
+      glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    }
+  }
+}
+
+} // namespace
+
+void
+load_gl_functions(GLADloadproc loader)
+{
+  static std::once_flag once;
+
+  std::call_once(once, load_gl_functions_once, loader);
+}
+
+auto
+query_gl_features() -> gl_features
+{
+  gl_features features;
+
+  const char* version{};
+
+  const char* extensions{};
+
+  if (!get_gl_version_and_extensions(&version, &extensions)) {
+    return features;
+  }
+
+  features.gles3 = is_gles3(version);
+
+  features.depth24 = features.gles3 || has_extension(extensions, "GL_OES_depth24");
+
+  features.etc1 = features.gles3 || has_extension(extensions, "GL_OES_compressed_ETC1_RGB8_texture");
+
+  features.color_buffer_float = features.gles3 && has_extension(extensions, "GL_EXT_color_buffer_float");
+
+  // The shaders are written against GLSL ES 1.00, which can only write to several color attachments through
+  // GL_EXT_draw_buffers, even on a GLES 3 context.
+  if (has_extension(extensions, "GL_EXT_draw_buffers") && mvz_glDrawBuffers) {
+    glGetIntegerv(GL_MAX_DRAW_BUFFERS, &features.max_draw_buffers);
+    features.draw_buffers = true;
+  }
+
+  features.async_readback = features.gles3 && mvz_glMapBufferRange && mvz_glUnmapBuffer && mvz_glFenceSync &&
+                            mvz_glClientWaitSync && mvz_glDeleteSync;
+
+  if ((features.gles3 || has_extension(extensions, "GL_OES_get_program_binary")) && mvz_glGetProgramBinary &&
+      mvz_glProgramBinary) {
+    GLint num_formats{};
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+    features.program_binary = num_formats > 0;
+  }
+
+  features.parallel_shader_compile = has_extension(extensions, "GL_KHR_parallel_shader_compile");
+
+  for (const auto name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+    const auto* value = reinterpret_cast<const char*>(glGetString(name));
+    features.driver += value ? value : "";
+    features.driver += '\n';
+  }
+
+  return features;
+}
+
+} // namespace mvz
@@ -0,0 +1,188 @@
+#pragma once
+
+#ifndef MVZ_BUILD
+#error "This header is not meant to be included outside of the build."
+#endif
+
+#include <glad/glad.h>
+
+#include <string>
+
+// The glad loader in deps/ only covers GLES 2.0. Anything newer (GLES 3.0 or extensions) that the library uses is
+// declared and loaded here, following the same naming scheme as glad.
+
+#ifndef GL_MAX_DRAW_BUFFERS
+#define GL_MAX_DRAW_BUFFERS 0x8824
+#endif
+
+#ifndef GL_COLOR_ATTACHMENT1
+#define GL_COLOR_ATTACHMENT1 0x8CE1
+#endif
+
+#ifndef GL_COLOR_ATTACHMENT2
+#define GL_COLOR_ATTACHMENT2 0x8CE2
+#endif
+
+#ifndef GL_COLOR_ATTACHMENT3
+#define GL_COLOR_ATTACHMENT3 0x8CE3
+#endif
+
+#ifndef GL_DEPTH_COMPONENT24_OES
+#define GL_DEPTH_COMPONENT24_OES 0x81A6
+#endif
+
+#ifndef GL_RED
+#define GL_RED 0x1903
+#endif
+
+#ifndef GL_R32F
+#define GL_R32F 0x822E
+#endif
+
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#endif
+
+#ifndef GL_MAP_READ_BIT
+#define GL_MAP_READ_BIT 0x0001
+#endif
+
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+
+#ifndef GL_SYNC_FLUSH_COMMANDS_BIT
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#endif
+
+#ifndef GL_ALREADY_SIGNALED
+#define GL_ALREADY_SIGNALED 0x911A
+#endif
+
+#ifndef GL_TIMEOUT_EXPIRED
+#define GL_TIMEOUT_EXPIRED 0x911B
+#endif
+
+#ifndef GL_CONDITION_SATISFIED
+#define GL_CONDITION_SATISFIED 0x911C
+#endif
+
+#ifndef GL_WAIT_FAILED
+#define GL_WAIT_FAILED 0x911D
+#endif
+
+#ifndef GL_ETC1_RGB8_OES
+#define GL_ETC1_RGB8_OES 0x8D64
+#endif
+
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#endif
+
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+#ifndef GL_TIMEOUT_IGNORED
+#define GL_TIMEOUT_IGNORED 0xFFFFFFFFFFFFFFFFull
+#endif
+
+typedef void(APIENTRYP PFNGLDRAWBUFFERSPROC)(GLsizei n, const GLenum* bufs);
+typedef void*(APIENTRYP PFNGLMAPBUFFERRANGEPROC)(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+typedef GLboolean(APIENTRYP PFNGLUNMAPBUFFERPROC)(GLenum target);
+typedef GLsync(APIENTRYP PFNGLFENCESYNCPROC)(GLenum condition, GLbitfield flags);
+typedef GLenum(APIENTRYP PFNGLCLIENTWAITSYNCPROC)(GLsync sync, GLbitfield flags, GLuint64 timeout);
+typedef void(APIENTRYP PFNGLDELETESYNCPROC)(GLsync sync);
+typedef void(APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program,
+                                                  GLsizei buf_size,
+                                                  GLsizei* length,
+                                                  GLenum* binary_format,
+                                                  void* binary);
+typedef void(APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program,
+                                               GLenum binary_format,
+                                               const void* binary,
+                                               GLsizei length);
+typedef void(APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+namespace mvz {
+
+extern PFNGLDRAWBUFFERSPROC mvz_glDrawBuffers;
+
+extern PFNGLMAPBUFFERRANGEPROC mvz_glMapBufferRange;
+
+extern PFNGLUNMAPBUFFERPROC mvz_glUnmapBuffer;
+
+extern PFNGLFENCESYNCPROC mvz_glFenceSync;
+
+extern PFNGLCLIENTWAITSYNCPROC mvz_glClientWaitSync;
+
+extern PFNGLDELETESYNCPROC mvz_glDeleteSync;
+
+extern PFNGLGETPROGRAMBINARYPROC mvz_glGetProgramBinary;
+
+extern PFNGLPROGRAMBINARYPROC mvz_glProgramBinary;
+
+extern PFNGLMAXSHADERCOMPILERTHREADSKHRPROC mvz_glMaxShaderCompilerThreadsKHR;
+
+struct gl_features final
+{
+  bool gles3{ false };
+
+  bool draw_buffers{ false };
+
+  // Pixel pack buffers, buffer mapping and fence syncs (GLES 3.0).
+  bool async_readback{ false };
+
+  bool color_buffer_float{ false };
+
+  bool depth24{ false };
+
+  // ETC1 compressed textures, either through GL_OES_compressed_ETC1_RGB8_texture or as ETC2 (GLES 3.0).
+  bool etc1{ false };
+
+  // Linked programs can be saved and loaded again (GLES 3.0 or GL_OES_get_program_binary), in at least one format.
+  bool program_binary{ false };
+
+  // Shaders are compiled and programs linked in the background, and GL_COMPLETION_STATUS_KHR tells when they are done
+  // (GL_KHR_parallel_shader_compile).
+  bool parallel_shader_compile{ false };
+
+  GLint max_draw_buffers{ 1 };
+
+  // GL_VENDOR, GL_RENDERER and GL_VERSION, which is what a program binary is only valid for.
+  std::string driver;
+};
+
+// Loads the GLES 2.0 entry points through glad, and the ones declared in this header. Only the first call in the
+// process loads anything, with its context current, so that sessions created on other threads never see the pointers
+// change. Every context of the process is expected to come from the same driver.
+void
+load_gl_functions(GLADloadproc loader);
+
+// Reports what the current context supports, out of what load_gl_functions() loaded.
+auto
+query_gl_features() -> gl_features;
+
+} // namespace mvz
+
+#define glDrawBuffers ::mvz::mvz_glDrawBuffers
+#define glMapBufferRange ::mvz::mvz_glMapBufferRange
+#define glUnmapBuffer ::mvz::mvz_glUnmapBuffer
+#define glFenceSync ::mvz::mvz_glFenceSync
+#define glClientWaitSync ::mvz::mvz_glClientWaitSync
+#define glDeleteSync ::mvz::mvz_glDeleteSync
+#define glGetProgramBinary ::mvz::mvz_glGetProgramBinary
+#define glProgramBinary ::mvz::mvz_glProgramBinary
+#define glMaxShaderCompilerThreadsKHR ::mvz::mvz_glMaxShaderCompilerThreadsKHR
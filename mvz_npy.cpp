@@ -0,0 +1,181 @@
+#include "mvz_npy.h"
+
+#include "mvz_writer.h"
+
+#include <sstream>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mvz {
+
+namespace {
+
+// The header is padded so that the array data starts on a 64 byte boundary, as numpy does.
+constexpr std::size_t npy_alignment{ 64 };
+
+auto
+get_descr(const int channel_size) -> const char*
+{
+  switch (channel_size) {
+    case 1:
+      return "|u1";
+    case 2:
+      return "<u2";
+    case 4:
+      return "<f4";
+  }
+
+  throw runtime_error("Unsupported channel size for an npy array.");
+}
+
+auto
+make_npy_header(const char* descr, const std::size_t n, const int h, const int w, const int c) -> std::string
+{
+  std::ostringstream dict_stream;
+  dict_stream << "{'descr': '" << descr << "', 'fortran_order': False, 'shape': (" << n << ", " << h << ", " << w
+              << ", " << c << "), }";
+
+  auto dict = dict_stream.str();
+
+  // Magic string, version 1.0 and the 16-bit header length come first, and the dictionary ends with a new line.
+  const std::size_t prefix_size{ 10 };
+
+  const auto unpadded = prefix_size + dict.size() + 1;
+
+  const auto padded = ((unpadded + npy_alignment - 1) / npy_alignment) * npy_alignment;
+
+  dict.append(padded - unpadded, ' ');
+  dict.push_back('\n');
+
+  std::string header("\x93NUMPY\x01\x00", 8);
+  header.push_back(static_cast<char>(dict.size() & 0xff));
+  header.push_back(static_cast<char>(dict.size() >> 8));
+  header += dict;
+
+  return header;
+}
+
+auto
+describe_errno(const char* action, const std::string& path) -> std::string
+{
+  std::ostringstream stream;
+  stream << "Failed to " << action << " '" << path << "': " << std::strerror(errno);
+  return stream.str();
+}
+
+} // namespace
+
+npy_writer::npy_writer(std::string directory, const std::size_t num_samples)
+  : m_directory(std::move(directory))
+  , m_num_samples(num_samples)
+{
+}
+
+npy_writer::~npy_writer()
+{
+  for (auto& m : m_mappings) {
+    if (m.address) {
+      munmap(m.address, m.file_size);
+    }
+  }
+}
+
+void
+npy_writer::write(const frame& f)
+{
+  if (f.index >= m_num_samples) {
+    std::ostringstream stream;
+    stream << "Frame index " << f.index << " is out of range for " << m_num_samples << " samples.";
+    throw runtime_error(stream.str());
+  }
+
+  const auto& m = get_mapping(f);
+
+  if ((f.width != m.width) || (f.height != m.height) || (f.channels != m.channels) ||
+      (f.channel_size != m.channel_size) || (f.pixels.size() != m.slot_size)) {
+    std::ostringstream stream;
+    stream << "The " << get_type_name(f.type) << " frame " << f.index << " does not match the shape of the array.";
+    throw runtime_error(stream.str());
+  }
+
+  // Slots do not overlap, so frames are copied without holding the lock.
+  std::memcpy(m.address + m.data_offset + m.slot_size * f.index, f.pixels.data(), m.slot_size);
+}
+
+void
+npy_writer::flush()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  for (auto& m : m_mappings) {
+    if (m.address && (msync(m.address, m.file_size, MS_SYNC) != 0)) {
+      throw runtime_error(describe_errno("sync", m_directory));
+    }
+  }
+}
+
+auto
+npy_writer::get_mapping(const frame& f) -> const mapping&
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  auto& m = m_mappings.at(static_cast<std::size_t>(f.type));
+
+  if (!m.address) {
+    create_mapping(f, m);
+  }
+
+  return m;
+}
+
+void
+npy_writer::create_mapping(const frame& f, mapping& m)
+{
+  const auto header = make_npy_header(get_descr(f.channel_size), m_num_samples, f.height, f.width, f.channels);
+
+  const auto slot_size = static_cast<std::size_t>(f.width) * f.height * f.channels * f.channel_size;
+
+  const auto file_size = header.size() + slot_size * m_num_samples;
+
+  const auto path = m_directory + '/' + get_type_name(f.type) + ".npy";
+
+  const auto fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0) {
+    throw runtime_error(describe_errno("open", path));
+  }
+
+  // The file is sized up front, so that the slots can be written in any order without extending it.
+  if ((ftruncate(fd, static_cast<off_t>(file_size)) != 0) ||
+      (pwrite(fd, header.data(), header.size(), 0) != static_cast<ssize_t>(header.size()))) {
+    const auto what = describe_errno("allocate", path);
+    close(fd);
+    throw runtime_error(what);
+  }
+
+  auto* address = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  // The mapping keeps the file open.
+  close(fd);
+
+  if (address == MAP_FAILED) {
+    throw runtime_error(describe_errno("map", path));
+  }
+
+  m.width = f.width;
+  m.height = f.height;
+  m.channels = f.channels;
+  m.channel_size = f.channel_size;
+  m.slot_size = slot_size;
+  m.data_offset = header.size();
+  m.file_size = file_size;
+  m.address = static_cast<unsigned char*>(address);
+}
+
+} // namespace mvz
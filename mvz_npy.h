@@ -0,0 +1,77 @@
+#pragma once
+
+#include "mvz.h"
+
+#include <array>
+#include <mutex>
+#include <string>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mvz {
+
+// Writes frames straight into preallocated, memory mapped '.npy' files, one per image type, for datasets in which every
+// frame of a type has the same size. '<directory>/<type>.npy' holds an array of shape [N, H, W, C] that is created
+// when the first frame of its type arrives, and the frame with index i goes into slot i. Nothing is encoded, so
+// write() is a copy, and it may be called from any thread, including the readback callback.
+//
+// Color, segmentation and normal frames are stored as uint8, 16-bit depth as uint16 and float depth as float32, all
+// little endian. POSIX only, and only built with MVZ_NPY.
+class npy_writer final
+{
+public:
+  npy_writer(std::string directory, std::size_t num_samples);
+
+  npy_writer(const npy_writer&) = delete;
+
+  npy_writer(npy_writer&&) = delete;
+
+  auto operator=(const npy_writer&) -> npy_writer& = delete;
+
+  auto operator=(npy_writer&&) -> npy_writer& = delete;
+
+  ~npy_writer();
+
+  // Throws a runtime_error if the index is out of range, or if the frame's size or format differs from the first frame
+  // of its type.
+  void write(const frame& f);
+
+  // Blocks until the written slots are on disk.
+  void flush();
+
+protected:
+  struct mapping final
+  {
+    int width{};
+
+    int height{};
+
+    int channels{};
+
+    int channel_size{};
+
+    std::size_t slot_size{};
+
+    std::size_t data_offset{};
+
+    std::size_t file_size{};
+
+    unsigned char* address{ nullptr };
+  };
+
+  auto get_mapping(const frame& f) -> const mapping&;
+
+  void create_mapping(const frame& f, mapping& m);
+
+private:
+  std::string m_directory;
+
+  std::size_t m_num_samples{};
+
+  std::mutex m_mutex;
+
+  std::array<mapping, 4> m_mappings;
+};
+
+} // namespace mvz
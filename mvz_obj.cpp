@@ -3,6 +3,8 @@
 #include <algorithm>
 #include <iterator>
 
+#include <cmath>
+
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 
@@ -53,7 +55,7 @@ protected:
   {
     auto it = m_meshes.find(mat);
     if (it == m_meshes.end()) {
-      it = m_meshes.emplace(mat, obj_mesh{ mat, {} }).first;
+      it = m_meshes.emplace(mat, obj_mesh{ mat, {}, {} }).first;
     }
     return it->second;
   }
@@ -62,6 +64,24 @@ private:
   std::map<material_id, obj_mesh> m_meshes;
 };
 
+auto
+convert_material(const tinyobj::material_t& mat) -> obj_material
+{
+  obj_material output;
+
+  if ((mat.illum < 3) || (mat.illum > 9)) {
+    return output;
+  }
+
+  output.specular = (mat.specular[0] + mat.specular[1] + mat.specular[2]) / 3.0F;
+
+  // Walter et al., "Microfacet Models for Refraction through Rough Surfaces", 2007: a Phong exponent n is about a
+  // Beckmann (and GGX) alpha of sqrt(2 / (n + 2)), and alpha is the square of the roughness.
+  output.roughness = std::sqrt(std::sqrt(2.0F / (std::max(mat.shininess, 0.0F) + 2.0F)));
+
+  return output;
+}
+
 } // namespace
 
 auto
@@ -113,6 +133,12 @@ obj_file::load(const char* path) -> bool
     shape.name = input_shape.name;
     shape.meshes = builder.take_meshes();
 
+    for (auto& m : shape.meshes) {
+      if (m.has_material()) {
+        m.material = convert_material(materials.at(m.material_index));
+      }
+    }
+
     shapes.emplace_back(std::move(shape));
   }
 
@@ -11,15 +11,25 @@
 
 namespace mvz {
 
+// The part of an MTL material that the mesh shader uses. Materials whose illumination model has reflections on
+// ('illum' 3 to 9) are glossy, and reflect the prefiltered sky.
 struct obj_material final
 {
-  float kd{ 1 };
+  // The mean of 'Ks', or zero if reflections are off.
+  float specular{};
+
+  // The GGX roughness that matches the Phong exponent 'Ns'.
+  float roughness{ 1 };
+
+  auto is_glossy() const -> bool { return specular > 0; }
 };
 
 struct obj_mesh final
 {
   int material_index{ -1 };
 
+  obj_material material;
+
   std::vector<float> vertices;
 
   int num_vertices{};
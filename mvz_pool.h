@@ -0,0 +1,52 @@
+#pragma once
+
+#ifndef MVZ_BUILD
+#error "This header is not meant to be included outside of the build."
+#endif
+
+#include <mutex>
+#include <vector>
+
+#include <cstddef>
+
+namespace mvz {
+
+// Pixel storage that is handed out with frames and comes back through session::recycle(), possibly from other threads.
+class pixel_storage_pool final
+{
+public:
+  auto acquire(const std::size_t size) -> std::vector<unsigned char>
+  {
+    std::vector<unsigned char> storage;
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (!m_free.empty()) {
+        storage = std::move(m_free.back());
+        m_free.pop_back();
+      }
+    }
+
+    storage.resize(size);
+
+    return storage;
+  }
+
+  void release(std::vector<unsigned char>&& storage)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_free.size() < max_free) {
+      m_free.emplace_back(std::move(storage));
+    }
+  }
+
+private:
+  static constexpr std::size_t max_free{ 16 };
+
+  std::mutex m_mutex;
+
+  std::vector<std::vector<unsigned char>> m_free;
+};
+
+} // namespace mvz
@@ -0,0 +1,114 @@
+#include "mvz_program_cache.h"
+
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+
+#include <cstdio>
+#include <cstring>
+
+namespace mvz {
+
+namespace {
+
+constexpr std::uint32_t cache_format_version{ 1 };
+
+constexpr char cache_magic[4]{ 'M', 'V', 'Z', 'P' };
+
+// Anything larger is not a program binary, but a corrupt length.
+constexpr std::uint32_t max_binary_size{ 64u << 20 };
+
+void
+write_u32(std::ostream& stream, const std::uint32_t value)
+{
+  const unsigned char bytes[4]{ static_cast<unsigned char>(value),
+                                static_cast<unsigned char>(value >> 8),
+                                static_cast<unsigned char>(value >> 16),
+                                static_cast<unsigned char>(value >> 24) };
+  stream.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+}
+
+auto
+read_u32(std::istream& stream, std::uint32_t& value) -> bool
+{
+  unsigned char bytes[4]{};
+  if (!stream.read(reinterpret_cast<char*>(bytes), sizeof(bytes))) {
+    return false;
+  }
+  value = static_cast<std::uint32_t>(bytes[0]) | (static_cast<std::uint32_t>(bytes[1]) << 8) |
+          (static_cast<std::uint32_t>(bytes[2]) << 16) | (static_cast<std::uint32_t>(bytes[3]) << 24);
+  return true;
+}
+
+} // namespace
+
+auto
+get_program_cache_name(const std::uint64_t key) -> std::string
+{
+  std::ostringstream stream;
+  stream << "program-" << std::hex << std::setw(16) << std::setfill('0') << key << "-v" << std::dec
+         << cache_format_version << ".bin";
+  return stream.str();
+}
+
+auto
+load_program_binary(const std::string& path, program_binary& binary) -> bool
+{
+  std::ifstream file(path, std::ios::binary);
+
+  char magic[4]{};
+
+  std::uint32_t version{};
+  std::uint32_t format{};
+  std::uint32_t size{};
+
+  if (!file.read(magic, sizeof(magic)) || (std::memcmp(magic, cache_magic, sizeof(magic)) != 0) ||
+      !read_u32(file, version) || (version != cache_format_version) || !read_u32(file, format) ||
+      !read_u32(file, size) || (size == 0) || (size > max_binary_size)) {
+    return false;
+  }
+
+  program_binary result;
+  result.format = format;
+  result.data.resize(size);
+
+  if (!file.read(reinterpret_cast<char*>(result.data.data()), static_cast<std::streamsize>(size))) {
+    return false;
+  }
+
+  binary = std::move(result);
+
+  return true;
+}
+
+auto
+save_program_binary(const std::string& path, const program_binary& binary) -> bool
+{
+  const auto temp_path = path + ".tmp" + std::to_string(std::random_device{}());
+
+  {
+    std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+
+    file.write(cache_magic, sizeof(cache_magic));
+    write_u32(file, cache_format_version);
+    write_u32(file, binary.format);
+    write_u32(file, static_cast<std::uint32_t>(binary.data.size()));
+    file.write(reinterpret_cast<const char*>(binary.data.data()), static_cast<std::streamsize>(binary.data.size()));
+
+    if (!file.flush()) {
+      file.close();
+      std::remove(temp_path.c_str());
+      return false;
+    }
+  }
+
+  if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+} // namespace mvz
@@ -0,0 +1,36 @@
+#pragma once
+
+#ifndef MVZ_BUILD
+#error "This header is not meant to be included outside of the build."
+#endif
+
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+namespace mvz {
+
+// A linked program as returned by glGetProgramBinary(), which only the driver that made it can load again.
+struct program_binary final
+{
+  std::uint32_t format{};
+
+  std::vector<unsigned char> data;
+};
+
+// The name of the cache file for a program. The key has to cover the driver and the source of every shader, since a
+// binary is only valid for both.
+auto
+get_program_cache_name(std::uint64_t key) -> std::string;
+
+// Returns false if the file does not exist or is not complete.
+auto
+load_program_binary(const std::string& path, program_binary& binary) -> bool;
+
+// Writes to a temporary file that is renamed into place, like save_specular_chain(). Returns false if the file could
+// not be written.
+auto
+save_program_binary(const std::string& path, const program_binary& binary) -> bool;
+
+} // namespace mvz
@@ -0,0 +1,356 @@
+#include "mvz_random.h"
+
+#include <algorithm>
+#include <sstream>
+#include <utility>
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define MVZ_RANDOM_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace mvz {
+
+namespace {
+
+constexpr std::uint32_t philox_m0{ 0xD2511F53 };
+
+constexpr std::uint32_t philox_m1{ 0xCD9E8D57 };
+
+constexpr std::uint32_t philox_w0{ 0x9E3779B9 };
+
+constexpr std::uint32_t philox_w1{ 0xBB67AE85 };
+
+constexpr int philox_rounds{ 10 };
+
+// Every sample has its own streams, which are split into blocks of four numbers. The counter is
+// (block, stream, index low, index high) and the key is the seed.
+enum stream : std::uint32_t
+{
+  camera_stream,
+  first_instance_stream
+};
+
+//=========//
+// Drawing //
+//=========//
+
+auto
+to_unit(const std::uint32_t x) -> float
+{
+  return static_cast<float>(x >> 8) * (1.0F / 16777216.0F);
+}
+
+auto
+draw(const std::uint32_t x, const float min_value, const float max_value) -> float
+{
+  return min_value + (max_value - min_value) * to_unit(x);
+}
+
+auto
+pick(const std::uint32_t x, const int n) -> int
+{
+  return static_cast<int>((static_cast<std::uint64_t>(x) * static_cast<std::uint32_t>(n)) >> 32);
+}
+
+// Takes the first block of the camera stream: azimuth, elevation, distance and field of view.
+auto
+make_camera(const randomization_config& config, const std::uint32_t* words) -> camera
+{
+  const auto azimuth = draw(words[0], 0, 6.28318530718F);
+  const auto elevation = draw(words[1], config.min_elevation, config.max_elevation);
+  const auto distance = draw(words[2], config.min_distance, config.max_distance);
+
+  const auto horizontal = distance * std::cos(elevation);
+
+  camera cam;
+  cam.position = { config.target.x + horizontal * std::sin(azimuth),
+                   config.target.y + distance * std::sin(elevation),
+                   config.target.z + horizontal * std::cos(azimuth) };
+  // Pitching down by the elevation and yawing by the azimuth points the camera's -Z axis at the target.
+  cam.rotation = { -elevation, azimuth, 0 };
+  cam.fovy = draw(words[3], config.min_fovy, config.max_fovy);
+  cam.resolution[0] = config.resolution[0];
+  cam.resolution[1] = config.resolution[1];
+  cam.aspect = static_cast<float>(config.resolution[0]) / static_cast<float>(config.resolution[1]);
+  return cam;
+}
+
+auto
+make_instance(const randomization_config& config, const std::uint32_t* words) -> mesh_instance
+{
+  auto inst = config.assets[pick(words[0], static_cast<int>(config.assets.size()))];
+
+  const auto scale = draw(words[1], config.min_scale, config.max_scale);
+  inst.scale = { scale, scale, scale };
+
+  inst.translation = { draw(words[3], config.min_translation.x, config.max_translation.x),
+                       draw(words[4], config.min_translation.y, config.max_translation.y),
+                       draw(words[5], config.min_translation.z, config.max_translation.z) };
+
+  const auto yaw = draw(words[2], 0, 6.28318530718F);
+
+  if (config.free_rotation) {
+    inst.rotation = { draw(words[6], 0, 6.28318530718F), yaw, draw(words[7], 0, 6.28318530718F) };
+  } else {
+    inst.rotation = { 0, yaw, 0 };
+  }
+
+  return inst;
+}
+
+void
+check_range(const char* name, const float min_value, const float max_value)
+{
+  if (min_value > max_value) {
+    std::ostringstream stream;
+    stream << "The randomization range of '" << name << "' is reversed.";
+    throw runtime_error(stream.str());
+  }
+}
+
+//==============//
+// Batch Philox //
+//==============//
+
+#ifdef MVZ_RANDOM_SSE2
+
+// The low and high halves of the 32-bit products of each lane. SSE2 only multiplies the even lanes, so the odd lanes
+// are shifted down and multiplied separately.
+void
+mulhilo(const __m128i x, const __m128i m, __m128i& lo, __m128i& hi)
+{
+  const auto low_mask = _mm_set_epi32(0, -1, 0, -1);
+  const auto even = _mm_mul_epu32(x, m);
+  const auto odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), m);
+  lo = _mm_or_si128(_mm_and_si128(even, low_mask), _mm_slli_epi64(odd, 32));
+  hi = _mm_or_si128(_mm_srli_epi64(even, 32), _mm_andnot_si128(low_mask, odd));
+}
+
+// Four counters at a time, one per lane, with the words of each counter spread across the registers.
+void
+philox4x32_x4(__m128i (&c)[4], std::array<std::uint32_t, 2> key)
+{
+  const auto m0 = _mm_set1_epi32(static_cast<int>(philox_m0));
+  const auto m1 = _mm_set1_epi32(static_cast<int>(philox_m1));
+
+  for (int round = 0; round < philox_rounds; round++) {
+    __m128i lo0;
+    __m128i hi0;
+    __m128i lo1;
+    __m128i hi1;
+    mulhilo(c[0], m0, lo0, hi0);
+    mulhilo(c[2], m1, lo1, hi1);
+
+    const auto k0 = _mm_set1_epi32(static_cast<int>(key[0]));
+    const auto k1 = _mm_set1_epi32(static_cast<int>(key[1]));
+
+    c[0] = _mm_xor_si128(_mm_xor_si128(hi1, c[1]), k0);
+    c[1] = lo1;
+    c[2] = _mm_xor_si128(_mm_xor_si128(hi0, c[3]), k1);
+    c[3] = lo0;
+
+    key[0] += philox_w0;
+    key[1] += philox_w1;
+  }
+}
+
+#endif
+
+// Draws one block of a stream for the samples [first, first + count) into 'words', four words per sample.
+void
+philox_batch(const std::array<std::uint32_t, 2>& key,
+             const std::uint32_t block,
+             const std::uint32_t stream_id,
+             const std::uint64_t first,
+             const std::size_t count,
+             std::uint32_t* words)
+{
+  std::size_t i = 0;
+
+#ifdef MVZ_RANDOM_SSE2
+  for (; (i + 4) <= count; i += 4) {
+
+    alignas(16) std::uint32_t index_lo[4];
+    alignas(16) std::uint32_t index_hi[4];
+
+    for (int lane = 0; lane < 4; lane++) {
+      const auto index = first + i + static_cast<std::size_t>(lane);
+      index_lo[lane] = static_cast<std::uint32_t>(index);
+      index_hi[lane] = static_cast<std::uint32_t>(index >> 32);
+    }
+
+    __m128i c[4]{ _mm_set1_epi32(static_cast<int>(block)),
+                  _mm_set1_epi32(static_cast<int>(stream_id)),
+                  _mm_load_si128(reinterpret_cast<const __m128i*>(index_lo)),
+                  _mm_load_si128(reinterpret_cast<const __m128i*>(index_hi)) };
+
+    philox4x32_x4(c, key);
+
+    alignas(16) std::uint32_t out[4][4];
+
+    for (int w = 0; w < 4; w++) {
+      _mm_store_si128(reinterpret_cast<__m128i*>(out[w]), c[w]);
+    }
+
+    for (int lane = 0; lane < 4; lane++) {
+      for (int w = 0; w < 4; w++) {
+        words[(i + static_cast<std::size_t>(lane)) * 4 + static_cast<std::size_t>(w)] = out[w][lane];
+      }
+    }
+  }
+#endif
+
+  for (; i < count; i++) {
+    const auto index = first + i;
+    const auto block_words = philox4x32(
+      { block, stream_id, static_cast<std::uint32_t>(index), static_cast<std::uint32_t>(index >> 32) }, key);
+    for (std::size_t w = 0; w < 4; w++) {
+      words[i * 4 + w] = block_words[w];
+    }
+  }
+}
+
+} // namespace
+
+auto
+philox4x32(const std::array<std::uint32_t, 4>& counter, const std::array<std::uint32_t, 2>& key)
+  -> std::array<std::uint32_t, 4>
+{
+  auto c = counter;
+  auto k = key;
+
+  for (int round = 0; round < philox_rounds; round++) {
+    const auto p0 = static_cast<std::uint64_t>(philox_m0) * c[0];
+    const auto p1 = static_cast<std::uint64_t>(philox_m1) * c[2];
+
+    c = { static_cast<std::uint32_t>(p1 >> 32) ^ c[1] ^ k[0],
+          static_cast<std::uint32_t>(p1),
+          static_cast<std::uint32_t>(p0 >> 32) ^ c[3] ^ k[1],
+          static_cast<std::uint32_t>(p0) };
+
+    k[0] += philox_w0;
+    k[1] += philox_w1;
+  }
+
+  return c;
+}
+
+//============//
+// Randomizer //
+//============//
+
+randomizer::randomizer(const std::uint64_t seed, randomization_config config)
+  : m_key{ static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32) }
+  , m_config(std::move(config))
+{
+  check_range("distance", m_config.min_distance, m_config.max_distance);
+  check_range("elevation", m_config.min_elevation, m_config.max_elevation);
+  check_range("fovy", m_config.min_fovy, m_config.max_fovy);
+  check_range("scale", m_config.min_scale, m_config.max_scale);
+  check_range("translation.x", m_config.min_translation.x, m_config.max_translation.x);
+  check_range("translation.y", m_config.min_translation.y, m_config.max_translation.y);
+  check_range("translation.z", m_config.min_translation.z, m_config.max_translation.z);
+
+  if ((m_config.min_instances < 0) || (m_config.min_instances > m_config.max_instances)) {
+    throw runtime_error("The randomization range of the instance count is invalid.");
+  }
+
+  if ((m_config.max_instances > 0) && m_config.assets.empty()) {
+    throw runtime_error("Instances were requested, but there are no assets to pick from.");
+  }
+
+  if (m_config.num_skyboxes < 1) {
+    throw runtime_error("There has to be at least one skybox to pick from.");
+  }
+}
+
+auto
+randomizer::generate(const std::uint64_t index) const -> sample_parameters
+{
+  const auto index_lo = static_cast<std::uint32_t>(index);
+  const auto index_hi = static_cast<std::uint32_t>(index >> 32);
+
+  const auto pose = philox4x32({ 0, camera_stream, index_lo, index_hi }, m_key);
+  const auto choices = philox4x32({ 1, camera_stream, index_lo, index_hi }, m_key);
+
+  sample_parameters sample;
+  sample.cam = make_camera(m_config, pose.data());
+  sample.skybox = pick(choices[0], m_config.num_skyboxes);
+
+  const auto num_instances =
+    m_config.min_instances + pick(choices[1], m_config.max_instances - m_config.min_instances + 1);
+
+  sample.instances.reserve(static_cast<std::size_t>(num_instances));
+
+  for (int i = 0; i < num_instances; i++) {
+    const auto stream_id = first_instance_stream + static_cast<std::uint32_t>(i);
+    const auto block0 = philox4x32({ 0, stream_id, index_lo, index_hi }, m_key);
+    const auto block1 = philox4x32({ 1, stream_id, index_lo, index_hi }, m_key);
+    const std::uint32_t words[8]{ block0[0], block0[1], block0[2], block0[3],
+                                  block1[0], block1[1], block1[2], block1[3] };
+    sample.instances.emplace_back(make_instance(m_config, words));
+  }
+
+  return sample;
+}
+
+void
+randomizer::generate_cameras(const std::uint64_t first, const std::size_t count, camera* cameras) const
+{
+  std::vector<std::uint32_t> words(count * 4);
+
+  philox_batch(m_key, 0, camera_stream, first, count, words.data());
+
+  for (std::size_t i = 0; i < count; i++) {
+    cameras[i] = make_camera(m_config, &words[i * 4]);
+  }
+}
+
+void
+randomizer::generate_batch(const std::uint64_t first, const std::size_t count, sample_parameters* samples) const
+{
+  std::vector<std::uint32_t> pose_words(count * 4);
+  std::vector<std::uint32_t> choice_words(count * 4);
+
+  philox_batch(m_key, 0, camera_stream, first, count, pose_words.data());
+  philox_batch(m_key, 1, camera_stream, first, count, choice_words.data());
+
+  int max_instances{};
+
+  for (std::size_t i = 0; i < count; i++) {
+    auto& sample = samples[i];
+    sample.cam = make_camera(m_config, &pose_words[i * 4]);
+    sample.skybox = pick(choice_words[i * 4], m_config.num_skyboxes);
+    const auto num_instances =
+      m_config.min_instances + pick(choice_words[i * 4 + 1], m_config.max_instances - m_config.min_instances + 1);
+    sample.instances.resize(static_cast<std::size_t>(num_instances));
+    max_instances = std::max(max_instances, num_instances);
+  }
+
+  // Instance streams are drawn for the whole batch, and samples with fewer instances ignore the extra numbers.
+  std::vector<std::uint32_t> block0(count * 4);
+  std::vector<std::uint32_t> block1(count * 4);
+
+  for (int instance = 0; instance < max_instances; instance++) {
+
+    const auto stream_id = first_instance_stream + static_cast<std::uint32_t>(instance);
+
+    philox_batch(m_key, 0, stream_id, first, count, block0.data());
+    philox_batch(m_key, 1, stream_id, first, count, block1.data());
+
+    for (std::size_t i = 0; i < count; i++) {
+      auto& instances = samples[i].instances;
+      if (static_cast<std::size_t>(instance) >= instances.size()) {
+        continue;
+      }
+      const std::uint32_t words[8]{ block0[i * 4], block0[i * 4 + 1], block0[i * 4 + 2], block0[i * 4 + 3],
+                                    block1[i * 4], block1[i * 4 + 1], block1[i * 4 + 2], block1[i * 4 + 3] };
+      instances[static_cast<std::size_t>(instance)] = make_instance(m_config, words);
+    }
+  }
+}
+
+} // namespace mvz
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "mvz.h"
+
+#include <array>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mvz {
+
+// Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3"). The output is a pure function of the
+// counter and the key, so there is no generator state to carry from one number to the next.
+auto
+philox4x32(const std::array<std::uint32_t, 4>& counter, const std::array<std::uint32_t, 2>& key)
+  -> std::array<std::uint32_t, 4>;
+
+// Ranges are inclusive on both ends. Angles are in radians.
+struct randomization_config final
+{
+  // The camera orbits the target at a random azimuth, elevation and distance, looking at it.
+  vec3 target{ 0, 0, 0 };
+
+  float min_distance{ 5 };
+
+  float max_distance{ 15 };
+
+  float min_elevation{ 0 };
+
+  float max_elevation{ 0.5 };
+
+  float min_fovy{ 0.5 };
+
+  float max_fovy{ 0.5 };
+
+  int resolution[2]{ 640, 480 };
+
+  int num_skyboxes{ 1 };
+
+  // Instances are picked uniformly from these, and get their obj_id and shape_index from them.
+  std::vector<mesh_instance> assets;
+
+  int min_instances{ 0 };
+
+  int max_instances{ 0 };
+
+  vec3 min_translation{ -1, 0, -1 };
+
+  vec3 max_translation{ 1, 0, 1 };
+
+  // Scales are uniform across the axes.
+  float min_scale{ 1 };
+
+  float max_scale{ 1 };
+
+  // Instances are rotated about the Y axis only, unless this is set.
+  bool free_rotation{ false };
+};
+
+struct sample_parameters final
+{
+  camera cam;
+
+  std::vector<mesh_instance> instances;
+
+  int skybox{};
+};
+
+// Draws the parameters of a sample from a stream of random numbers that is keyed by the seed and the sample index, so
+// that any sample can be generated on its own, in any order, on any thread or process, and always come out the same.
+class randomizer final
+{
+public:
+  // Throws a runtime_error if a range is reversed, or if instances are requested but there are no assets.
+  randomizer(std::uint64_t seed, randomization_config config);
+
+  auto generate(std::uint64_t index) const -> sample_parameters;
+
+  // The same cameras that generate() produces for the samples [first, first + count), with the random numbers of
+  // four samples drawn at a time.
+  void generate_cameras(std::uint64_t first, std::size_t count, camera* cameras) const;
+
+  void generate_batch(std::uint64_t first, std::size_t count, sample_parameters* samples) const;
+
+  auto config() const -> const randomization_config& { return m_config; }
+
+private:
+  std::array<std::uint32_t, 2> m_key{};
+
+  randomization_config m_config;
+};
+
+} // namespace mvz
@@ -0,0 +1,249 @@
+#include "mvz_sh.h"
+
+#include <algorithm>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cmath>
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define MVZ_SH_SSE2 1
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+namespace mvz {
+
+namespace {
+
+constexpr int num_coefficients{ 9 };
+
+// The basis functions are these constants times the polynomials of sh9_irradiance.
+constexpr std::array<float, num_coefficients> basis_scale{ 0.282095F, 0.488603F, 0.488603F, 0.488603F, 1.092548F,
+                                                           1.092548F, 0.315392F, 1.092548F, 0.546274F };
+
+// The clamped cosine convolved into each band, divided by pi (Ramamoorthi and Hanrahan, 2001).
+constexpr std::array<float, num_coefficients> band_scale{ 1.0F,        2.0F / 3.0F, 2.0F / 3.0F, 2.0F / 3.0F, 0.25F,
+                                                          0.25F,       0.25F,       0.25F,       0.25F };
+
+// A texel (s, t) of a face, with both in [-1, 1], points along s * u + t * v + n.
+struct face_axes final
+{
+  glm::vec3 u;
+
+  glm::vec3 v;
+
+  glm::vec3 n;
+};
+
+const std::array<face_axes, 6> cube_axes{ { { { 0, 0, -1 }, { 0, -1, 0 }, { 1, 0, 0 } },
+                                            { { 0, 0, 1 }, { 0, -1, 0 }, { -1, 0, 0 } },
+                                            { { 1, 0, 0 }, { 0, 0, 1 }, { 0, 1, 0 } },
+                                            { { 1, 0, 0 }, { 0, 0, -1 }, { 0, -1, 0 } },
+                                            { { 1, 0, 0 }, { 0, -1, 0 }, { 0, 0, 1 } },
+                                            { { -1, 0, 0 }, { 0, -1, 0 }, { 0, 0, -1 } } } };
+
+// The weighted sums of one row, coefficient major.
+using row_sums = std::array<float, num_coefficients * 3>;
+
+void
+accumulate(row_sums& sums, const float x, const float y, const float z, const float weight, const unsigned char* texel)
+{
+  const float basis[num_coefficients]{ 1.0F,      y,     z, x, x * y, y * z, 3.0F * z * z - 1.0F,
+                                       x * z,     x * x - y * y };
+
+  const float rgb[3]{ texel[0] * weight, texel[1] * weight, texel[2] * weight };
+
+  for (int k = 0; k < num_coefficients; k++) {
+    for (int c = 0; c < 3; c++) {
+      sums[k * 3 + c] += basis[k] * rgb[c];
+    }
+  }
+}
+
+void
+integrate_row(const cube_face_view& face, const face_axes& axes, const int row, row_sums& sums)
+{
+  const auto t = 2.0F * (static_cast<float>(row) + 0.5F) / static_cast<float>(face.height) - 1.0F;
+
+  const auto ds = 2.0F / static_cast<float>(face.width);
+
+  // The solid angle of a texel is its area on the face divided by the cube of its distance from the center, and texels
+  // are converted from [0, 255] here as well.
+  const auto area = (4.0F / (static_cast<float>(face.width) * static_cast<float>(face.height))) / 255.0F;
+
+  const auto* texels = face.pixels + static_cast<std::size_t>(row) * static_cast<std::size_t>(face.width) * 4;
+
+  sums.fill(0.0F);
+
+  int i = 0;
+
+#ifdef MVZ_SH_SSE2
+  {
+    __m128 acc[num_coefficients][3];
+
+    for (auto& coefficient : acc) {
+      for (auto& channel : coefficient) {
+        channel = _mm_setzero_ps();
+      }
+    }
+
+    const auto base_x = _mm_set1_ps(t * axes.v.x + axes.n.x);
+    const auto base_y = _mm_set1_ps(t * axes.v.y + axes.n.y);
+    const auto base_z = _mm_set1_ps(t * axes.v.z + axes.n.z);
+
+    const auto u_x = _mm_set1_ps(axes.u.x);
+    const auto u_y = _mm_set1_ps(axes.u.y);
+    const auto u_z = _mm_set1_ps(axes.u.z);
+
+    const auto one = _mm_set1_ps(1.0F);
+    const auto three = _mm_set1_ps(3.0F);
+    const auto area_v = _mm_set1_ps(area);
+    const auto zero = _mm_setzero_si128();
+
+    for (; (i + 4) <= face.width; i += 4) {
+
+      const auto s = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_set_ps(3.5F, 2.5F, 1.5F, 0.5F),
+                                                      _mm_set1_ps(static_cast<float>(i))),
+                                           _mm_set1_ps(ds)),
+                                one);
+
+      const auto dx = _mm_add_ps(_mm_mul_ps(s, u_x), base_x);
+      const auto dy = _mm_add_ps(_mm_mul_ps(s, u_y), base_y);
+      const auto dz = _mm_add_ps(_mm_mul_ps(s, u_z), base_z);
+
+      const auto len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+      const auto inv_len = _mm_div_ps(one, _mm_sqrt_ps(len2));
+      const auto weight = _mm_mul_ps(area_v, _mm_mul_ps(inv_len, _mm_mul_ps(inv_len, inv_len)));
+
+      const auto x = _mm_mul_ps(dx, inv_len);
+      const auto y = _mm_mul_ps(dy, inv_len);
+      const auto z = _mm_mul_ps(dz, inv_len);
+
+      // Four RGBA texels, widened to one float vector each and transposed to one vector per channel.
+      const auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(texels + i * 4));
+      const auto lo = _mm_unpacklo_epi8(bytes, zero);
+      const auto hi = _mm_unpackhi_epi8(bytes, zero);
+      auto p0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+      auto p1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+      auto p2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+      auto p3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+      _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+
+      const __m128 rgb[3]{ _mm_mul_ps(p0, weight), _mm_mul_ps(p1, weight), _mm_mul_ps(p2, weight) };
+
+      const __m128 basis[num_coefficients]{ one,
+                                            y,
+                                            z,
+                                            x,
+                                            _mm_mul_ps(x, y),
+                                            _mm_mul_ps(y, z),
+                                            _mm_sub_ps(_mm_mul_ps(three, _mm_mul_ps(z, z)), one),
+                                            _mm_mul_ps(x, z),
+                                            _mm_sub_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)) };
+
+      for (int k = 0; k < num_coefficients; k++) {
+        for (int c = 0; c < 3; c++) {
+          acc[k][c] = _mm_add_ps(acc[k][c], _mm_mul_ps(basis[k], rgb[c]));
+        }
+      }
+    }
+
+    for (int k = 0; k < num_coefficients; k++) {
+      for (int c = 0; c < 3; c++) {
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, acc[k][c]);
+        sums[k * 3 + c] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+      }
+    }
+  }
+#endif
+
+  for (; i < face.width; i++) {
+    const auto s = (static_cast<float>(i) + 0.5F) * ds - 1.0F;
+    const auto dir = s * axes.u + t * axes.v + axes.n;
+    const auto inv_len = 1.0F / std::sqrt(glm::dot(dir, dir));
+    const auto n = dir * inv_len;
+    accumulate(sums, n.x, n.y, n.z, area * inv_len * inv_len * inv_len, texels + i * 4);
+  }
+}
+
+} // namespace
+
+auto
+get_cube_direction(const int face, const float s, const float t) -> glm::vec3
+{
+  const auto& axes = cube_axes.at(static_cast<std::size_t>(face));
+  return s * axes.u + t * axes.v + axes.n;
+}
+
+auto
+project_irradiance(const std::array<cube_face_view, 6>& faces, int num_threads) -> sh9_irradiance
+{
+  std::vector<std::pair<int, int>> rows;
+
+  for (int f = 0; f < 6; f++) {
+    for (int y = 0; y < faces[f].height; y++) {
+      rows.emplace_back(f, y);
+    }
+  }
+
+  if (num_threads <= 0) {
+    num_threads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+  }
+
+  // Every row has its own sums, which are added up in order afterwards, so that the split does not change the result.
+  std::vector<row_sums> sums(rows.size());
+
+  const auto rows_per_thread = (rows.size() + static_cast<std::size_t>(num_threads) - 1) / num_threads;
+
+  auto integrate = [&](const std::size_t thread_index) {
+    const auto first = thread_index * rows_per_thread;
+    const auto last = std::min(first + rows_per_thread, rows.size());
+    for (auto r = first; r < last; r++) {
+      integrate_row(faces[rows[r].first], cube_axes[rows[r].first], rows[r].second, sums[r]);
+    }
+  };
+
+  std::vector<std::thread> threads;
+
+  for (int i = 1; i < num_threads; i++) {
+    threads.emplace_back(integrate, static_cast<std::size_t>(i));
+  }
+
+  integrate(0);
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  std::array<double, num_coefficients * 3> total{};
+
+  for (const auto& row : sums) {
+    for (std::size_t i = 0; i < total.size(); i++) {
+      total[i] += row[i];
+    }
+  }
+
+  sh9_irradiance sh;
+
+  for (int k = 0; k < num_coefficients; k++) {
+    const auto scale = static_cast<double>(basis_scale[k]) * basis_scale[k] * band_scale[k];
+    sh[k] = glm::vec3(static_cast<float>(total[k * 3] * scale),
+                      static_cast<float>(total[k * 3 + 1] * scale),
+                      static_cast<float>(total[k * 3 + 2] * scale));
+  }
+
+  return sh;
+}
+
+auto
+evaluate_irradiance(const sh9_irradiance& sh, const glm::vec3& n) -> glm::vec3
+{
+  return sh[0] + sh[1] * n.y + sh[2] * n.z + sh[3] * n.x + sh[4] * (n.x * n.y) + sh[5] * (n.y * n.z) +
+         sh[6] * (3.0F * n.z * n.z - 1.0F) + sh[7] * (n.x * n.z) + sh[8] * (n.x * n.x - n.y * n.y);
+}
+
+} // namespace mvz
@@ -0,0 +1,44 @@
+#pragma once
+
+#ifndef MVZ_BUILD
+#error "This header is not meant to be included outside of the build."
+#endif
+
+#include <glm/glm.hpp>
+
+#include <array>
+
+namespace mvz {
+
+// One face of an RGBA8 cube map, in the order GL numbers the faces (+X, -X, +Y, -Y, +Z, -Z).
+struct cube_face_view final
+{
+  const unsigned char* pixels{ nullptr };
+
+  int width{};
+
+  int height{};
+};
+
+// The direction through a point of a face, with s and t in [-1, 1] running along the face's texel columns and rows.
+// The direction is not normalized.
+auto
+get_cube_direction(int face, float s, float t) -> glm::vec3;
+
+// The diffuse irradiance of an environment as nine spherical harmonics coefficients. The cosine lobe and the 1/pi of a
+// Lambertian surface are folded into them, so the reflected radiance for a unit normal n is the polynomial
+//
+//   c0 + c1 y + c2 z + c3 x + c4 xy + c5 yz + c6 (3z^2 - 1) + c7 xz + c8 (x^2 - y^2)
+//
+// times the albedo. This is what the mesh shaders evaluate.
+using sh9_irradiance = std::array<glm::vec3, 9>;
+
+// Projects the faces on the given number of threads (zero means one per hardware thread). The result does not depend
+// on the number of threads.
+auto
+project_irradiance(const std::array<cube_face_view, 6>& faces, int num_threads = 0) -> sh9_irradiance;
+
+auto
+evaluate_irradiance(const sh9_irradiance& sh, const glm::vec3& n) -> glm::vec3;
+
+} // namespace mvz
@@ -0,0 +1,337 @@
+#include "mvz_shard.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include <cstring>
+
+namespace mvz {
+
+namespace {
+
+constexpr std::size_t tar_block_size{ 512 };
+
+// Shards are written in blocks of this size, so that the file system sees a few large sequential writes.
+constexpr std::size_t write_block_size{ std::size_t(4) << 20 };
+
+auto
+padded_size(const std::size_t size) -> std::size_t
+{
+  return ((size + tar_block_size - 1) / tar_block_size) * tar_block_size;
+}
+
+void
+write_octal(char* field, const std::size_t field_size, std::uint64_t value)
+{
+  // The field is NUL terminated.
+  std::memset(field, '0', field_size - 1);
+
+  field[field_size - 1] = 0;
+
+  for (std::size_t i = field_size - 1; (i > 0) && (value > 0); i--) {
+    field[i - 1] = static_cast<char>('0' + (value & 7));
+    value >>= 3;
+  }
+
+  if (value > 0) {
+    throw runtime_error("Tar member is too large.");
+  }
+}
+
+// A ustar header for a regular file.
+auto
+make_tar_header(const std::string& name, const std::size_t size) -> std::vector<unsigned char>
+{
+  if (name.size() > 100) {
+    std::ostringstream stream;
+    stream << "Tar member name '" << name << "' is too long.";
+    throw runtime_error(stream.str());
+  }
+
+  std::vector<unsigned char> header(tar_block_size, 0);
+
+  auto* h = reinterpret_cast<char*>(header.data());
+
+  std::memcpy(h, name.data(), name.size());
+
+  write_octal(h + 100, 8, 0644);
+  write_octal(h + 108, 8, 0);
+  write_octal(h + 116, 8, 0);
+  write_octal(h + 124, 12, size);
+  write_octal(h + 136, 12, 0);
+
+  h[156] = '0';
+
+  std::memcpy(h + 257, "ustar", 6);
+  std::memcpy(h + 263, "00", 2);
+
+  // The checksum is computed with its own field set to spaces, and then stored as six digits, a NUL and a space.
+  std::memset(h + 148, ' ', 8);
+
+  unsigned int checksum{};
+
+  for (const auto byte : header) {
+    checksum += byte;
+  }
+
+  write_octal(h + 148, 7, checksum);
+
+  h[155] = ' ';
+
+  return header;
+}
+
+void
+append_u64_le(std::vector<unsigned char>& output, const std::uint64_t value)
+{
+  for (int i = 0; i < 8; i++) {
+    output.push_back(static_cast<unsigned char>(value >> (i * 8)));
+  }
+}
+
+auto
+make_sample_name(const std::uint64_t index) -> std::string
+{
+  std::ostringstream stream;
+  stream << std::setw(8) << std::setfill('0') << index;
+  return stream.str();
+}
+
+} // namespace
+
+shard_sink::shard_sink(std::string directory,
+                       std::vector<image_type> types,
+                       const bool with_labels,
+                       const std::size_t max_shard_size,
+                       std::string prefix)
+  : m_directory(std::move(directory))
+  , m_prefix(std::move(prefix))
+  , m_types(std::move(types))
+  , m_with_labels(with_labels)
+  , m_max_shard_size(max_shard_size)
+{
+  m_block.reserve(write_block_size);
+}
+
+shard_sink::~shard_sink()
+{
+  try {
+    close();
+  } catch (...) {
+  }
+}
+
+void
+shard_sink::write(const frame& f, const char* extension, const std::vector<unsigned char>& data)
+{
+  std::ostringstream name_stream;
+  name_stream << make_sample_name(f.index) << '.' << get_type_name(f.type) << extension;
+
+  add_member(f.index, member{ name_stream.str(), data }, false);
+}
+
+void
+shard_sink::set_label(const std::uint64_t index, std::string json)
+{
+  member m{ make_sample_name(index) + ".json", std::vector<unsigned char>(json.begin(), json.end()) };
+
+  add_member(index, std::move(m), true);
+}
+
+void
+shard_sink::flush()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  flush_block();
+
+  if (m_file.is_open()) {
+    m_file.flush();
+  }
+}
+
+void
+shard_sink::close()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if (m_closed) {
+    return;
+  }
+
+  m_closed = true;
+
+  for (const auto& entry : m_pending) {
+    append_sample(entry.first, entry.second);
+  }
+
+  m_pending.clear();
+
+  close_shard();
+}
+
+void
+shard_sink::add_member(const std::uint64_t index, member&& m, const bool is_label)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if (m_closed) {
+    throw runtime_error("Cannot add to a shard sink after it was closed.");
+  }
+
+  auto& s = m_pending[index];
+
+  s.members.emplace_back(std::move(m));
+
+  if (is_label) {
+    s.has_label = true;
+  } else {
+    s.num_images++;
+  }
+
+  const auto complete = (s.num_images >= m_types.size()) && (s.has_label || !m_with_labels);
+
+  if (complete) {
+    append_sample(index, s);
+    m_pending.erase(index);
+  }
+}
+
+void
+shard_sink::append_sample(const std::uint64_t index, const sample& s)
+{
+  std::size_t sample_size{};
+
+  for (const auto& m : s.members) {
+    sample_size += tar_block_size + padded_size(m.data.size());
+  }
+
+  // The two zero blocks at the end of the archive count towards the limit.
+  if ((m_shard_size > 0) && ((m_shard_size + sample_size + 2 * tar_block_size) > m_max_shard_size)) {
+    close_shard();
+  }
+
+  if (!m_file.is_open()) {
+    open_shard();
+  }
+
+  append_u64_le(m_index, index);
+  append_u64_le(m_index, m_shard_size);
+  append_u64_le(m_index, sample_size);
+
+  // Members arrive in whatever order the encoder threads finish, so they are sorted to make shards reproducible.
+  std::vector<const member*> members;
+
+  for (const auto& m : s.members) {
+    members.emplace_back(&m);
+  }
+
+  std::sort(members.begin(), members.end(), [](const member* a, const member* b) { return a->name < b->name; });
+
+  const unsigned char padding[tar_block_size]{};
+
+  for (const auto* m : members) {
+
+    const auto header = make_tar_header(m->name, m->data.size());
+
+    append_bytes(header.data(), header.size());
+
+    append_bytes(m->data.data(), m->data.size());
+
+    append_bytes(padding, padded_size(m->data.size()) - m->data.size());
+  }
+}
+
+void
+shard_sink::open_shard()
+{
+  std::ostringstream path_stream;
+  path_stream << m_directory << '/' << m_prefix << '-' << std::setw(6) << std::setfill('0') << m_shard_number;
+
+  m_shard_path = path_stream.str();
+
+  m_file.open(m_shard_path + ".tar", std::ios::binary | std::ios::trunc);
+
+  if (!m_file) {
+    std::ostringstream stream;
+    stream << "Failed to open '" << m_shard_path << ".tar'.";
+    throw runtime_error(stream.str());
+  }
+
+  m_shard_number++;
+
+  m_shard_size = 0;
+
+  m_index.clear();
+}
+
+void
+shard_sink::close_shard()
+{
+  if (!m_file.is_open()) {
+    return;
+  }
+
+  const unsigned char end_of_archive[2 * tar_block_size]{};
+
+  append_bytes(end_of_archive, sizeof(end_of_archive));
+
+  flush_block();
+
+  m_file.close();
+
+  if (!m_file) {
+    std::ostringstream stream;
+    stream << "Failed to write '" << m_shard_path << ".tar'.";
+    throw runtime_error(stream.str());
+  }
+
+  std::ofstream index_file(m_shard_path + ".idx", std::ios::binary | std::ios::trunc);
+
+  index_file.write(reinterpret_cast<const char*>(m_index.data()), static_cast<std::streamsize>(m_index.size()));
+
+  if (!index_file) {
+    std::ostringstream stream;
+    stream << "Failed to write '" << m_shard_path << ".idx'.";
+    throw runtime_error(stream.str());
+  }
+}
+
+void
+shard_sink::append_bytes(const unsigned char* data, const std::size_t size)
+{
+  m_shard_size += size;
+
+  if ((m_block.size() + size) > write_block_size) {
+    flush_block();
+  }
+
+  // Anything that would not fit into an empty block skips it.
+  if (size >= write_block_size) {
+    m_file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+    return;
+  }
+
+  m_block.insert(m_block.end(), data, data + size);
+}
+
+void
+shard_sink::flush_block()
+{
+  if (m_block.empty()) {
+    return;
+  }
+
+  m_file.write(reinterpret_cast<const char*>(m_block.data()), static_cast<std::streamsize>(m_block.size()));
+
+  m_block.clear();
+
+  if (!m_file) {
+    std::ostringstream stream;
+    stream << "Failed to write '" << m_shard_path << ".tar'.";
+    throw runtime_error(stream.str());
+  }
+}
+
+} // namespace mvz
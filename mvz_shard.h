@@ -0,0 +1,118 @@
+#pragma once
+
+#include "mvz_writer.h"
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mvz {
+
+// Collects the images of each sample and appends them to tar shards in the WebDataset layout, so that every member of
+// sample 12 is named '00000012.<type><ext>' and the members of a sample are adjacent. A shard is closed before it would
+// grow past the size limit (unless it only holds one sample), and the next one is opened as
+// '<directory>/<prefix>-<shard number>.tar'.
+//
+// Next to each shard, '<prefix>-<shard number>.idx' lists where its samples are, as little endian records of
+//
+//   uint64 sample index, uint64 offset of the first tar header, uint64 size of all of the sample's members
+//
+// so that a sample can be fetched with a single read of the shard.
+class shard_sink final : public image_sink
+{
+public:
+  // A sample is written once an image of each of the given types has arrived, along with its label when labels are
+  // expected.
+  shard_sink(std::string directory,
+             std::vector<image_type> types,
+             bool with_labels = false,
+             std::size_t max_shard_size = std::size_t(1) << 30,
+             std::string prefix = "shard");
+
+  shard_sink(const shard_sink&) = delete;
+
+  shard_sink(shard_sink&&) = delete;
+
+  auto operator=(const shard_sink&) -> shard_sink& = delete;
+
+  auto operator=(shard_sink&&) -> shard_sink& = delete;
+
+  // Calls close(), ignoring errors.
+  ~shard_sink() override;
+
+  void write(const frame& f, const char* extension, const std::vector<unsigned char>& data) override;
+
+  // Writes the buffered part of the current shard to disk.
+  void flush() override;
+
+  // Adds '<index>.json' to the sample. May be called from any thread, before or after its images are written.
+  void set_label(std::uint64_t index, std::string json);
+
+  // Writes out the samples that are still incomplete, with whatever they have, and finishes the current shard.
+  void close();
+
+protected:
+  struct member final
+  {
+    std::string name;
+
+    std::vector<unsigned char> data;
+  };
+
+  struct sample final
+  {
+    std::vector<member> members;
+
+    std::size_t num_images{};
+
+    bool has_label{ false };
+  };
+
+  void add_member(std::uint64_t index, member&& m, bool is_label);
+
+  void append_sample(std::uint64_t index, const sample& s);
+
+  void open_shard();
+
+  void close_shard();
+
+  void append_bytes(const unsigned char* data, std::size_t size);
+
+  void flush_block();
+
+private:
+  std::string m_directory;
+
+  std::string m_prefix;
+
+  std::vector<image_type> m_types;
+
+  bool m_with_labels{ false };
+
+  std::size_t m_max_shard_size{};
+
+  std::mutex m_mutex;
+
+  std::map<std::uint64_t, sample> m_pending;
+
+  std::ofstream m_file;
+
+  std::string m_shard_path;
+
+  std::size_t m_shard_number{};
+
+  std::uint64_t m_shard_size{};
+
+  std::vector<unsigned char> m_block;
+
+  std::vector<unsigned char> m_index;
+
+  bool m_closed{ false };
+};
+
+} // namespace mvz
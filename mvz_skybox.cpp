@@ -0,0 +1,255 @@
+#include "mvz_skybox.h"
+
+#include "mvz.h"
+
+#include <algorithm>
+#include <sstream>
+#include <thread>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define MVZ_SKYBOX_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace mvz {
+
+namespace {
+
+constexpr float pi{ 3.14159265358979f };
+
+const std::array<const char*, 6> face_names{ "/px.png", "/nx.png", "/py.png", "/ny.png", "/pz.png", "/nz.png" };
+
+// The four texels around a point of the source and their weights, which add up to one.
+struct bilinear_tap final
+{
+  const unsigned char* texels[4]{};
+
+  float weights[4]{};
+};
+
+#ifdef MVZ_SKYBOX_SSE2
+
+auto
+load_texel(const unsigned char* texel) -> __m128
+{
+  std::int32_t bits{};
+  std::memcpy(&bits, texel, 4);
+
+  const auto zero = _mm_setzero_si128();
+
+  const auto bytes = _mm_cvtsi32_si128(bits);
+
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero));
+}
+
+// Blends all four channels at once. Rounds to nearest even like the scalar version, so both give the same result.
+void
+blend(const bilinear_tap& tap, unsigned char* dst)
+{
+  auto sum = _mm_mul_ps(load_texel(tap.texels[0]), _mm_set1_ps(tap.weights[0]));
+
+  for (int i = 1; i < 4; i++) {
+    sum = _mm_add_ps(sum, _mm_mul_ps(load_texel(tap.texels[i]), _mm_set1_ps(tap.weights[i])));
+  }
+
+  const auto words = _mm_packs_epi32(_mm_cvtps_epi32(sum), _mm_setzero_si128());
+
+  const auto bits = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+
+  std::memcpy(dst, &bits, 4);
+}
+
+#else
+
+void
+blend(const bilinear_tap& tap, unsigned char* dst)
+{
+  for (int c = 0; c < 4; c++) {
+
+    auto sum = tap.texels[0][c] * tap.weights[0];
+
+    for (int i = 1; i < 4; i++) {
+      sum += tap.texels[i][c] * tap.weights[i];
+    }
+
+    dst[c] = static_cast<unsigned char>(std::min(std::max(std::nearbyint(sum), 0.0f), 255.0f));
+  }
+}
+
+#endif
+
+// Uses the mapping of the original sphere sampling in the mesh shader: longitude decreases from the left edge to the
+// right, starting and ending at +Z, and the top row is +Y.
+auto
+get_equirect_tap(const cube_face_view& src, const glm::vec3& dir) -> bilinear_tap
+{
+  const auto n = glm::normalize(dir);
+
+  const auto theta = std::acos(std::min(std::max(n.y, -1.0f), 1.0f));
+
+  const auto phi = std::atan2(n.x, -n.z);
+
+  const auto u = 0.5f - phi / (2.0f * pi);
+
+  const auto v = theta / pi;
+
+  // Texel centers are at half integers. Columns wrap around, rows are clamped at the poles.
+  const auto x = u * static_cast<float>(src.width) - 0.5f;
+  const auto y = v * static_cast<float>(src.height) - 0.5f;
+
+  const auto x0 = static_cast<int>(std::floor(x));
+  const auto y0 = static_cast<int>(std::floor(y));
+
+  const auto fx = x - static_cast<float>(x0);
+  const auto fy = y - static_cast<float>(y0);
+
+  const auto wrap = [&src](const int column) { return ((column % src.width) + src.width) % src.width; };
+
+  const auto clamp = [&src](const int row) { return std::min(std::max(row, 0), src.height - 1); };
+
+  const int columns[2]{ wrap(x0), wrap(x0 + 1) };
+
+  const int rows[2]{ clamp(y0), clamp(y0 + 1) };
+
+  bilinear_tap tap;
+
+  for (int j = 0; j < 2; j++) {
+    for (int i = 0; i < 2; i++) {
+      tap.texels[j * 2 + i] = src.pixels + (static_cast<std::size_t>(rows[j]) * src.width + columns[i]) * 4;
+      tap.weights[j * 2 + i] = (i ? fx : (1.0f - fx)) * (j ? fy : (1.0f - fy));
+    }
+  }
+
+  return tap;
+}
+
+void
+resample_face(const cube_face_view& src, const int face, const int size, std::vector<unsigned char>& dst)
+{
+  dst.resize(static_cast<std::size_t>(size) * size * 4);
+
+  const auto scale = 2.0f / static_cast<float>(size);
+
+  for (int y = 0; y < size; y++) {
+
+    const auto t = (static_cast<float>(y) + 0.5f) * scale - 1.0f;
+
+    for (int x = 0; x < size; x++) {
+
+      const auto s = (static_cast<float>(x) + 0.5f) * scale - 1.0f;
+
+      const auto tap = get_equirect_tap(src, get_cube_direction(face, s, t));
+
+      blend(tap, dst.data() + (static_cast<std::size_t>(y) * size + x) * 4);
+    }
+  }
+}
+
+} // namespace
+
+auto
+is_equirect_skybox(const std::string& path) -> bool
+{
+  const std::string extension = ".jpg";
+
+  return (path.size() > extension.size()) &&
+         (path.compare(path.size() - extension.size(), extension.size(), extension) == 0);
+}
+
+auto
+get_skybox_images(const std::string& path) -> std::vector<std::string>
+{
+  if (is_equirect_skybox(path)) {
+    return { path };
+  }
+
+  std::vector<std::string> images;
+
+  for (const auto* name : face_names) {
+    images.emplace_back(path + name);
+  }
+
+  return images;
+}
+
+auto
+equirect_to_cube(const cube_face_view& equirect, const int face_size, int num_threads)
+  -> std::array<std::vector<unsigned char>, 6>
+{
+  std::array<std::vector<unsigned char>, 6> faces;
+
+  if (num_threads <= 0) {
+    num_threads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+  }
+
+  num_threads = std::min(num_threads, 6);
+
+  auto resample = [&](const int thread_index) {
+    for (int face = thread_index; face < 6; face += num_threads) {
+      resample_face(equirect, face, face_size, faces[face]);
+    }
+  };
+
+  std::vector<std::thread> threads;
+
+  for (int i = 1; i < num_threads; i++) {
+    threads.emplace_back(resample, i);
+  }
+
+  resample(0);
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  return faces;
+}
+
+void
+skybox_faces::load(rc_image_decoder& decoder, const std::string& path)
+{
+  const auto num_images = get_skybox_images(path).size();
+
+  std::array<int, 6> widths{};
+
+  std::array<int, 6> heights{};
+
+  for (std::size_t i = 0; i < num_images; i++) {
+
+    std::string image_path;
+
+    m_images[i] = decoder.next(&widths[i], &heights[i], &image_path);
+    if (!m_images[i]) {
+      std::ostringstream stream;
+      stream << "Failed to open internal skybox '" << image_path << "'.";
+      throw runtime_error(stream.str());
+    }
+  }
+
+  if (!is_equirect_skybox(path)) {
+    for (std::size_t i = 0; i < m_views.size(); i++) {
+      m_views[i].pixels = m_images[i].get();
+      m_views[i].width = widths[i];
+      m_views[i].height = heights[i];
+    }
+    return;
+  }
+
+  const auto size = std::max(heights[0] / 2, 1);
+
+  m_resampled = equirect_to_cube(cube_face_view{ m_images[0].get(), widths[0], heights[0] }, size);
+
+  m_images[0].reset();
+
+  for (std::size_t i = 0; i < m_views.size(); i++) {
+    m_views[i].pixels = m_resampled[i].data();
+    m_views[i].width = size;
+    m_views[i].height = size;
+  }
+}
+
+} // namespace mvz
@@ -0,0 +1,52 @@
+#pragma once
+
+#ifndef MVZ_BUILD
+#error "This header is not meant to be included outside of the build."
+#endif
+
+#include "mvz_sh.h"
+#include "mvz_stb.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace mvz {
+
+// Skyboxes are built into the library either as a directory of six faces, or as a single equirectangular image that
+// is resampled into faces when it is loaded.
+auto
+is_equirect_skybox(const std::string& path) -> bool;
+
+// The embedded images that make up the skybox at the path, as listed by list_rc_skyboxes(): the six faces in the order
+// GL numbers them, or the equirectangular image.
+auto
+get_skybox_images(const std::string& path) -> std::vector<std::string>;
+
+// Resamples an RGBA8 equirectangular image (longitude along the rows, the zenith at the top) into six square RGBA8
+// faces of the given size, with bilinear filtering. The faces are resampled on up to 'num_threads' threads (zero
+// means one per hardware thread).
+auto
+equirect_to_cube(const cube_face_view& equirect, int face_size, int num_threads = 0)
+  -> std::array<std::vector<unsigned char>, 6>;
+
+// The six RGBA8 faces of a loaded skybox, whichever way it is stored.
+class skybox_faces final
+{
+public:
+  // Takes the images of the skybox from the decoder, which has to be at the first of get_skybox_images(path). Throws a
+  // runtime_error if one of them cannot be decoded. Equirectangular images are resampled into faces of half their
+  // height, which keeps the texel density at the horizon.
+  void load(rc_image_decoder& decoder, const std::string& path);
+
+  auto views() const -> const std::array<cube_face_view, 6>& { return m_views; }
+
+private:
+  std::array<unique_image_ptr, 6> m_images;
+
+  std::array<std::vector<unsigned char>, 6> m_resampled;
+
+  std::array<cube_face_view, 6> m_views;
+};
+
+} // namespace mvz
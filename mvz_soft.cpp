@@ -0,0 +1,1232 @@
+#include "mvz_soft.h"
+
+#include "mvz_obj.h"
+#include "mvz_pool.h"
+#include "mvz_sh.h"
+#include "mvz_skybox.h"
+#include "mvz_stb.h"
+#include "mvz_transform.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define MVZ_SOFT_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace mvz {
+
+//=============//
+// Thread Pool //
+//=============//
+
+namespace {
+
+// Runs batches of tasks on a fixed set of threads. The calling thread takes part in every batch.
+class task_pool final
+{
+public:
+  using task_func = std::function<void(std::size_t task, std::size_t thread)>;
+
+  explicit task_pool(const int num_threads)
+  {
+    const auto hw_threads = static_cast<int>(std::thread::hardware_concurrency());
+
+    const auto thread_count = (num_threads > 0) ? num_threads : (hw_threads > 0 ? hw_threads : 1);
+
+    for (int i = 1; i < thread_count; i++) {
+      m_threads.emplace_back(&task_pool::run_worker, this, static_cast<std::size_t>(i));
+    }
+  }
+
+  task_pool(const task_pool&) = delete;
+
+  task_pool(task_pool&&) = delete;
+
+  auto operator=(const task_pool&) -> task_pool& = delete;
+
+  auto operator=(task_pool&&) -> task_pool& = delete;
+
+  ~task_pool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+
+    m_start.notify_all();
+
+    for (auto& t : m_threads) {
+      t.join();
+    }
+  }
+
+  // Including the calling thread.
+  auto size() const -> std::size_t { return m_threads.size() + 1; }
+
+  // Calls the function once for every task in [0, num_tasks) and returns when all of them are done. The thread index
+  // passed along is below size(). Rethrows the first exception thrown by a task.
+  void run(const std::size_t num_tasks, const task_func& func)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_func = &func;
+      m_num_tasks = num_tasks;
+      m_next_task = 0;
+      m_num_working = m_threads.size();
+      m_error = nullptr;
+      m_generation++;
+    }
+
+    m_start.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_done.wait(lock, [this] { return m_num_working == 0; });
+
+    m_func = nullptr;
+
+    if (m_error) {
+      std::rethrow_exception(m_error);
+    }
+  }
+
+protected:
+  void run_worker(const std::size_t thread)
+  {
+    std::uint64_t generation{};
+
+    while (true) {
+
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_start.wait(lock, [this, generation] { return m_stopping || (m_generation != generation); });
+
+        if (m_stopping) {
+          return;
+        }
+
+        generation = m_generation;
+      }
+
+      work(thread);
+
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_num_working--;
+      }
+
+      m_done.notify_one();
+    }
+  }
+
+  void work(const std::size_t thread)
+  {
+    while (true) {
+
+      const auto task = m_next_task.fetch_add(1);
+
+      if (task >= m_num_tasks) {
+        return;
+      }
+
+      try {
+        (*m_func)(task, thread);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_error) {
+          m_error = std::current_exception();
+        }
+      }
+    }
+  }
+
+private:
+  std::mutex m_mutex;
+
+  std::condition_variable m_start;
+
+  std::condition_variable m_done;
+
+  const task_func* m_func{ nullptr };
+
+  std::size_t m_num_tasks{};
+
+  std::atomic<std::size_t> m_next_task{};
+
+  std::size_t m_num_working{};
+
+  std::uint64_t m_generation{};
+
+  bool m_stopping{ false };
+
+  std::exception_ptr m_error;
+
+  std::vector<std::thread> m_threads;
+};
+
+} // namespace
+
+//========//
+// Skybox //
+//========//
+
+namespace {
+
+// The faces of a cube map, sampled the way GL selects a face and texel for a direction. The session's cube map is
+// minified with GL_NEAREST at any usual resolution, so the nearest texel is what it shows. Meshes are lit by the
+// diffuse irradiance that is projected from the faces when they are loaded.
+class soft_cubemap final
+{
+public:
+  // Takes the images of the skybox at the path from the decoder, see skybox_faces::load().
+  void load(rc_image_decoder& decoder, const std::string& path)
+  {
+    m_faces.load(decoder, path);
+
+    m_irradiance = project_irradiance(m_faces.views());
+  }
+
+  auto irradiance() const -> const sh9_irradiance& { return m_irradiance; }
+
+  // Returns the RGBA texel in the direction, which does not need to be normalized.
+  auto sample(const glm::vec3& dir) const -> const unsigned char*
+  {
+    static const unsigned char black[4]{ 0, 0, 0, 255 };
+
+    const auto ax = std::fabs(dir.x);
+    const auto ay = std::fabs(dir.y);
+    const auto az = std::fabs(dir.z);
+
+    std::size_t face{};
+
+    float sc{};
+    float tc{};
+    float ma{};
+
+    if ((ax >= ay) && (ax >= az)) {
+      face = (dir.x >= 0) ? 0 : 1;
+      sc = (dir.x >= 0) ? -dir.z : dir.z;
+      tc = -dir.y;
+      ma = ax;
+    } else if (ay >= az) {
+      face = (dir.y >= 0) ? 2 : 3;
+      sc = dir.x;
+      tc = (dir.y >= 0) ? dir.z : -dir.z;
+      ma = ay;
+    } else {
+      face = (dir.z >= 0) ? 4 : 5;
+      sc = (dir.z >= 0) ? dir.x : -dir.x;
+      tc = -dir.y;
+      ma = az;
+    }
+
+    if (ma == 0) {
+      return black;
+    }
+
+    const auto& f = m_faces.views()[face];
+
+    const auto s = 0.5f * (sc / ma + 1.0f);
+    const auto t = 0.5f * (tc / ma + 1.0f);
+
+    const auto i = std::min(std::max(static_cast<int>(std::floor(s * f.width)), 0), f.width - 1);
+    const auto j = std::min(std::max(static_cast<int>(std::floor(t * f.height)), 0), f.height - 1);
+
+    return f.pixels + (static_cast<std::size_t>(j) * f.width + i) * 4;
+  }
+
+private:
+  skybox_faces m_faces;
+
+  sh9_irradiance m_irradiance{};
+};
+
+} // namespace
+
+//============//
+// Rasterizer //
+//============//
+
+namespace {
+
+constexpr int tile_size{ 64 };
+
+constexpr int subpixel_bits{ 4 };
+
+constexpr std::int64_t subpixel_scale{ 1 << subpixel_bits };
+
+// Triangles are clipped to this multiple of the viewport in NDC. It keeps the fixed point edge functions within 32 bits
+// wherever an edge crosses a tile, for viewports up to 8K.
+constexpr float guard_band{ 2.0f };
+
+// Meshes are split into tasks of this many triangles, so that one large mesh still spreads across threads.
+constexpr std::size_t triangles_per_task{ 2048 };
+
+constexpr std::int32_t no_order{ std::numeric_limits<std::int32_t>::max() };
+
+constexpr std::size_t floats_per_vertex{ 8 };
+
+struct clip_vertex final
+{
+  glm::vec4 position;
+
+  glm::vec3 normal;
+};
+
+// A triangle in screen space, with y pointing down, wound so that its edge functions are positive inside.
+struct raster_triangle final
+{
+  // Vertex positions in fixed point.
+  std::array<std::int64_t, 3> x;
+
+  std::array<std::int64_t, 3> y;
+
+  // The pixels whose centers may be covered.
+  int min_x{};
+
+  int max_x{};
+
+  int min_y{};
+
+  int max_y{};
+
+  // Depth and the screen space weights of vertices 1 and 2 as planes over pixel coordinates, relative to vertex 0.
+  float origin_x{};
+
+  float origin_y{};
+
+  float z{};
+
+  float dz_dx{};
+
+  float dz_dy{};
+
+  float w1_dx{};
+
+  float w1_dy{};
+
+  float w2_dx{};
+
+  float w2_dy{};
+
+  std::array<float, 3> inv_w;
+
+  std::array<glm::vec3, 3> normal;
+
+  // The position in draw order, which breaks depth ties the way GL_LESS does.
+  std::int32_t order{};
+
+  std::uint32_t instance_id{};
+};
+
+struct instance_transform final
+{
+  glm::mat4 mvp;
+
+  glm::mat3 normal_matrix;
+
+  std::uint32_t id{};
+};
+
+struct vertex_task final
+{
+  const instance_transform* transform{ nullptr };
+
+  const obj_mesh* mesh{ nullptr };
+
+  std::size_t first_triangle{};
+
+  std::size_t num_triangles{};
+
+  std::int32_t first_order{};
+};
+
+struct alignas(16) tile_buffer final
+{
+  std::array<float, tile_size * tile_size> depth;
+
+  std::array<std::int32_t, tile_size * tile_size> order;
+
+  std::array<const raster_triangle*, tile_size * tile_size> triangle;
+};
+
+auto
+floor_div(const std::int64_t a, const std::int64_t b) -> std::int64_t
+{
+  return (a >= 0) ? (a / b) : -((-a + b - 1) / b);
+}
+
+auto
+is_top_left(const std::int64_t dx, const std::int64_t dy) -> bool
+{
+  return (dy < 0) || ((dy == 0) && (dx > 0));
+}
+
+// The clip space planes, as distances that are positive on the inside: near, then the guard band.
+auto
+get_clip_distance(const glm::vec4& p, const int plane) -> float
+{
+  switch (plane) {
+    case 0:
+      return p.z + p.w;
+    case 1:
+      return guard_band * p.w - p.x;
+    case 2:
+      return guard_band * p.w + p.x;
+    case 3:
+      return guard_band * p.w - p.y;
+    default:
+      return guard_band * p.w + p.y;
+  }
+}
+
+constexpr int num_clip_planes{ 5 };
+
+// Clips a convex polygon against one plane. Returns the new number of vertices.
+auto
+clip_polygon(const clip_vertex* in, const std::size_t in_size, const int plane, clip_vertex* out) -> std::size_t
+{
+  std::size_t out_size{};
+
+  for (std::size_t i = 0; i < in_size; i++) {
+
+    const auto& a = in[i];
+    const auto& b = in[(i + 1) % in_size];
+
+    const auto da = get_clip_distance(a.position, plane);
+    const auto db = get_clip_distance(b.position, plane);
+
+    if (da >= 0) {
+      out[out_size++] = a;
+    }
+
+    if ((da >= 0) != (db >= 0)) {
+      const auto t = da / (da - db);
+      out[out_size].position = a.position + (b.position - a.position) * t;
+      out[out_size].normal = a.normal + (b.normal - a.normal) * t;
+      out_size++;
+    }
+  }
+
+  return out_size;
+}
+
+class rasterizer final
+{
+public:
+  explicit rasterizer(const int num_threads)
+    : m_pool(num_threads)
+    , m_triangles(m_pool.size())
+    , m_bins(m_pool.size())
+    , m_tile_buffers(m_pool.size())
+  {
+  }
+
+  void render(const std::vector<instance_transform>& transforms,
+              const std::vector<const obj_shape*>& shapes,
+              const glm::mat3& camera_rotation,
+              const soft_cubemap& skybox,
+              const int width,
+              const int height,
+              unsigned char* color,
+              unsigned char* segmentation)
+  {
+    m_width = width;
+    m_height = height;
+    m_tiles_x = (width + tile_size - 1) / tile_size;
+    m_tiles_y = (height + tile_size - 1) / tile_size;
+
+    for (std::size_t i = 0; i < m_pool.size(); i++) {
+      m_triangles[i].clear();
+      m_bins[i].resize(static_cast<std::size_t>(m_tiles_x) * m_tiles_y);
+      for (auto& bin : m_bins[i]) {
+        bin.clear();
+      }
+    }
+
+    build_vertex_tasks(transforms, shapes);
+
+    m_pool.run(m_vertex_tasks.size(), [this](const std::size_t task, const std::size_t thread) {
+      process_triangles(m_vertex_tasks[task], thread);
+    });
+
+    const auto num_tiles = static_cast<std::size_t>(m_tiles_x) * m_tiles_y;
+
+    m_pool.run(num_tiles, [&](const std::size_t tile, const std::size_t thread) {
+      auto& buffer = m_tile_buffers[thread];
+      rasterize_tile(tile, buffer);
+      shade_tile(tile, buffer, camera_rotation, skybox, color, segmentation);
+    });
+  }
+
+protected:
+  void build_vertex_tasks(const std::vector<instance_transform>& transforms,
+                          const std::vector<const obj_shape*>& shapes)
+  {
+    m_vertex_tasks.clear();
+
+    std::size_t order{};
+
+    for (std::size_t i = 0; i < transforms.size(); i++) {
+      for (const auto& m : shapes[i]->meshes) {
+
+        const auto num_triangles = static_cast<std::size_t>(m.num_vertices) / 3;
+
+        for (std::size_t first = 0; first < num_triangles; first += triangles_per_task) {
+
+          vertex_task task;
+          task.transform = &transforms[i];
+          task.mesh = &m;
+          task.first_triangle = first;
+          task.num_triangles = std::min(triangles_per_task, num_triangles - first);
+          task.first_order = static_cast<std::int32_t>(order + first);
+
+          m_vertex_tasks.emplace_back(task);
+        }
+
+        order += num_triangles;
+
+        if (order >= static_cast<std::size_t>(no_order)) {
+          throw runtime_error("Too many triangles for the software rasterizer.");
+        }
+      }
+    }
+  }
+
+  void process_triangles(const vertex_task& task, const std::size_t thread)
+  {
+    // Clipping a triangle against five planes leaves at most eight vertices.
+    std::array<clip_vertex, 8> polygon;
+    std::array<clip_vertex, 8> scratch;
+
+    const auto& transform = *task.transform;
+
+    for (std::size_t i = 0; i < task.num_triangles; i++) {
+
+      const auto* v = task.mesh->vertices.data() + (task.first_triangle + i) * 3 * floats_per_vertex;
+
+      auto inside = true;
+
+      for (std::size_t j = 0; j < 3; j++) {
+
+        const auto* p = v + j * floats_per_vertex;
+
+        polygon[j].position = transform.mvp * glm::vec4(p[0], p[1], p[2], 1.0f);
+        polygon[j].normal = transform.normal_matrix * glm::vec3(p[5], p[6], p[7]);
+
+        for (int plane = 0; plane < num_clip_planes; plane++) {
+          inside = inside && (get_clip_distance(polygon[j].position, plane) >= 0);
+        }
+      }
+
+      std::size_t size{ 3 };
+
+      if (!inside) {
+        for (int plane = 0; (plane < num_clip_planes) && (size >= 3); plane++) {
+          size = clip_polygon(polygon.data(), size, plane, scratch.data());
+          std::copy(scratch.begin(), scratch.begin() + size, polygon.begin());
+        }
+      }
+
+      const auto order = task.first_order + static_cast<std::int32_t>(i);
+
+      for (std::size_t j = 2; j < size; j++) {
+        setup_triangle(polygon[0], polygon[j - 1], polygon[j], order, transform.id, thread);
+      }
+    }
+  }
+
+  void setup_triangle(const clip_vertex& a,
+                      const clip_vertex& b,
+                      const clip_vertex& c,
+                      const std::int32_t order,
+                      const std::uint32_t instance_id,
+                      const std::size_t thread)
+  {
+    raster_triangle t;
+
+    std::array<const clip_vertex*, 3> vertices{ &a, &b, &c };
+
+    std::array<float, 3> z;
+
+    for (std::size_t i = 0; i < 3; i++) {
+
+      const auto& p = vertices[i]->position;
+
+      const auto inv_w = 1.0f / p.w;
+
+      const auto screen_x = (p.x * inv_w * 0.5f + 0.5f) * static_cast<float>(m_width);
+      const auto screen_y = (0.5f - p.y * inv_w * 0.5f) * static_cast<float>(m_height);
+
+      t.x[i] = static_cast<std::int64_t>(std::lround(screen_x * subpixel_scale));
+      t.y[i] = static_cast<std::int64_t>(std::lround(screen_y * subpixel_scale));
+
+      t.inv_w[i] = inv_w;
+      t.normal[i] = vertices[i]->normal;
+
+      z[i] = p.z * inv_w * 0.5f + 0.5f;
+    }
+
+    auto area = (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (t.y[1] - t.y[0]) * (t.x[2] - t.x[0]);
+
+    if (area == 0) {
+      return;
+    }
+
+    // Faces are not culled, so either winding is turned into the one the edge functions expect.
+    if (area < 0) {
+      std::swap(t.x[1], t.x[2]);
+      std::swap(t.y[1], t.y[2]);
+      std::swap(t.inv_w[1], t.inv_w[2]);
+      std::swap(t.normal[1], t.normal[2]);
+      std::swap(z[1], z[2]);
+      area = -area;
+    }
+
+    const auto min_x = std::min({ t.x[0], t.x[1], t.x[2] });
+    const auto max_x = std::max({ t.x[0], t.x[1], t.x[2] });
+    const auto min_y = std::min({ t.y[0], t.y[1], t.y[2] });
+    const auto max_y = std::max({ t.y[0], t.y[1], t.y[2] });
+
+    // Pixel centers are at half a pixel.
+    const auto half = subpixel_scale / 2;
+
+    t.min_x = static_cast<int>(std::max<std::int64_t>(-floor_div(half - min_x, subpixel_scale), 0));
+    t.max_x = static_cast<int>(std::min<std::int64_t>(floor_div(max_x - half, subpixel_scale), m_width - 1));
+    t.min_y = static_cast<int>(std::max<std::int64_t>(-floor_div(half - min_y, subpixel_scale), 0));
+    t.max_y = static_cast<int>(std::min<std::int64_t>(floor_div(max_y - half, subpixel_scale), m_height - 1));
+
+    if ((t.min_x > t.max_x) || (t.min_y > t.max_y)) {
+      return;
+    }
+
+    const auto scale = 1.0 / static_cast<double>(subpixel_scale);
+
+    const auto e1x = static_cast<double>(t.x[1] - t.x[0]) * scale;
+    const auto e1y = static_cast<double>(t.y[1] - t.y[0]) * scale;
+    const auto e2x = static_cast<double>(t.x[2] - t.x[0]) * scale;
+    const auto e2y = static_cast<double>(t.y[2] - t.y[0]) * scale;
+
+    const auto det = static_cast<double>(area) * scale * scale;
+
+    const auto w1_dx = e2y / det;
+    const auto w1_dy = -e2x / det;
+    const auto w2_dx = -e1y / det;
+    const auto w2_dy = e1x / det;
+
+    t.origin_x = static_cast<float>(static_cast<double>(t.x[0]) * scale);
+    t.origin_y = static_cast<float>(static_cast<double>(t.y[0]) * scale);
+
+    t.z = z[0];
+    t.dz_dx = static_cast<float>(w1_dx * (z[1] - z[0]) + w2_dx * (z[2] - z[0]));
+    t.dz_dy = static_cast<float>(w1_dy * (z[1] - z[0]) + w2_dy * (z[2] - z[0]));
+
+    t.w1_dx = static_cast<float>(w1_dx);
+    t.w1_dy = static_cast<float>(w1_dy);
+    t.w2_dx = static_cast<float>(w2_dx);
+    t.w2_dy = static_cast<float>(w2_dy);
+
+    t.order = order;
+    t.instance_id = instance_id;
+
+    auto& triangles = m_triangles[thread];
+
+    const auto index = static_cast<std::uint32_t>(triangles.size());
+
+    triangles.emplace_back(t);
+
+    auto& bins = m_bins[thread];
+
+    for (int ty = t.min_y / tile_size; ty <= t.max_y / tile_size; ty++) {
+      for (int tx = t.min_x / tile_size; tx <= t.max_x / tile_size; tx++) {
+        bins[static_cast<std::size_t>(ty) * m_tiles_x + tx].emplace_back(index);
+      }
+    }
+  }
+
+  void rasterize_tile(const std::size_t tile, tile_buffer& buffer)
+  {
+    buffer.depth.fill(1.0f);
+    buffer.order.fill(no_order);
+    buffer.triangle.fill(nullptr);
+
+    for (std::size_t thread = 0; thread < m_pool.size(); thread++) {
+      for (const auto index : m_bins[thread][tile]) {
+        rasterize_triangle(tile, m_triangles[thread][index], buffer);
+      }
+    }
+  }
+
+  void rasterize_triangle(const std::size_t tile, const raster_triangle& t, tile_buffer& buffer)
+  {
+    const auto tile_x = static_cast<int>(tile % m_tiles_x) * tile_size;
+    const auto tile_y = static_cast<int>(tile / m_tiles_x) * tile_size;
+
+    const auto x0 = std::max(t.min_x, tile_x);
+    const auto x1 = std::min(t.max_x, tile_x + tile_size - 1);
+    const auto y0 = std::max(t.min_y, tile_y);
+    const auto y1 = std::min(t.max_y, tile_y + tile_size - 1);
+
+    // Rows are walked in groups of four pixels that start on a multiple of four.
+    const auto group_x0 = x0 & ~3;
+
+    std::array<std::int32_t, 3> edge;
+    std::array<std::int32_t, 3> step_x;
+    std::array<std::int32_t, 3> step_y;
+
+    const auto half = subpixel_scale / 2;
+
+    for (std::size_t i = 0; i < 3; i++) {
+
+      // The edge opposite of vertex i.
+      const auto a = (i + 1) % 3;
+      const auto b = (i + 2) % 3;
+
+      const auto dx = t.x[b] - t.x[a];
+      const auto dy = t.y[b] - t.y[a];
+
+      const auto sx = -dy * subpixel_scale;
+      const auto sy = dx * subpixel_scale;
+
+      const auto bias = is_top_left(dx, dy) ? 0 : -1;
+
+      const auto origin = dx * (y0 * subpixel_scale + half - t.y[a]) - dy * (group_x0 * subpixel_scale + half - t.x[a]);
+
+      const auto corner_x = sx * (x1 - group_x0);
+      const auto corner_y = sy * (y1 - y0);
+
+      const auto min_value = origin + std::min<std::int64_t>(corner_x, 0) + std::min<std::int64_t>(corner_y, 0) + bias;
+      const auto max_value = origin + std::max<std::int64_t>(corner_x, 0) + std::max<std::int64_t>(corner_y, 0) + bias;
+
+      if (max_value < 0) {
+        return;
+      }
+
+      // An edge that has the whole region on its inside does not need testing, and its values may not fit in 32 bits.
+      if (min_value >= 0) {
+        edge[i] = 0;
+        step_x[i] = 0;
+        step_y[i] = 0;
+      } else {
+        edge[i] = static_cast<std::int32_t>(origin + bias);
+        step_x[i] = static_cast<std::int32_t>(sx);
+        step_y[i] = static_cast<std::int32_t>(sy);
+      }
+    }
+
+    const auto px = static_cast<float>(group_x0) + 0.5f - t.origin_x;
+    const auto py = static_cast<float>(y0) + 0.5f - t.origin_y;
+
+    auto z_row = t.z + t.dz_dx * px + t.dz_dy * py;
+
+    for (int y = y0; y <= y1; y++) {
+
+      auto* depth = buffer.depth.data() + (y - tile_y) * tile_size - tile_x;
+      auto* order = buffer.order.data() + (y - tile_y) * tile_size - tile_x;
+      auto* triangle = buffer.triangle.data() + (y - tile_y) * tile_size - tile_x;
+
+      rasterize_row(t, group_x0, x0, x1, edge, step_x, z_row, depth, order, triangle);
+
+      for (std::size_t i = 0; i < 3; i++) {
+        edge[i] += step_y[i];
+      }
+
+      z_row += t.dz_dy;
+    }
+  }
+
+  // The row pointers are offset so that they are indexed by the pixel's x coordinate.
+  static void rasterize_row(const raster_triangle& t,
+                            const int group_x0,
+                            const int x0,
+                            const int x1,
+                            const std::array<std::int32_t, 3>& edge,
+                            const std::array<std::int32_t, 3>& step_x,
+                            const float z_row,
+                            float* depth,
+                            std::int32_t* order,
+                            const raster_triangle** triangle)
+  {
+#ifdef MVZ_SOFT_SSE2
+    // SSE2 has no 32-bit multiply, so the lane offsets are set up as scalars.
+    auto e0 = _mm_add_epi32(_mm_set1_epi32(edge[0]), _mm_setr_epi32(0, step_x[0], step_x[0] * 2, step_x[0] * 3));
+    auto e1 = _mm_add_epi32(_mm_set1_epi32(edge[1]), _mm_setr_epi32(0, step_x[1], step_x[1] * 2, step_x[1] * 3));
+    auto e2 = _mm_add_epi32(_mm_set1_epi32(edge[2]), _mm_setr_epi32(0, step_x[2], step_x[2] * 2, step_x[2] * 3));
+
+    const auto group_step0 = _mm_set1_epi32(step_x[0] * 4);
+    const auto group_step1 = _mm_set1_epi32(step_x[1] * 4);
+    const auto group_step2 = _mm_set1_epi32(step_x[2] * 4);
+
+    auto z = _mm_add_ps(_mm_set1_ps(z_row), _mm_mul_ps(_mm_set1_ps(t.dz_dx), _mm_setr_ps(0, 1, 2, 3)));
+
+    const auto group_step_z = _mm_set1_ps(t.dz_dx * 4);
+
+    const auto triangle_order = _mm_set1_epi32(t.order);
+
+    for (int x = group_x0; x <= x1; x += 4) {
+
+      const auto outside = _mm_or_si128(_mm_or_si128(e0, e1), e2);
+
+      auto mask = ~_mm_movemask_ps(_mm_castsi128_ps(outside)) & 0xf;
+
+      if (x < x0) {
+        mask &= 0xf << (x0 - x);
+      }
+
+      if (x + 3 > x1) {
+        mask &= 0xf >> (x + 3 - x1);
+      }
+
+      if (mask != 0) {
+
+        const auto old_depth = _mm_load_ps(depth + x);
+
+        const auto old_order = _mm_load_si128(reinterpret_cast<const __m128i*>(order + x));
+
+        const auto less = _mm_cmplt_ps(z, old_depth);
+
+        const auto equal = _mm_and_ps(_mm_cmpeq_ps(z, old_depth),
+                                      _mm_castsi128_ps(_mm_cmplt_epi32(triangle_order, old_order)));
+
+        mask &= _mm_movemask_ps(_mm_or_ps(less, equal));
+
+        if (mask != 0) {
+
+          const auto pass = _mm_castsi128_ps(_mm_setr_epi32(
+            (mask & 1) ? -1 : 0, (mask & 2) ? -1 : 0, (mask & 4) ? -1 : 0, (mask & 8) ? -1 : 0));
+
+          _mm_store_ps(depth + x, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, old_depth)));
+
+          const auto pass_i = _mm_castps_si128(pass);
+
+          _mm_store_si128(reinterpret_cast<__m128i*>(order + x),
+                          _mm_or_si128(_mm_and_si128(pass_i, triangle_order), _mm_andnot_si128(pass_i, old_order)));
+
+          for (int i = 0; i < 4; i++) {
+            if (mask & (1 << i)) {
+              triangle[x + i] = &t;
+            }
+          }
+        }
+      }
+
+      e0 = _mm_add_epi32(e0, group_step0);
+      e1 = _mm_add_epi32(e1, group_step1);
+      e2 = _mm_add_epi32(e2, group_step2);
+
+      z = _mm_add_ps(z, group_step_z);
+    }
+#else
+    auto e0 = edge[0] + step_x[0] * (x0 - group_x0);
+    auto e1 = edge[1] + step_x[1] * (x0 - group_x0);
+    auto e2 = edge[2] + step_x[2] * (x0 - group_x0);
+
+    for (int x = x0; x <= x1; x++) {
+
+      if ((e0 | e1 | e2) >= 0) {
+
+        const auto z = z_row + t.dz_dx * static_cast<float>(x - group_x0);
+
+        if ((z < depth[x]) || ((z == depth[x]) && (t.order < order[x]))) {
+          depth[x] = z;
+          order[x] = t.order;
+          triangle[x] = &t;
+        }
+      }
+
+      e0 += step_x[0];
+      e1 += step_x[1];
+      e2 += step_x[2];
+    }
+#endif
+  }
+
+  void shade_tile(const std::size_t tile,
+                  const tile_buffer& buffer,
+                  const glm::mat3& camera_rotation,
+                  const soft_cubemap& skybox,
+                  unsigned char* color,
+                  unsigned char* segmentation)
+  {
+    const auto tile_x = static_cast<int>(tile % m_tiles_x) * tile_size;
+    const auto tile_y = static_cast<int>(tile / m_tiles_x) * tile_size;
+
+    const auto x1 = std::min(tile_x + tile_size, m_width);
+    const auto y1 = std::min(tile_y + tile_size, m_height);
+
+    for (int y = tile_y; y < y1; y++) {
+
+      const auto row = static_cast<std::size_t>(y) * m_width;
+
+      const auto* triangles = buffer.triangle.data() + (y - tile_y) * tile_size - tile_x;
+
+      const auto ndc_y = 1.0f - 2.0f * (static_cast<float>(y) + 0.5f) / static_cast<float>(m_height);
+
+      for (int x = tile_x; x < x1; x++) {
+
+        const auto* t = triangles[x];
+
+        if (color) {
+
+          auto* dst = color + (row + x) * 3;
+
+          if (t) {
+            const auto n = glm::normalize(interpolate_normal(*t, x, y));
+            // The mesh albedo is 0.8, clamped and rounded the way GL converts to unorm8.
+            const auto radiance = 0.8f * evaluate_irradiance(skybox.irradiance(), n);
+            for (int i = 0; i < 3; i++) {
+              dst[i] = static_cast<unsigned char>(std::min(std::max(radiance[i], 0.0f), 1.0f) * 255.0f + 0.5f);
+            }
+          } else {
+            const auto ndc_x = 2.0f * (static_cast<float>(x) + 0.5f) / static_cast<float>(m_width) - 1.0f;
+            const auto* texel = skybox.sample(camera_rotation * glm::vec3(ndc_x, ndc_y, -1.0f));
+            dst[0] = texel[0];
+            dst[1] = texel[1];
+            dst[2] = texel[2];
+          }
+        }
+
+        if (segmentation) {
+
+          auto* dst = segmentation + (row + x) * 3;
+
+          const auto id = t ? t->instance_id : 0;
+
+          dst[0] = static_cast<unsigned char>(id & 0xff);
+          dst[1] = static_cast<unsigned char>((id >> 8) & 0xff);
+          dst[2] = static_cast<unsigned char>((id >> 16) & 0xff);
+        }
+      }
+    }
+  }
+
+  // Perspective correct, but not normalized, since the cube map lookup does not need it.
+  static auto interpolate_normal(const raster_triangle& t, const int x, const int y) -> glm::vec3
+  {
+    const auto dx = static_cast<float>(x) + 0.5f - t.origin_x;
+    const auto dy = static_cast<float>(y) + 0.5f - t.origin_y;
+
+    const auto w1 = t.w1_dx * dx + t.w1_dy * dy;
+    const auto w2 = t.w2_dx * dx + t.w2_dy * dy;
+    const auto w0 = 1.0f - w1 - w2;
+
+    return t.normal[0] * (w0 * t.inv_w[0]) + t.normal[1] * (w1 * t.inv_w[1]) + t.normal[2] * (w2 * t.inv_w[2]);
+  }
+
+private:
+  task_pool m_pool;
+
+  int m_width{};
+
+  int m_height{};
+
+  int m_tiles_x{};
+
+  int m_tiles_y{};
+
+  std::vector<vertex_task> m_vertex_tasks;
+
+  // Triangles and bins are per thread, so that setup needs no locks. Bins hold indices into the triangles of the same
+  // thread.
+  std::vector<std::vector<raster_triangle>> m_triangles;
+
+  std::vector<std::vector<std::vector<std::uint32_t>>> m_bins;
+
+  std::vector<tile_buffer> m_tile_buffers;
+};
+
+} // namespace
+
+//=========//
+// Session //
+//=========//
+
+class soft_session_impl final
+{
+public:
+  explicit soft_session_impl(const int num_threads)
+    : m_rasterizer(num_threads)
+  {
+    const auto paths = list_rc_skyboxes();
+
+    std::vector<std::string> face_paths;
+
+    for (const auto& path : paths) {
+      for (auto& image_path : get_skybox_images(path)) {
+        face_paths.emplace_back(std::move(image_path));
+      }
+    }
+
+    rc_image_decoder decoder(std::move(face_paths));
+
+    m_skyboxes.resize(paths.size());
+
+    for (std::size_t i = 0; i < paths.size(); i++) {
+      m_skyboxes[i].load(decoder, paths[i]);
+    }
+
+    if (m_skyboxes.empty()) {
+      throw runtime_error("There are no skyboxes built into the library.");
+    }
+  }
+
+  auto load_obj(const char* path) -> int
+  {
+    obj_file file;
+
+    if (!file.load(path)) {
+      std::ostringstream stream;
+      stream << "Failed to load OBJ file '" << path << "'.";
+      throw runtime_error(stream.str());
+    }
+
+    const auto id = m_next_obj_id++;
+
+    m_obj_files.emplace(id, std::move(file));
+
+    m_obj_paths.emplace(id, path);
+
+    return id;
+  }
+
+  auto instance(const int obj_id, const char* shape) -> mesh_instance
+  {
+    const auto& file = m_obj_files.at(obj_id);
+
+    const auto shape_idx = file.find_shape(shape);
+    if (shape_idx < 0) {
+      std::ostringstream stream;
+      stream << "Failed to find shape '" << shape << "' in OBJ '" << m_obj_paths.at(obj_id) << "'.";
+      throw runtime_error(stream.str());
+    }
+
+    mesh_instance instance;
+    instance.obj_id = obj_id;
+    instance.shape_index = shape_idx;
+    return instance;
+  }
+
+  void render_offscreen(const camera& cam,
+                        const std::vector<mesh_instance>& instances,
+                        const std::vector<image_type>& outputs)
+  {
+    auto has_color = false;
+    auto has_segmentation = false;
+
+    for (const auto type : outputs) {
+      if (type == image_type::color) {
+        has_color = true;
+      } else if (type == image_type::segmentation) {
+        has_segmentation = true;
+      } else {
+        throw runtime_error("The software rasterizer only renders color and segmentation.");
+      }
+    }
+
+    const auto w = cam.resolution[0];
+    const auto h = cam.resolution[1];
+
+    const auto view_proj = get_projection_matrix(cam) * get_view_matrix(cam);
+
+    m_transforms.resize(instances.size());
+
+    m_shapes.resize(instances.size());
+
+    for (std::size_t i = 0; i < instances.size(); i++) {
+
+      const auto& inst = instances[i];
+
+      const auto model = get_model_matrix(inst);
+
+      m_transforms[i].mvp = view_proj * model;
+      m_transforms[i].normal_matrix = glm::transpose(glm::inverse(glm::mat3(model)));
+      m_transforms[i].id = get_instance_id(i);
+
+      m_shapes[i] = &m_obj_files.at(inst.obj_id).shapes.at(static_cast<std::size_t>(inst.shape_index));
+    }
+
+    const auto size = static_cast<std::size_t>(w) * h * 3;
+
+    m_color.resize(has_color ? size : 0);
+
+    m_segmentation.resize(has_segmentation ? size : 0);
+
+    m_rasterizer.render(m_transforms,
+                        m_shapes,
+                        glm::mat3(get_rotation_matrix(cam.rotation)),
+                        m_skyboxes[m_skybox_index],
+                        w,
+                        h,
+                        has_color ? m_color.data() : nullptr,
+                        has_segmentation ? m_segmentation.data() : nullptr);
+
+    m_width = w;
+    m_height = h;
+  }
+
+  void read_offscreen(const image_type type, const std::uint64_t index)
+  {
+    if (!m_readback_callback) {
+      throw runtime_error("A readback callback has to be set before reading back.");
+    }
+
+    const auto& pixels = (type == image_type::color) ? m_color : m_segmentation;
+
+    if (((type != image_type::color) && (type != image_type::segmentation)) || pixels.empty()) {
+      throw runtime_error("The last offscreen render has no output of that type.");
+    }
+
+    frame f;
+    f.type = type;
+    f.index = index;
+    f.width = m_width;
+    f.height = m_height;
+    f.channels = 3;
+    f.channel_size = 1;
+    f.pixels = m_pixel_pool.acquire(pixels.size());
+
+    std::copy(pixels.begin(), pixels.end(), f.pixels.begin());
+
+    m_readback_callback(std::move(f));
+  }
+
+  void set_readback_callback(readback_callback callback) { m_readback_callback = std::move(callback); }
+
+  void recycle(frame&& f) { m_pixel_pool.release(std::move(f.pixels)); }
+
+  auto num_skyboxes() const -> int { return static_cast<int>(m_skyboxes.size()); }
+
+  void set_skybox(const int index)
+  {
+    if ((index < 0) || (index >= num_skyboxes())) {
+      std::ostringstream stream;
+      stream << "Skybox index '" << index << "' is out of range, there are " << num_skyboxes() << '.';
+      throw runtime_error(stream.str());
+    }
+
+    m_skybox_index = static_cast<std::size_t>(index);
+  }
+
+private:
+  rasterizer m_rasterizer;
+
+  std::vector<soft_cubemap> m_skyboxes;
+
+  std::size_t m_skybox_index{};
+
+  std::map<int, obj_file> m_obj_files;
+
+  std::map<int, std::string> m_obj_paths;
+
+  int m_next_obj_id{};
+
+  std::vector<instance_transform> m_transforms;
+
+  std::vector<const obj_shape*> m_shapes;
+
+  std::vector<unsigned char> m_color;
+
+  std::vector<unsigned char> m_segmentation;
+
+  int m_width{};
+
+  int m_height{};
+
+  pixel_storage_pool m_pixel_pool;
+
+  readback_callback m_readback_callback;
+};
+
+soft_session::soft_session(const int num_threads)
+  : m_impl(new soft_session_impl(num_threads))
+{
+}
+
+soft_session::~soft_session()
+{
+  delete m_impl;
+}
+
+auto
+soft_session::load_obj(const char* path) -> int
+{
+  return impl().load_obj(path);
+}
+
+auto
+soft_session::instance(const int obj_id, const char* name) -> mesh_instance
+{
+  return impl().instance(obj_id, name);
+}
+
+void
+soft_session::render_offscreen(const camera& cam,
+                               const std::vector<mesh_instance>& mesh_instances,
+                               const std::vector<image_type>& outputs)
+{
+  impl().render_offscreen(cam, mesh_instances, outputs);
+}
+
+void
+soft_session::read_offscreen(const image_type type, const std::uint64_t index)
+{
+  impl().read_offscreen(type, index);
+}
+
+void
+soft_session::poll_readbacks(const bool)
+{
+}
+
+void
+soft_session::set_readback_callback(readback_callback callback)
+{
+  impl().set_readback_callback(std::move(callback));
+}
+
+void
+soft_session::recycle(frame&& f)
+{
+  impl().recycle(std::move(f));
+}
+
+auto
+soft_session::num_skyboxes() const -> int
+{
+  return m_impl->num_skyboxes();
+}
+
+void
+soft_session::set_skybox(const int index)
+{
+  impl().set_skybox(index);
+}
+
+auto
+soft_session::impl() -> soft_session_impl&
+{
+  return *m_impl;
+}
+
+} // namespace mvz
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "mvz.h"
+
+namespace mvz {
+
+class soft_session_impl;
+
+// Renders on the CPU with a tile-binned, multi-threaded rasterizer instead of GL, for render nodes without a GPU. It
+// has the offscreen part of the session interface and produces the same color and segmentation images as a session
+// does. Depth and normal outputs are not supported. Frames are delivered from read_offscreen() right away.
+class soft_session final
+{
+public:
+  // Zero threads means one per hardware thread.
+  explicit soft_session(int num_threads = 0);
+
+  soft_session(const soft_session&) = delete;
+
+  soft_session(soft_session&&) = delete;
+
+  auto operator=(const soft_session&) -> soft_session& = delete;
+
+  auto operator=(soft_session&&) -> soft_session& = delete;
+
+  ~soft_session();
+
+  auto load_obj(const char* path) -> int;
+
+  auto instance(int obj_id, const char* name) -> mesh_instance;
+
+  void render_offscreen(const camera& cam,
+                        const std::vector<mesh_instance>& mesh_instances,
+                        const std::vector<image_type>& outputs);
+
+  void read_offscreen(image_type type, std::uint64_t index);
+
+  // Frames are never pending, so this does nothing. It is here so that code can be written against either session.
+  void poll_readbacks(bool wait = false);
+
+  void set_readback_callback(readback_callback callback);
+
+  // Hands the pixel storage of a delivered frame back to the session for reuse. Can be called from any thread.
+  void recycle(frame&& f);
+
+  // The same skyboxes, in the same order, as a session has.
+  auto num_skyboxes() const -> int;
+
+  void set_skybox(int index);
+
+protected:
+  auto impl() -> soft_session_impl&;
+
+private:
+  soft_session_impl* m_impl{ nullptr };
+};
+
+} // namespace mvz
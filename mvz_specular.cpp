@@ -0,0 +1,479 @@
+#include "mvz_specular.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#include <cmath>
+#include <cstring>
+
+namespace mvz {
+
+namespace {
+
+// The largest base level of the chain. Glossy reflections do not need more, and the chain stays small enough to cache.
+constexpr int max_chain_size{ 128 };
+
+// Sources are box filtered down to this before prefiltering.
+constexpr int max_source_size{ 512 };
+
+constexpr int num_lobe_samples{ 64 };
+
+// Has to change whenever the output of prefilter_specular() does.
+constexpr std::uint32_t cache_format_version{ 1 };
+
+constexpr char cache_magic[4]{ 'M', 'V', 'Z', 'S' };
+
+constexpr float pi{ 3.14159265358979F };
+
+struct float_face final
+{
+  int size{};
+
+  std::vector<glm::vec3> texels;
+};
+
+using float_cube = std::array<float_face, 6>;
+
+// Averages blocks of texels until the face is no larger than max_source_size.
+auto
+reduce_face(const cube_face_view& view) -> float_face
+{
+  int factor = 1;
+
+  while ((view.width / factor) > max_source_size) {
+    factor *= 2;
+  }
+
+  float_face face;
+  face.size = std::max(view.width / factor, 1);
+  face.texels.resize(static_cast<std::size_t>(face.size) * face.size);
+
+  const auto scale = 1.0F / (255.0F * static_cast<float>(factor * factor));
+
+  for (int y = 0; y < face.size; y++) {
+    for (int x = 0; x < face.size; x++) {
+      glm::vec3 sum(0.0F);
+      for (int j = 0; j < factor; j++) {
+        const auto src_y = std::min(y * factor + j, view.height - 1);
+        for (int i = 0; i < factor; i++) {
+          const auto src_x = std::min(x * factor + i, view.width - 1);
+          const auto* texel = view.pixels + (static_cast<std::size_t>(src_y) * view.width + src_x) * 4;
+          sum += glm::vec3(texel[0], texel[1], texel[2]);
+        }
+      }
+      face.texels[static_cast<std::size_t>(y) * face.size + x] = sum * scale;
+    }
+  }
+
+  return face;
+}
+
+auto
+halve_face(const float_face& src) -> float_face
+{
+  float_face face;
+  face.size = std::max(src.size / 2, 1);
+  face.texels.resize(static_cast<std::size_t>(face.size) * face.size);
+
+  for (int y = 0; y < face.size; y++) {
+    for (int x = 0; x < face.size; x++) {
+      const auto x0 = std::min(x * 2, src.size - 1);
+      const auto x1 = std::min(x * 2 + 1, src.size - 1);
+      const auto y0 = std::min(y * 2, src.size - 1);
+      const auto y1 = std::min(y * 2 + 1, src.size - 1);
+      const auto at = [&src](const int i, const int j) {
+        return src.texels[static_cast<std::size_t>(j) * src.size + i];
+      };
+      face.texels[static_cast<std::size_t>(y) * face.size + x] =
+        (at(x0, y0) + at(x1, y0) + at(x0, y1) + at(x1, y1)) * 0.25F;
+    }
+  }
+
+  return face;
+}
+
+// Looks up a direction the way GL selects a face, with bilinear filtering within the face.
+auto
+sample_cube(const float_cube& cube, const glm::vec3& dir) -> glm::vec3
+{
+  const auto ax = std::fabs(dir.x);
+  const auto ay = std::fabs(dir.y);
+  const auto az = std::fabs(dir.z);
+
+  std::size_t index{};
+
+  float sc{};
+  float tc{};
+  float ma{};
+
+  if ((ax >= ay) && (ax >= az)) {
+    index = (dir.x >= 0) ? 0 : 1;
+    sc = (dir.x >= 0) ? -dir.z : dir.z;
+    tc = -dir.y;
+    ma = ax;
+  } else if (ay >= az) {
+    index = (dir.y >= 0) ? 2 : 3;
+    sc = dir.x;
+    tc = (dir.y >= 0) ? dir.z : -dir.z;
+    ma = ay;
+  } else {
+    index = (dir.z >= 0) ? 4 : 5;
+    sc = (dir.z >= 0) ? dir.x : -dir.x;
+    tc = -dir.y;
+    ma = az;
+  }
+
+  const auto& face = cube[index];
+
+  const auto size = static_cast<float>(face.size);
+
+  const auto x = std::min(std::max(0.5F * (sc / ma + 1.0F) * size - 0.5F, 0.0F), size - 1.0F);
+  const auto y = std::min(std::max(0.5F * (tc / ma + 1.0F) * size - 0.5F, 0.0F), size - 1.0F);
+
+  const auto x0 = static_cast<int>(x);
+  const auto y0 = static_cast<int>(y);
+  const auto x1 = std::min(x0 + 1, face.size - 1);
+  const auto y1 = std::min(y0 + 1, face.size - 1);
+
+  const auto fx = x - static_cast<float>(x0);
+  const auto fy = y - static_cast<float>(y0);
+
+  const auto at = [&face](const int i, const int j) {
+    return face.texels[static_cast<std::size_t>(j) * face.size + i];
+  };
+
+  const auto top = at(x0, y0) + (at(x1, y0) - at(x0, y0)) * fx;
+  const auto bottom = at(x0, y1) + (at(x1, y1) - at(x0, y1)) * fx;
+
+  return top + (bottom - top) * fy;
+}
+
+// One sample of a GGX lobe around +Z, with the view along the normal, and the source level to read it from.
+struct lobe_sample final
+{
+  glm::vec3 direction;
+
+  float weight{};
+
+  int level{};
+};
+
+auto
+radical_inverse(std::uint32_t bits) -> float
+{
+  bits = (bits << 16) | (bits >> 16);
+  bits = ((bits & 0x55555555U) << 1) | ((bits & 0xAAAAAAAAU) >> 1);
+  bits = ((bits & 0x33333333U) << 2) | ((bits & 0xCCCCCCCCU) >> 2);
+  bits = ((bits & 0x0F0F0F0FU) << 4) | ((bits & 0xF0F0F0F0U) >> 4);
+  bits = ((bits & 0x00FF00FFU) << 8) | ((bits & 0xFF00FF00U) >> 8);
+  return static_cast<float>(bits) * 2.3283064365386963e-10F;
+}
+
+// Importance samples the lobe with a Hammersley set. Each sample reads from the source level whose texels cover about
+// the solid angle the sample stands for, which keeps bright texels from turning into fireflies (Colbert and Krivanek,
+// "GPU-Based Importance Sampling", 2007).
+auto
+make_lobe(const float roughness, const int source_size, const int num_source_levels) -> std::vector<lobe_sample>
+{
+  const auto a = roughness * roughness;
+  const auto a2 = a * a;
+
+  const auto texel_solid_angle = 4.0F * pi / (6.0F * static_cast<float>(source_size) * static_cast<float>(source_size));
+
+  std::vector<lobe_sample> lobe;
+
+  for (int i = 0; i < num_lobe_samples; i++) {
+
+    const auto u = static_cast<float>(i) / static_cast<float>(num_lobe_samples);
+    const auto v = radical_inverse(static_cast<std::uint32_t>(i));
+
+    const auto phi = 2.0F * pi * u;
+    const auto cos_theta = std::sqrt((1.0F - v) / (1.0F + (a2 - 1.0F) * v));
+    const auto sin_theta = std::sqrt(1.0F - cos_theta * cos_theta);
+
+    const glm::vec3 h(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+
+    const auto l = 2.0F * cos_theta * h - glm::vec3(0, 0, 1);
+
+    if (l.z <= 0) {
+      continue;
+    }
+
+    const auto d = (a2 > 0) ? a2 / (pi * std::pow(cos_theta * cos_theta * (a2 - 1.0F) + 1.0F, 2.0F)) : 0.0F;
+
+    // With the view along the normal, the pdf of the reflected direction is D / 4.
+    const auto sample_solid_angle = (d > 0) ? 4.0F / (static_cast<float>(num_lobe_samples) * d) : 0.0F;
+
+    const auto level =
+      (sample_solid_angle > 0) ? 0.5F * std::log2(sample_solid_angle / texel_solid_angle) + 1.0F : 0.0F;
+
+    lobe_sample s;
+    s.direction = l;
+    s.weight = l.z;
+    s.level = std::min(std::max(static_cast<int>(std::lround(level)), 0), num_source_levels - 1);
+    lobe.emplace_back(s);
+  }
+
+  return lobe;
+}
+
+void
+prefilter_row(const std::vector<float_cube>& source,
+              const std::vector<lobe_sample>& lobe,
+              const int face_index,
+              const int size,
+              const int row,
+              unsigned char* output)
+{
+  const auto t = 2.0F * (static_cast<float>(row) + 0.5F) / static_cast<float>(size) - 1.0F;
+
+  for (int x = 0; x < size; x++) {
+
+    const auto s = 2.0F * (static_cast<float>(x) + 0.5F) / static_cast<float>(size) - 1.0F;
+
+    const auto n = glm::normalize(get_cube_direction(face_index, s, t));
+
+    const auto up = (std::fabs(n.z) < 0.999F) ? glm::vec3(0, 0, 1) : glm::vec3(1, 0, 0);
+    const auto tangent_x = glm::normalize(glm::cross(up, n));
+    const auto tangent_y = glm::cross(n, tangent_x);
+
+    glm::vec3 sum(0.0F);
+
+    float total_weight{};
+
+    for (const auto& sample : lobe) {
+      const auto dir = tangent_x * sample.direction.x + tangent_y * sample.direction.y + n * sample.direction.z;
+      sum += sample_cube(source[static_cast<std::size_t>(sample.level)], dir) * sample.weight;
+      total_weight += sample.weight;
+    }
+
+    const auto color = sum / std::max(total_weight, 1e-6F);
+
+    auto* dst = output + static_cast<std::size_t>(x) * 4;
+
+    for (int c = 0; c < 3; c++) {
+      dst[c] = static_cast<unsigned char>(std::min(std::max(color[c], 0.0F), 1.0F) * 255.0F + 0.5F);
+    }
+
+    dst[3] = 255;
+  }
+}
+
+void
+write_u32(std::ostream& stream, const std::uint32_t value)
+{
+  const unsigned char bytes[4]{ static_cast<unsigned char>(value),
+                                static_cast<unsigned char>(value >> 8),
+                                static_cast<unsigned char>(value >> 16),
+                                static_cast<unsigned char>(value >> 24) };
+  stream.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+}
+
+auto
+read_u32(std::istream& stream, std::uint32_t& value) -> bool
+{
+  unsigned char bytes[4]{};
+  if (!stream.read(reinterpret_cast<char*>(bytes), sizeof(bytes))) {
+    return false;
+  }
+  value = static_cast<std::uint32_t>(bytes[0]) | (static_cast<std::uint32_t>(bytes[1]) << 8) |
+          (static_cast<std::uint32_t>(bytes[2]) << 16) | (static_cast<std::uint32_t>(bytes[3]) << 24);
+  return true;
+}
+
+} // namespace
+
+auto
+prefilter_specular(const std::array<cube_face_view, 6>& faces, int num_threads) -> specular_chain
+{
+  std::vector<float_cube> source(1);
+
+  for (std::size_t i = 0; i < faces.size(); i++) {
+    source[0][i] = reduce_face(faces[i]);
+  }
+
+  while (source.back()[0].size > 1) {
+    float_cube next;
+    for (std::size_t i = 0; i < next.size(); i++) {
+      next[i] = halve_face(source.back()[i]);
+    }
+    source.emplace_back(std::move(next));
+  }
+
+  const auto source_size = source[0][0].size;
+
+  specular_chain chain;
+
+  chain.size = 1;
+
+  while ((chain.size * 2) <= std::min(max_chain_size, source_size)) {
+    chain.size *= 2;
+  }
+
+  chain.num_levels = static_cast<int>(std::log2(chain.size)) + 1;
+
+  chain.faces.resize(static_cast<std::size_t>(chain.num_levels) * 6);
+
+  std::vector<std::vector<lobe_sample>> lobes(static_cast<std::size_t>(chain.num_levels));
+
+  // Rows of every level and face, as (level, face, row).
+  std::vector<std::array<int, 3>> rows;
+
+  for (int level = 0; level < chain.num_levels; level++) {
+
+    const auto size = chain.size >> level;
+
+    if (level == 0) {
+      // A perfect mirror is the source itself, read at the level that matches the size of the chain.
+      lobe_sample mirror;
+      mirror.direction = glm::vec3(0, 0, 1);
+      mirror.weight = 1;
+      mirror.level = static_cast<int>(std::log2(source_size / size));
+      lobes[0].emplace_back(mirror);
+    } else {
+      const auto roughness = static_cast<float>(level) / static_cast<float>(chain.num_levels - 1);
+      lobes[static_cast<std::size_t>(level)] =
+        make_lobe(roughness, source_size, static_cast<int>(source.size()));
+    }
+
+    for (int face = 0; face < 6; face++) {
+      chain.faces[static_cast<std::size_t>(level) * 6 + face].resize(static_cast<std::size_t>(size) * size * 4);
+      for (int row = 0; row < size; row++) {
+        rows.push_back({ level, face, row });
+      }
+    }
+  }
+
+  if (num_threads <= 0) {
+    num_threads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+  }
+
+  std::atomic<std::size_t> next_row{ 0 };
+
+  auto prefilter = [&]() {
+    for (auto r = next_row++; r < rows.size(); r = next_row++) {
+      const auto level = rows[r][0];
+      const auto face = rows[r][1];
+      const auto size = chain.size >> level;
+      auto* output = chain.faces[static_cast<std::size_t>(level) * 6 + face].data() +
+                     static_cast<std::size_t>(rows[r][2]) * size * 4;
+      prefilter_row(source, lobes[static_cast<std::size_t>(level)], face, size, rows[r][2], output);
+    }
+  };
+
+  std::vector<std::thread> threads;
+
+  for (int i = 1; i < num_threads; i++) {
+    threads.emplace_back(prefilter);
+  }
+
+  prefilter();
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  return chain;
+}
+
+auto
+hash_bytes(const void* data, const std::size_t size, std::uint64_t hash) -> std::uint64_t
+{
+  const auto* bytes = static_cast<const unsigned char*>(data);
+
+  for (std::size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+auto
+get_specular_cache_name(const std::uint64_t asset_hash) -> std::string
+{
+  std::ostringstream stream;
+  stream << "specular-" << std::hex << std::setw(16) << std::setfill('0') << asset_hash << "-v" << std::dec
+         << cache_format_version << ".bin";
+  return stream.str();
+}
+
+auto
+load_specular_chain(const std::string& path, specular_chain& chain) -> bool
+{
+  std::ifstream file(path, std::ios::binary);
+
+  char magic[4]{};
+
+  std::uint32_t version{};
+  std::uint32_t size{};
+  std::uint32_t num_levels{};
+
+  if (!file.read(magic, sizeof(magic)) || (std::memcmp(magic, cache_magic, sizeof(magic)) != 0) ||
+      !read_u32(file, version) || (version != cache_format_version) || !read_u32(file, size) ||
+      !read_u32(file, num_levels) || (size == 0) || (size > max_chain_size) || (num_levels == 0) ||
+      ((size >> (num_levels - 1)) == 0)) {
+    return false;
+  }
+
+  specular_chain result;
+  result.size = static_cast<int>(size);
+  result.num_levels = static_cast<int>(num_levels);
+  result.faces.resize(static_cast<std::size_t>(num_levels) * 6);
+
+  for (std::uint32_t level = 0; level < num_levels; level++) {
+    const auto level_size = static_cast<std::size_t>(size >> level);
+    for (int face = 0; face < 6; face++) {
+      auto& data = result.faces[level * 6 + face];
+      data.resize(level_size * level_size * 4);
+      if (!file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()))) {
+        return false;
+      }
+    }
+  }
+
+  chain = std::move(result);
+
+  return true;
+}
+
+auto
+save_specular_chain(const std::string& path, const specular_chain& chain) -> bool
+{
+  const auto temp_path = path + ".tmp" + std::to_string(std::random_device{}());
+
+  {
+    std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+
+    file.write(cache_magic, sizeof(cache_magic));
+    write_u32(file, cache_format_version);
+    write_u32(file, static_cast<std::uint32_t>(chain.size));
+    write_u32(file, static_cast<std::uint32_t>(chain.num_levels));
+
+    for (const auto& face : chain.faces) {
+      file.write(reinterpret_cast<const char*>(face.data()), static_cast<std::streamsize>(face.size()));
+    }
+
+    if (!file.flush()) {
+      file.close();
+      std::remove(temp_path.c_str());
+      return false;
+    }
+  }
+
+  if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+} // namespace mvz
@@ -0,0 +1,57 @@
+#pragma once
+
+#ifndef MVZ_BUILD
+#error "This header is not meant to be included outside of the build."
+#endif
+
+#include "mvz_sh.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mvz {
+
+// A cube map prefiltered for glossy reflections. Level i of the chain is the environment convolved with a GGX lobe of
+// roughness i / (num_levels - 1), so that a shader only has to pick the level by roughness.
+struct specular_chain final
+{
+  int size{};
+
+  int num_levels{};
+
+  // RGBA8 faces of each level, level major, in the order GL numbers the faces.
+  std::vector<std::vector<unsigned char>> faces;
+
+  auto face(const int level, const int index) const -> const std::vector<unsigned char>&
+  {
+    return faces.at(static_cast<std::size_t>(level) * 6 + static_cast<std::size_t>(index));
+  }
+};
+
+// Runs on the given number of threads (zero means one per hardware thread).
+auto
+prefilter_specular(const std::array<cube_face_view, 6>& faces, int num_threads = 0) -> specular_chain;
+
+// FNV-1a, for keying cached data by the contents of the assets it was derived from.
+auto
+hash_bytes(const void* data, std::size_t size, std::uint64_t hash = 0xcbf29ce484222325ULL) -> std::uint64_t;
+
+// The name of the cache file for a chain prefiltered from assets with the given hash. It changes along with the
+// prefiltering parameters, so that stale files are never read.
+auto
+get_specular_cache_name(std::uint64_t asset_hash) -> std::string;
+
+// Returns false if the file does not exist or is not a complete chain.
+auto
+load_specular_chain(const std::string& path, specular_chain& chain) -> bool;
+
+// Writes to a temporary file that is renamed into place, so that processes sharing the cache never read a partial
+// file. Returns false if the file could not be written.
+auto
+save_specular_chain(const std::string& path, const specular_chain& chain) -> bool;
+
+} // namespace mvz
@@ -1,5 +1,7 @@
 #include "mvz_stb.h"
 
+#include "mvz_etc.h"
+
 #define STB_IMAGE_STATIC
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -10,6 +12,17 @@
 
 #include <cmrc/cmrc.hpp>
 
+#include <zlib.h>
+
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <thread>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
 CMRC_DECLARE(mvz_assets);
 
 namespace mvz {
@@ -32,4 +45,629 @@ open_rc_image(const char* path, int* w, int* h) -> unique_image_ptr
   return unique_image_ptr(px);
 }
 
+rc_image_decoder::rc_image_decoder(std::vector<std::string> paths, int num_threads)
+  : m_paths(std::move(paths))
+  , m_slots(m_paths.size())
+{
+  if (num_threads <= 0) {
+    num_threads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+  }
+
+  num_threads = std::min(num_threads, static_cast<int>(m_paths.size()));
+
+  try {
+    for (int i = 0; i < num_threads; i++) {
+      m_threads.emplace_back(&rc_image_decoder::run, this);
+    }
+  } catch (...) {
+    // The destructor does not run for a constructor that throws, and a joinable thread must not be destroyed. The
+    // threads that did start stop after the image they are on.
+    m_next_decode.store(m_paths.size());
+    for (auto& t : m_threads) {
+      t.join();
+    }
+    throw;
+  }
+}
+
+rc_image_decoder::~rc_image_decoder()
+{
+  for (auto& t : m_threads) {
+    t.join();
+  }
+}
+
+void
+rc_image_decoder::run()
+{
+  for (;;) {
+
+    const auto index = m_next_decode.fetch_add(1);
+    if (index >= m_paths.size()) {
+      break;
+    }
+
+    int w{};
+    int h{};
+
+    // An exception must not leave the thread. A missing resource is reported by next() like an image that fails to
+    // decode.
+    unique_image_ptr pixels;
+
+    try {
+      pixels = open_rc_image(m_paths[index].c_str(), &w, &h);
+    } catch (...) {
+      w = 0;
+      h = 0;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto& s = m_slots[index];
+    s.pixels = std::move(pixels);
+    s.width = w;
+    s.height = h;
+    s.done = true;
+
+    m_decoded.notify_all();
+  }
+}
+
+auto
+rc_image_decoder::next(int* w, int* h, std::string* path) -> unique_image_ptr
+{
+  const auto index = m_next_result++;
+
+  if (path) {
+    *path = m_paths.at(index);
+  }
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  auto& s = m_slots.at(index);
+
+  m_decoded.wait(lock, [&s] { return s.done; });
+
+  *w = s.width;
+  *h = s.height;
+
+  return std::move(s.pixels);
+}
+
+auto
+open_rc_ktx_cubemap(const char* path, ktx_cubemap& cubemap) -> bool
+{
+  const auto fs = cmrc::mvz_assets::get_filesystem();
+
+  if (!fs.is_file(path)) {
+    return false;
+  }
+
+  const auto file = fs.open(path);
+
+  return parse_ktx_cubemap(file.begin(), file.size(), cubemap);
+}
+
+auto
+list_rc_skyboxes() -> std::vector<std::string>
+{
+  const std::string directory = "assets/skyboxes";
+
+  const auto fs = cmrc::mvz_assets::get_filesystem();
+
+  std::vector<std::string> paths;
+
+  std::vector<std::string> equirect_paths;
+
+  for (const auto& entry : fs.iterate_directory(directory)) {
+    const auto path = directory + "/" + entry.filename();
+    if (entry.is_directory() && fs.is_file(path + "/px.png")) {
+      paths.emplace_back(path);
+    } else if (entry.is_file() && (path.size() > 4) && (path.compare(path.size() - 4, 4, ".jpg") == 0)) {
+      equirect_paths.emplace_back(path);
+    }
+  }
+
+  std::sort(paths.begin(), paths.end());
+
+  std::sort(equirect_paths.begin(), equirect_paths.end());
+
+  paths.insert(paths.end(), equirect_paths.begin(), equirect_paths.end());
+
+  return paths;
+}
+
+namespace {
+
+void
+append_to_vector(void* context, void* data, int size)
+{
+  auto* output = static_cast<std::vector<unsigned char>*>(context);
+
+  const auto* bytes = static_cast<const unsigned char*>(data);
+
+  output->insert(output->end(), bytes, bytes + size);
+}
+
+// Bands smaller than this are not worth a thread of their own.
+constexpr std::size_t min_png_band_pixels{ std::size_t(1) << 20 };
+
+constexpr int png_compression_level{ 6 };
+
+// A band of rows and the buffers it is encoded with, which a png_context keeps for the next image. zlib keeps a
+// pointer to the stream, so a band cannot move.
+struct png_band final
+{
+  png_band() = default;
+
+  png_band(const png_band&) = delete;
+
+  png_band(png_band&&) = delete;
+
+  auto operator=(const png_band&) -> png_band& = delete;
+
+  auto operator=(png_band&&) -> png_band& = delete;
+
+  ~png_band()
+  {
+    if (stream_ready) {
+      deflateEnd(&stream);
+    }
+  }
+
+  int first_row{};
+
+  int num_rows{};
+
+  std::vector<signed char> line;
+
+  std::vector<unsigned char> filtered;
+
+  std::vector<unsigned char> compressed;
+
+  z_stream stream{};
+
+  bool stream_ready{ false };
+
+  uLong adler{};
+
+  uLong crc{};
+
+  bool success{ false };
+};
+
+void
+append_u32(std::vector<unsigned char>& output, const std::uint32_t value)
+{
+  output.push_back(static_cast<unsigned char>(value >> 24));
+  output.push_back(static_cast<unsigned char>(value >> 16));
+  output.push_back(static_cast<unsigned char>(value >> 8));
+  output.push_back(static_cast<unsigned char>(value));
+}
+
+void
+append_chunk(std::vector<unsigned char>& output, const char* tag, const unsigned char* data, const std::size_t size)
+{
+  append_u32(output, static_cast<std::uint32_t>(size));
+
+  const auto* tag_ptr = reinterpret_cast<const unsigned char*>(tag);
+
+  output.insert(output.end(), tag_ptr, tag_ptr + 4);
+  output.insert(output.end(), data, data + size);
+
+  auto crc = crc32(0, tag_ptr, 4);
+
+  if (size > 0) {
+    crc = crc32(crc, data, static_cast<uInt>(size));
+  }
+
+  append_u32(output, static_cast<std::uint32_t>(crc));
+}
+
+// Filters the rows of a band with the same per-row heuristic as stbi_write_png(). Filtering only looks at the row
+// above, so bands do not depend on each other.
+void
+filter_png_band(unsigned char* pixels, const int w, const int h, const int bytes_per_pixel, png_band& band)
+{
+  const auto row_size = static_cast<std::size_t>(w) * bytes_per_pixel;
+
+  band.filtered.resize((row_size + 1) * band.num_rows);
+
+  auto& line = band.line;
+
+  line.resize(row_size);
+
+  for (int j = 0; j < band.num_rows; j++) {
+
+    const auto y = band.first_row + j;
+
+    int best_filter{};
+
+    int best_estimate{ 0x7fffffff };
+
+    for (int filter = 0; filter < 5; filter++) {
+
+      stbiw__encode_png_line(pixels, static_cast<int>(row_size), w, h, y, bytes_per_pixel, filter, line.data());
+
+      int estimate{};
+
+      for (const auto value : line) {
+        estimate += std::abs(value);
+      }
+
+      if (estimate < best_estimate) {
+        best_estimate = estimate;
+        best_filter = filter;
+      }
+    }
+
+    stbiw__encode_png_line(pixels, static_cast<int>(row_size), w, h, y, bytes_per_pixel, best_filter, line.data());
+
+    auto* dst = band.filtered.data() + j * (row_size + 1);
+
+    dst[0] = static_cast<unsigned char>(best_filter);
+
+    std::memcpy(dst + 1, line.data(), row_size);
+  }
+}
+
+// Deflates a band as raw deflate data. Every band but the last ends on a sync flush, which leaves the stream byte
+// aligned and open, so that the bands can simply be concatenated (the same approach as pigz).
+void
+deflate_png_band(png_band& band, const bool last)
+{
+  band.success = false;
+
+  auto& stream = band.stream;
+
+  if (band.stream_ready) {
+    if (deflateReset(&stream) != Z_OK) {
+      return;
+    }
+  } else {
+    if (deflateInit2(&stream, png_compression_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      return;
+    }
+    band.stream_ready = true;
+  }
+
+  const auto input_size = static_cast<uLong>(band.filtered.size());
+
+  // A sync flush appends an empty stored block, which deflateBound() does not account for.
+  band.compressed.resize(deflateBound(&stream, input_size) + 16);
+
+  stream.next_in = band.filtered.data();
+  stream.avail_in = static_cast<uInt>(input_size);
+  stream.next_out = band.compressed.data();
+  stream.avail_out = static_cast<uInt>(band.compressed.size());
+
+  const auto result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+
+  band.success = (last ? (result == Z_STREAM_END) : (result == Z_OK)) && (stream.avail_in == 0);
+
+  band.compressed.resize(band.compressed.size() - stream.avail_out);
+
+  band.adler = adler32(1, band.filtered.data(), static_cast<uInt>(input_size));
+
+  band.crc = crc32(0, band.compressed.data(), static_cast<uInt>(band.compressed.size()));
+}
+
+} // namespace
+
+// Runs the bands of an image on the threads of the context, which wait for the next image in between.
+class png_context::impl final
+{
+public:
+  explicit impl(const int num_threads)
+  {
+    try {
+      for (int i = 1; i < num_threads; i++) {
+        m_threads.emplace_back(&impl::run_worker, this);
+      }
+    } catch (...) {
+      stop();
+      throw;
+    }
+  }
+
+  impl(const impl&) = delete;
+
+  impl(impl&&) = delete;
+
+  auto operator=(const impl&) -> impl& = delete;
+
+  auto operator=(impl&&) -> impl& = delete;
+
+  ~impl() { stop(); }
+
+  // Calls 'func' with every index below 'num_tasks', on the calling thread and the ones of the context, and returns
+  // once all calls did. Rethrows the first exception of a call.
+  void run(const std::size_t num_tasks, const std::function<void(std::size_t)>& func)
+  {
+    if (m_threads.empty() || (num_tasks < 2)) {
+      for (std::size_t i = 0; i < num_tasks; i++) {
+        func(i);
+      }
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_task = &func;
+      m_num_tasks = num_tasks;
+      m_next_task = 0;
+      m_num_unfinished = num_tasks;
+    }
+
+    m_work_available.notify_all();
+
+    run_tasks();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_work_done.wait(lock, [this] { return m_num_unfinished == 0; });
+
+    m_task = nullptr;
+
+    if (m_error) {
+      const auto error = m_error;
+      m_error = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+  std::vector<unsigned char> swapped;
+
+  std::vector<std::unique_ptr<png_band>> bands;
+
+private:
+  void run_worker()
+  {
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_work_available.wait(lock, [this] { return m_stopping || (m_task && (m_next_task < m_num_tasks)); });
+
+        if (m_stopping) {
+          return;
+        }
+      }
+
+      run_tasks();
+    }
+  }
+
+  void run_tasks()
+  {
+    while (true) {
+
+      const std::function<void(std::size_t)>* task{};
+
+      std::size_t index{};
+
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (!m_task || (m_next_task >= m_num_tasks)) {
+          return;
+        }
+
+        task = m_task;
+        index = m_next_task++;
+      }
+
+      std::exception_ptr error;
+
+      try {
+        (*task)(index);
+      } catch (...) {
+        error = std::current_exception();
+      }
+
+      bool finished{};
+
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (error && !m_error) {
+          m_error = error;
+        }
+
+        finished = (--m_num_unfinished == 0);
+      }
+
+      if (finished) {
+        m_work_done.notify_all();
+      }
+    }
+  }
+
+  void stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+
+    m_work_available.notify_all();
+
+    for (auto& t : m_threads) {
+      t.join();
+    }
+  }
+
+  std::mutex m_mutex;
+
+  std::condition_variable m_work_available;
+
+  std::condition_variable m_work_done;
+
+  const std::function<void(std::size_t)>* m_task{};
+
+  std::size_t m_num_tasks{};
+
+  std::size_t m_next_task{};
+
+  std::size_t m_num_unfinished{};
+
+  std::exception_ptr m_error;
+
+  bool m_stopping{ false };
+
+  std::vector<std::thread> m_threads;
+};
+
+png_context::png_context(const int num_threads)
+  : m_num_threads(std::max(num_threads, 1))
+  , m_impl(new impl(m_num_threads))
+{
+}
+
+png_context::~png_context() = default;
+
+auto
+png_context::num_threads() const -> int
+{
+  return m_num_threads;
+}
+
+auto
+encode_png(const unsigned char* pixels,
+           const int w,
+           const int h,
+           const int channels,
+           const int channel_size,
+           png_context& context,
+           std::vector<unsigned char>& output) -> bool
+{
+  if ((w <= 0) || (h <= 0) || (channels < 1) || (channels > 4) || ((channel_size != 1) && (channel_size != 2))) {
+    return false;
+  }
+
+  const auto bytes_per_pixel = channels * channel_size;
+
+  const auto row_size = static_cast<std::size_t>(w) * bytes_per_pixel;
+
+  auto& state = *context.m_impl;
+
+  // PNG stores 16-bit samples big endian.
+  auto& swapped = state.swapped;
+
+  if (channel_size == 2) {
+    swapped.resize(row_size * h);
+    for (std::size_t i = 0; i < swapped.size(); i += 2) {
+      std::uint16_t value{};
+      std::memcpy(&value, pixels + i, 2);
+      swapped[i] = static_cast<unsigned char>(value >> 8);
+      swapped[i + 1] = static_cast<unsigned char>(value);
+    }
+    pixels = swapped.data();
+  }
+
+  const auto max_bands = std::max<std::size_t>(1, (static_cast<std::size_t>(w) * h) / min_png_band_pixels);
+
+  const auto num_bands = std::min<std::size_t>(context.num_threads(), std::min<std::size_t>(max_bands, h));
+
+  auto& bands = state.bands;
+
+  while (bands.size() < num_bands) {
+    bands.emplace_back(std::make_unique<png_band>());
+  }
+
+  for (std::size_t i = 0; i < num_bands; i++) {
+    bands[i]->first_row = static_cast<int>((h * i) / num_bands);
+    bands[i]->num_rows = static_cast<int>((h * (i + 1)) / num_bands) - bands[i]->first_row;
+  }
+
+  // stb takes the pixels as non-const, but only reads them.
+  auto* src = const_cast<unsigned char*>(pixels);
+
+  const auto encode_band = [&](const std::size_t i) {
+    filter_png_band(src, w, h, bytes_per_pixel, *bands[i]);
+    deflate_png_band(*bands[i], i + 1 == num_bands);
+  };
+
+  // Passed by reference, so that the std::function does not allocate a copy of the lambda.
+  state.run(num_bands, std::ref(encode_band));
+
+  std::size_t compressed_size{ 6 };
+
+  for (std::size_t i = 0; i < num_bands; i++) {
+    if (!bands[i]->success) {
+      return false;
+    }
+    compressed_size += bands[i]->compressed.size();
+  }
+
+  const unsigned char signature[8]{ 137, 80, 78, 71, 13, 10, 26, 10 };
+
+  output.reserve(output.size() + sizeof(signature) + 25 + 12 + compressed_size + 12);
+
+  output.insert(output.end(), signature, signature + sizeof(signature));
+
+  static const unsigned char color_types[5]{ 0, 0, 4, 2, 6 };
+
+  unsigned char header[13]{};
+  header[0] = static_cast<unsigned char>(w >> 24);
+  header[1] = static_cast<unsigned char>(w >> 16);
+  header[2] = static_cast<unsigned char>(w >> 8);
+  header[3] = static_cast<unsigned char>(w);
+  header[4] = static_cast<unsigned char>(h >> 24);
+  header[5] = static_cast<unsigned char>(h >> 16);
+  header[6] = static_cast<unsigned char>(h >> 8);
+  header[7] = static_cast<unsigned char>(h);
+  header[8] = static_cast<unsigned char>(channel_size * 8);
+  header[9] = color_types[channels];
+
+  append_chunk(output, "IHDR", header, sizeof(header));
+
+  // The IDAT chunk is assembled in place so that the compressed bands are only copied once, and its CRC is combined
+  // from the ones computed by the band threads.
+  append_u32(output, static_cast<std::uint32_t>(compressed_size));
+
+  const auto crc_start = output.size();
+
+  const unsigned char zlib_header[2]{ 0x78, 0x9c };
+
+  output.insert(output.end(), { 'I', 'D', 'A', 'T' });
+  output.insert(output.end(), zlib_header, zlib_header + 2);
+
+  auto crc = crc32(0, output.data() + crc_start, 6);
+
+  uLong adler{ bands[0]->adler };
+
+  for (std::size_t i = 0; i < num_bands; i++) {
+
+    const auto& band = *bands[i];
+
+    output.insert(output.end(), band.compressed.begin(), band.compressed.end());
+
+    crc = crc32_combine(crc, band.crc, static_cast<z_off_t>(band.compressed.size()));
+
+    if (i > 0) {
+      adler = adler32_combine(adler, band.adler, static_cast<z_off_t>((row_size + 1) * band.num_rows));
+    }
+  }
+
+  const auto adler_start = output.size();
+
+  append_u32(output, static_cast<std::uint32_t>(adler));
+
+  crc = crc32(crc, output.data() + adler_start, 4);
+
+  append_u32(output, static_cast<std::uint32_t>(crc));
+
+  append_chunk(output, "IEND", nullptr, 0);
+
+  return true;
+}
+
+auto
+encode_jpg(const unsigned char* pixels, int w, int h, int channels, int quality, std::vector<unsigned char>& output)
+  -> bool
+{
+  return stbi_write_jpg_to_func(append_to_vector, &output, w, h, channels, pixels, quality) != 0;
+}
+
 } // namespace mvz
@@ -4,10 +4,18 @@
 #error "This header is not meant to be included outside of the build."
 #endif
 
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace mvz {
 
+struct ktx_cubemap;
+
 struct image_deconstructor final
 {
   void operator()(unsigned char* ptr);
@@ -18,4 +26,122 @@ using unique_image_ptr = std::unique_ptr<unsigned char, image_deconstructor>;
 auto
 open_rc_image(const char* path, int* w, int* h) -> unique_image_ptr;
 
+// Decodes embedded images on worker threads and hands them back in the order of their paths, each as soon as it and
+// the ones before it are done. This lets the owning thread upload an image while the next ones are still decoding.
+class rc_image_decoder final
+{
+public:
+  // Zero threads means one per hardware thread, but never more than there are images.
+  explicit rc_image_decoder(std::vector<std::string> paths, int num_threads = 0);
+
+  rc_image_decoder(const rc_image_decoder&) = delete;
+
+  rc_image_decoder(rc_image_decoder&&) = delete;
+
+  auto operator=(const rc_image_decoder&) -> rc_image_decoder& = delete;
+
+  auto operator=(rc_image_decoder&&) -> rc_image_decoder& = delete;
+
+  // Images that were not taken yet are still decoded, and then dropped.
+  ~rc_image_decoder();
+
+  // Waits for the next image and returns it, or a null pointer if it could not be decoded. The path of the image is
+  // stored in 'path' if one is given, for error messages.
+  auto next(int* w, int* h, std::string* path = nullptr) -> unique_image_ptr;
+
+private:
+  void run();
+
+  struct slot final
+  {
+    unique_image_ptr pixels;
+
+    int width{};
+
+    int height{};
+
+    bool done{ false };
+  };
+
+  std::vector<std::string> m_paths;
+
+  std::vector<slot> m_slots;
+
+  std::atomic<std::size_t> m_next_decode{ 0 };
+
+  std::size_t m_next_result{};
+
+  std::mutex m_mutex;
+
+  std::condition_variable m_decoded;
+
+  std::vector<std::thread> m_threads;
+};
+
+// Returns false if there is no such resource or it is not a valid KTX cube map. The compressed copies of the skyboxes
+// are only built into the library when it is configured with MVZ_ETC.
+auto
+open_rc_ktx_cubemap(const char* path, ktx_cubemap& cubemap) -> bool;
+
+// The skyboxes built into the library: the paths of the directories that hold six faces ('px.png' and so on), followed
+// by the paths of the equirectangular JPEG images, each sorted so that their order does not depend on the resource
+// index.
+auto
+list_rc_skyboxes() -> std::vector<std::string>;
+
+// What encode_png() keeps from one image to the next: the buffers and deflate streams of the bands, which stop
+// allocating once they have grown to the image size, and the threads that the bands are encoded on. Only one thread at
+// a time may encode with a context.
+class png_context final
+{
+public:
+  // Bands are encoded on up to 'num_threads' threads, the calling one included. The others are started here and wait
+  // for work until the context is destroyed.
+  explicit png_context(int num_threads = 1);
+
+  png_context(const png_context&) = delete;
+
+  png_context(png_context&&) = delete;
+
+  auto operator=(const png_context&) -> png_context& = delete;
+
+  auto operator=(png_context&&) -> png_context& = delete;
+
+  ~png_context();
+
+  auto num_threads() const -> int;
+
+private:
+  friend auto encode_png(const unsigned char* pixels,
+                         int w,
+                         int h,
+                         int channels,
+                         int channel_size,
+                         png_context& context,
+                         std::vector<unsigned char>& output) -> bool;
+
+  class impl;
+
+  int m_num_threads{ 1 };
+
+  std::unique_ptr<impl> m_impl;
+};
+
+// The encoders append to the output buffer, so that callers can reuse its capacity between images.
+
+// Supports 8 and 16-bit channels, the latter in native byte order. Large images are split into bands of rows that are
+// filtered and deflated on the threads of the context and stitched into a single zlib stream.
+auto
+encode_png(const unsigned char* pixels,
+           int w,
+           int h,
+           int channels,
+           int channel_size,
+           png_context& context,
+           std::vector<unsigned char>& output) -> bool;
+
+auto
+encode_jpg(const unsigned char* pixels, int w, int h, int channels, int quality, std::vector<unsigned char>& output)
+  -> bool;
+
 } // namespace mvz
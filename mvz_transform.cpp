@@ -0,0 +1,54 @@
+#include "mvz_transform.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <sstream>
+
+namespace mvz {
+
+auto
+get_rotation_matrix(const vec3& rotation) -> glm::mat4
+{
+  const auto x_rot = glm::rotate(glm::mat4(1.0), rotation.x, glm::vec3(1, 0, 0));
+  const auto y_rot = glm::rotate(glm::mat4(1.0), rotation.y, glm::vec3(0, 1, 0));
+  const auto z_rot = glm::rotate(glm::mat4(1.0), rotation.z, glm::vec3(0, 0, 1));
+  return z_rot * y_rot * x_rot;
+}
+
+auto
+get_model_matrix(const mesh_instance& inst) -> glm::mat4
+{
+  const auto translation = glm::vec3(inst.translation.x, inst.translation.y, inst.translation.z);
+  const auto scale = glm::vec3(inst.scale.x, inst.scale.y, inst.scale.z);
+  return glm::translate(glm::mat4(1.0), translation) * get_rotation_matrix(inst.rotation) *
+         glm::scale(glm::mat4(1.0), scale);
+}
+
+auto
+get_view_matrix(const camera& cam) -> glm::mat4
+{
+  const auto cam_pos = glm::vec3(cam.position.x, cam.position.y, cam.position.z);
+  const auto cam_rot = glm::mat3(get_rotation_matrix(cam.rotation));
+
+  return glm::lookAt(cam_pos, cam_pos + cam_rot * glm::vec3(0, 0, -1), glm::vec3(0, 1, 0));
+}
+
+auto
+get_projection_matrix(const camera& cam) -> glm::mat4
+{
+  return glm::perspective(cam.fovy, cam.aspect, cam.near, cam.far);
+}
+
+auto
+get_instance_id(const std::size_t instance_index) -> std::uint32_t
+{
+  const auto id = instance_index + 1;
+  if (id > max_instance_id) {
+    std::ostringstream stream;
+    stream << "Instance count exceeds the maximum of '" << max_instance_id << "' for segmentation.";
+    throw runtime_error(stream.str());
+  }
+  return static_cast<std::uint32_t>(id);
+}
+
+} // namespace mvz
@@ -0,0 +1,35 @@
+#pragma once
+
+#ifndef MVZ_BUILD
+#error "This header is not meant to be included outside of the build."
+#endif
+
+#include "mvz.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mvz {
+
+// Segmentation IDs are the instance index plus one (zero is the background) and have to fit into 24 bits.
+constexpr std::size_t max_instance_id{ 0xffffff };
+
+auto
+get_rotation_matrix(const vec3& rotation) -> glm::mat4;
+
+auto
+get_model_matrix(const mesh_instance& inst) -> glm::mat4;
+
+auto
+get_view_matrix(const camera& cam) -> glm::mat4;
+
+auto
+get_projection_matrix(const camera& cam) -> glm::mat4;
+
+// Throws a runtime_error when the index is out of range.
+auto
+get_instance_id(std::size_t instance_index) -> std::uint32_t;
+
+} // namespace mvz
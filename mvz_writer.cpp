@@ -0,0 +1,241 @@
+#include "mvz_writer.h"
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace mvz {
+
+auto
+get_type_name(const image_type type) -> const char*
+{
+  switch (type) {
+    case image_type::color:
+      return "color";
+    case image_type::segmentation:
+      return "segmentation";
+    case image_type::depth:
+      return "depth";
+    case image_type::normal:
+      return "normal";
+  }
+
+  return "unknown";
+}
+
+namespace {
+
+class directory_sink final : public image_sink
+{
+public:
+  explicit directory_sink(std::string directory)
+    : m_directory(std::move(directory))
+  {
+  }
+
+  void write(const frame& f, const char* extension, const std::vector<unsigned char>& data) override
+  {
+    std::ostringstream path_stream;
+    path_stream << m_directory << '/' << std::setw(8) << std::setfill('0') << f.index << '_' << get_type_name(f.type)
+                << extension;
+
+    const auto path = path_stream.str();
+
+    std::ofstream file(path, std::ios::binary);
+
+    file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+
+    if (!file) {
+      std::ostringstream stream;
+      stream << "Failed to write '" << path << "'.";
+      throw runtime_error(stream.str());
+    }
+  }
+
+private:
+  std::string m_directory;
+};
+
+} // namespace
+
+auto
+make_directory_sink(std::string directory) -> std::shared_ptr<image_sink>
+{
+  return std::make_shared<directory_sink>(std::move(directory));
+}
+
+image_writer::image_writer(std::string directory,
+                           readback_callback recycle,
+                           const int num_threads,
+                           const std::size_t max_queued)
+  : image_writer(make_directory_sink(std::move(directory)), std::move(recycle), num_threads, max_queued)
+{
+}
+
+image_writer::image_writer(std::shared_ptr<image_sink> sink,
+                           readback_callback recycle,
+                           const int num_threads,
+                           const std::size_t max_queued)
+  : m_sink(std::move(sink))
+  , m_recycle(std::move(recycle))
+  , m_max_queued(max_queued > 0 ? max_queued : 1)
+  , m_encoders(static_cast<std::size_t>(image_type::normal) + 1, make_png_encoder(1))
+{
+  m_encoders.at(static_cast<std::size_t>(image_type::depth)) = make_raw_encoder();
+
+  const auto hw_threads = static_cast<int>(std::thread::hardware_concurrency());
+
+  const auto thread_count = (num_threads > 0) ? num_threads : (hw_threads > 0 ? hw_threads : 1);
+
+  for (int i = 0; i < thread_count; i++) {
+    m_threads.emplace_back(&image_writer::run_worker, this);
+  }
+}
+
+image_writer::~image_writer()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+
+  m_queue_not_empty.notify_all();
+
+  for (auto& t : m_threads) {
+    t.join();
+  }
+}
+
+void
+image_writer::push(frame&& f)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  m_queue_not_full.wait(lock, [this] { return (m_queue.size() < m_max_queued) || m_error; });
+
+  // A frame that is not queued goes back to the recycle callback like a written one, so that its storage is not lost.
+  if (m_error) {
+    const auto error = m_error;
+    m_error = nullptr;
+    lock.unlock();
+    if (m_recycle) {
+      m_recycle(std::move(f));
+    }
+    std::rethrow_exception(error);
+  }
+
+  m_queue.emplace_back(std::move(f));
+
+  lock.unlock();
+
+  m_queue_not_empty.notify_one();
+}
+
+void
+image_writer::flush()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  m_idle.wait(lock, [this] { return (m_queue.empty() && (m_num_busy == 0)) || m_error; });
+
+  rethrow_error();
+
+  lock.unlock();
+
+  m_sink->flush();
+}
+
+void
+image_writer::set_encoder(const image_type type, std::shared_ptr<const image_encoder> encoder)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  m_encoders.at(static_cast<std::size_t>(type)) = std::move(encoder);
+}
+
+void
+image_writer::rethrow_error()
+{
+  if (m_error) {
+    auto err = m_error;
+    m_error = nullptr;
+    std::rethrow_exception(err);
+  }
+}
+
+void
+image_writer::run_worker()
+{
+  // Each thread keeps its own output buffer, so that its capacity is reused from one image to the next.
+  std::vector<unsigned char> buffer;
+
+  while (true) {
+
+    frame f;
+
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+
+      m_queue_not_empty.wait(lock, [this] { return !m_queue.empty() || m_stopping; });
+
+      if (m_queue.empty()) {
+        return;
+      }
+
+      f = std::move(m_queue.front());
+
+      m_queue.pop_front();
+
+      m_num_busy++;
+    }
+
+    m_queue_not_full.notify_one();
+
+    std::exception_ptr error;
+
+    try {
+      write(f, buffer);
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    if (m_recycle) {
+      m_recycle(std::move(f));
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+
+      m_num_busy--;
+
+      if (error && !m_error) {
+        m_error = error;
+      }
+    }
+
+    m_idle.notify_all();
+
+    if (error) {
+      m_queue_not_full.notify_all();
+    }
+  }
+}
+
+void
+image_writer::write(const frame& f, std::vector<unsigned char>& buffer)
+{
+  std::shared_ptr<const image_encoder> encoder;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    encoder = m_encoders.at(static_cast<std::size_t>(f.type));
+  }
+
+  buffer.clear();
+
+  encoder->encode(f, buffer);
+
+  m_sink->write(f, encoder->extension(), buffer);
+}
+
+} // namespace mvz
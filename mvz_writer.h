@@ -0,0 +1,109 @@
+#pragma once
+
+#include "mvz.h"
+#include "mvz_encoder.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+
+namespace mvz {
+
+// Lower case, e.g. "segmentation".
+auto
+get_type_name(image_type type) -> const char*;
+
+// Where an image_writer puts the encoded images. write() is called from the encoder threads concurrently.
+class image_sink
+{
+public:
+  virtual ~image_sink() = default;
+
+  virtual void write(const frame& f, const char* extension, const std::vector<unsigned char>& data) = 0;
+
+  // Called by image_writer::flush() once every queued frame has been written.
+  virtual void flush() {}
+};
+
+// One file per image, named '<directory>/<index>_<type><ext>'.
+auto
+make_directory_sink(std::string directory) -> std::shared_ptr<image_sink>;
+
+// Encodes frames on a pool of background threads and passes them to a sink. Frames are moved in and out of the queue,
+// and every frame is handed to the recycle callback once it is written, which is where its storage should go back to
+// the session.
+class image_writer final
+{
+public:
+  image_writer(std::string directory, readback_callback recycle, int num_threads = 0, std::size_t max_queued = 16);
+
+  image_writer(std::shared_ptr<image_sink> sink,
+               readback_callback recycle,
+               int num_threads = 0,
+               std::size_t max_queued = 16);
+
+  image_writer(const image_writer&) = delete;
+
+  image_writer(image_writer&&) = delete;
+
+  auto operator=(const image_writer&) -> image_writer& = delete;
+
+  auto operator=(image_writer&&) -> image_writer& = delete;
+
+  // Writes out everything that is still queued.
+  ~image_writer();
+
+  // Blocks while the queue is full. Rethrows the first error that occurred on an encoder thread, after handing the
+  // frame to the recycle callback.
+  void push(frame&& f);
+
+  // Blocks until every queued frame is written and flushes the sink. Rethrows the first error that occurred on an
+  // encoder thread.
+  void flush();
+
+  // By default, depth is written raw and everything else as PNG, each frame on the encoder thread that took it.
+  void set_encoder(image_type type, std::shared_ptr<const image_encoder> encoder);
+
+protected:
+  void run_worker();
+
+  void write(const frame& f, std::vector<unsigned char>& buffer);
+
+  void rethrow_error();
+
+private:
+  std::shared_ptr<image_sink> m_sink;
+
+  readback_callback m_recycle;
+
+  std::size_t m_max_queued{};
+
+  std::vector<std::shared_ptr<const image_encoder>> m_encoders;
+
+  std::mutex m_mutex;
+
+  std::condition_variable m_queue_not_empty;
+
+  std::condition_variable m_queue_not_full;
+
+  std::condition_variable m_idle;
+
+  std::deque<frame> m_queue;
+
+  std::size_t m_num_busy{};
+
+  bool m_stopping{ false };
+
+  std::exception_ptr m_error;
+
+  std::vector<std::thread> m_threads;
+};
+
+} // namespace mvz
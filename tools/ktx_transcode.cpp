@@ -0,0 +1,126 @@
+#include "mvz_etc.h"
+
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdlib>
+
+// Transcodes the six faces of a skybox into an ETC1 compressed KTX cube map with a full mip chain. Run by the build
+// when MVZ_ETC is enabled, so that sessions upload the blocks as they are instead of decoding PNGs.
+//
+//   mvz_ktx_transcode <output.ktx> <px.png> <nx.png> <py.png> <ny.png> <pz.png> <nz.png>
+
+namespace {
+
+struct image final
+{
+  int size{};
+
+  std::vector<unsigned char> rgba;
+};
+
+auto
+halve(const image& src) -> image
+{
+  image dst;
+  dst.size = std::max(src.size / 2, 1);
+  dst.rgba.resize(static_cast<std::size_t>(dst.size) * dst.size * 4);
+
+  for (int y = 0; y < dst.size; y++) {
+    for (int x = 0; x < dst.size; x++) {
+      for (int c = 0; c < 4; c++) {
+        int sum{};
+        for (int j = 0; j < 2; j++) {
+          for (int i = 0; i < 2; i++) {
+            const auto sx = std::min(x * 2 + i, src.size - 1);
+            const auto sy = std::min(y * 2 + j, src.size - 1);
+            sum += src.rgba[(static_cast<std::size_t>(sy) * src.size + sx) * 4 + c];
+          }
+        }
+        dst.rgba[(static_cast<std::size_t>(y) * dst.size + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+      }
+    }
+  }
+
+  return dst;
+}
+
+} // namespace
+
+auto
+main(int argc, char** argv) -> int
+{
+  if (argc != 8) {
+    std::cerr << "usage: " << argv[0] << " <output.ktx> <px.png> <nx.png> <py.png> <ny.png> <pz.png> <nz.png>"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::vector<image> faces(6);
+
+  for (int i = 0; i < 6; i++) {
+
+    int w{};
+    int h{};
+
+    std::unique_ptr<unsigned char, void (*)(void*)> pixels(stbi_load(argv[i + 2], &w, &h, nullptr, 4), stbi_image_free);
+
+    if (!pixels || (w != h) || ((i > 0) && (w != faces[0].size))) {
+      std::cerr << "Failed to open '" << argv[i + 2] << "' as a square face of the same size as the others."
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    faces[i].size = w;
+    faces[i].rgba.assign(pixels.get(), pixels.get() + static_cast<std::size_t>(w) * h * 4);
+  }
+
+  mvz::ktx_cubemap cubemap;
+  cubemap.internal_format = mvz::etc1_internal_format;
+  cubemap.size = faces[0].size;
+
+  for (auto size = cubemap.size; size > 0; size /= 2) {
+
+    const auto first = cubemap.faces.size();
+
+    cubemap.faces.resize(first + 6);
+
+    // The faces are independent, so each is reduced and encoded on a thread of its own.
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < 6; i++) {
+      threads.emplace_back([&cubemap, &faces, first, i]() {
+        if (cubemap.num_levels > 0) {
+          faces[i] = halve(faces[i]);
+        }
+        cubemap.faces[first + i] = mvz::encode_etc1(faces[i].rgba.data(), faces[i].size, faces[i].size);
+      });
+    }
+
+    for (auto& t : threads) {
+      t.join();
+    }
+
+    cubemap.num_levels++;
+  }
+
+  const auto data = mvz::write_ktx_cubemap(cubemap);
+
+  std::ofstream file(argv[1], std::ios::binary | std::ios::trunc);
+
+  if (!file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()))) {
+    std::cerr << "Failed to write '" << argv[1] << "'." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,514 @@
+#include "mvz.h"
+#include "mvz_egl.h"
+#include "mvz_random.h"
+#include "mvz_writer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Renders a dataset with several worker processes, each of which owns a headless session. Sample indices are handed
+// out in ranges from a counter in shared memory. A worker records itself as the owner of every range it takes, and
+// publishes how far into the range the written samples go. A worker that crashes is restarted and picks its range up
+// from there, and a range that was taken by a worker that died before recording itself is claimed again once the
+// counter runs out, so that no sample is skipped. Samples that were written but not yet committed are rendered again,
+// to the same images. Camera poses and skyboxes are drawn by a randomizer keyed by the sample index, which makes the
+// output independent of how the work was split.
+
+namespace {
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "Shared memory counters have to be lock free.");
+
+static_assert(std::atomic<std::uint16_t>::is_always_lock_free, "Shared memory range owners have to be lock free.");
+
+constexpr std::uint64_t default_range_size{ 16 };
+
+constexpr int max_workers{ 256 };
+
+constexpr int max_restarts_per_worker{ 8 };
+
+// The owner of a range is the index of its worker plus one, between these two.
+constexpr std::uint16_t range_free{ 0 };
+
+constexpr std::uint16_t range_done{ std::numeric_limits<std::uint16_t>::max() };
+
+static_assert(max_workers < range_done, "Worker indices have to fit in a range owner.");
+
+// Both ends of a range share one word of shared memory, which limits sample indices to 32 bits.
+constexpr std::uint64_t max_samples{ std::numeric_limits<std::uint32_t>::max() };
+
+const std::vector<mvz::image_type> sample_outputs{ mvz::image_type::color, mvz::image_type::segmentation };
+
+struct worker_slot final
+{
+  // The range claimed last, as packed by pack_range(). Its end and the index below which its samples are on disk are
+  // stored together, so that a worker that dies at any point leaves them consistent.
+  std::atomic<std::uint64_t> range;
+
+  std::atomic<std::uint64_t> num_samples;
+
+  std::atomic<std::uint64_t> num_restarts;
+};
+
+struct shared_state final
+{
+  std::atomic<std::uint64_t> next_range;
+
+  worker_slot workers[max_workers];
+};
+
+// The owner of every range, in shared memory next to the shared_state.
+struct range_table final
+{
+  std::atomic<std::uint16_t>* owners{};
+
+  std::uint64_t size{};
+};
+
+struct options final
+{
+  std::string output_directory;
+
+  std::uint64_t num_samples{};
+
+  int num_workers{ 1 };
+
+  std::uint64_t range_size{ default_range_size };
+
+  std::uint64_t seed{};
+
+  std::string obj_path;
+
+  std::vector<std::string> shapes;
+};
+
+constexpr auto
+pack_range(const std::uint64_t committed, const std::uint64_t end) -> std::uint64_t
+{
+  return (end << 32) | committed;
+}
+
+constexpr auto
+get_committed(const std::uint64_t range) -> std::uint64_t
+{
+  return range & max_samples;
+}
+
+constexpr auto
+get_range_end(const std::uint64_t range) -> std::uint64_t
+{
+  return range >> 32;
+}
+
+auto
+find_range(const range_table& ranges, const std::uint16_t owner) -> std::uint64_t
+{
+  for (std::uint64_t range = 0; range < ranges.size; range++) {
+    if (ranges.owners[range].load() == owner) {
+      return range;
+    }
+  }
+
+  return ranges.size;
+}
+
+auto
+try_claim(std::atomic<std::uint16_t>& range_owner, const std::uint16_t owner) -> bool
+{
+  auto expected = range_free;
+
+  return range_owner.compare_exchange_strong(expected, owner);
+}
+
+// Ranges are taken in order from the counter, and belong to the worker that then records itself as their owner. One
+// that dies in between leaves its range free, so once the counter runs out, the ranges that are still free are claimed
+// in a scan. Returns the size of the table when there is nothing left.
+auto
+claim_range(shared_state& state, const range_table& ranges, const std::uint16_t owner) -> std::uint64_t
+{
+  for (auto range = state.next_range.fetch_add(1); range < ranges.size; range = state.next_range.fetch_add(1)) {
+    if (try_claim(ranges.owners[range], owner)) {
+      return range;
+    }
+  }
+
+  for (std::uint64_t range = 0; range < ranges.size; range++) {
+    if (try_claim(ranges.owners[range], owner)) {
+      return range;
+    }
+  }
+
+  return ranges.size;
+}
+
+// Tracks which samples of the current range have all of their images written, and publishes the prefix that is
+// complete. Frames finish on the writer threads in any order.
+class commit_tracker final
+{
+public:
+  explicit commit_tracker(worker_slot& slot)
+    : m_slot(slot)
+  {
+  }
+
+  void begin(const std::uint64_t first, const std::uint64_t last)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_first = first;
+    m_counts.assign(last - first, 0);
+  }
+
+  void on_written(const std::uint64_t index)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_counts.at(index - m_first)++;
+
+    const auto range = m_slot.range.load();
+
+    const auto first_uncommitted = get_committed(range);
+
+    auto committed = first_uncommitted;
+
+    auto advanced = false;
+
+    while ((committed < m_first + m_counts.size()) && (m_counts[committed - m_first] == sample_outputs.size())) {
+      committed++;
+      advanced = true;
+    }
+
+    if (advanced) {
+      m_slot.num_samples.fetch_add(committed - first_uncommitted);
+      m_slot.range.store(pack_range(committed, get_range_end(range)));
+    }
+  }
+
+private:
+  worker_slot& m_slot;
+
+  std::mutex m_mutex;
+
+  std::uint64_t m_first{};
+
+  std::vector<std::size_t> m_counts;
+};
+
+// Reports every image that reached the disk to the tracker. The recycle callback of the writer is no such signal,
+// since frames that failed to encode or write are recycled as well.
+class committing_sink final : public mvz::image_sink
+{
+public:
+  committing_sink(std::shared_ptr<mvz::image_sink> sink, commit_tracker& tracker)
+    : m_sink(std::move(sink))
+    , m_tracker(tracker)
+  {
+  }
+
+  void write(const mvz::frame& f, const char* extension, const std::vector<unsigned char>& data) override
+  {
+    m_sink->write(f, extension, data);
+
+    m_tracker.on_written(f.index);
+  }
+
+  void flush() override { m_sink->flush(); }
+
+private:
+  std::shared_ptr<mvz::image_sink> m_sink;
+
+  commit_tracker& m_tracker;
+};
+
+auto
+run_worker(const options& opts, shared_state& state, const range_table& ranges, const int index) -> int
+{
+  auto& slot = state.workers[index];
+
+  const auto owner = static_cast<std::uint16_t>(index + 1);
+
+  mvz::headless_context context;
+
+  mvz::session s(mvz::headless_context::get_proc_address);
+
+  const auto obj_id = s.load_obj(opts.obj_path.c_str());
+
+  std::vector<mvz::mesh_instance> scene;
+
+  for (const auto& shape : opts.shapes) {
+    auto inst = s.instance(obj_id, shape.c_str());
+    inst.translation = { 0, 0, 0 };
+    inst.rotation = { 0, 0, 0 };
+    scene.emplace_back(inst);
+  }
+
+  mvz::randomization_config config;
+  config.min_distance = 8;
+  config.max_distance = 12;
+  config.min_elevation = 0.05F;
+  config.max_elevation = 0.4F;
+  config.num_skyboxes = s.num_skyboxes();
+
+  const mvz::randomizer rnd(opts.seed, config);
+
+  std::vector<mvz::sample_parameters> samples(opts.range_size);
+
+  commit_tracker tracker(slot);
+
+  {
+    auto sink = std::make_shared<committing_sink>(mvz::make_directory_sink(opts.output_directory), tracker);
+
+    mvz::image_writer writer(std::move(sink), [&s](mvz::frame&& f) { s.recycle(std::move(f)); });
+
+    s.set_readback_callback([&writer](mvz::frame&& f) { writer.push(std::move(f)); });
+
+    // A restarted worker finishes the range of the one it replaces before claiming a new one.
+    auto range = find_range(ranges, owner);
+
+    while (true) {
+
+      if (range == ranges.size) {
+        range = claim_range(state, ranges, owner);
+      }
+
+      if (range == ranges.size) {
+        break;
+      }
+
+      auto first = range * opts.range_size;
+
+      const auto last = std::min(first + opts.range_size, opts.num_samples);
+
+      // No two ranges end at the same sample, so a matching end means that the slot already tracks this range.
+      const auto progress = slot.range.load();
+
+      if (get_range_end(progress) == last) {
+        first = get_committed(progress);
+      } else {
+        slot.range.store(pack_range(first, last));
+      }
+
+      tracker.begin(first, last);
+
+      rnd.generate_batch(first, static_cast<std::size_t>(last - first), samples.data());
+
+      for (auto index = first; index < last; index++) {
+        const auto& sample = samples[index - first];
+        s.set_skybox(sample.skybox);
+        s.render_offscreen(sample.cam, scene, sample_outputs);
+        for (const auto type : sample_outputs) {
+          s.read_offscreen(type, index);
+        }
+        s.poll_readbacks();
+      }
+
+      s.poll_readbacks(true);
+
+      writer.flush();
+
+      ranges.owners[range].store(range_done);
+
+      range = ranges.size;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+auto
+spawn_worker(const options& opts, shared_state& state, const range_table& ranges, const int index) -> pid_t
+{
+  const auto pid = fork();
+
+  if (pid != 0) {
+    return pid;
+  }
+
+  auto exit_code{ EXIT_FAILURE };
+
+  try {
+    exit_code = run_worker(opts, state, ranges, index);
+  } catch (const mvz::runtime_error& err) {
+    std::cerr << "worker " << index << ": " << err.what() << std::endl;
+  }
+
+  // The child must not run the parent's destructors or flush its stdio buffers twice.
+  std::_Exit(exit_code);
+}
+
+void
+print_stats(const options& opts, const shared_state& state, const double seconds)
+{
+  std::uint64_t total{};
+
+  std::cout << "[" << static_cast<int>(seconds) << "s]";
+
+  for (int i = 0; i < opts.num_workers; i++) {
+    const auto n = state.workers[i].num_samples.load();
+    std::cout << " w" << i << '=' << n;
+    total += n;
+  }
+
+  std::cout << " total=" << total << '/' << opts.num_samples << " (" << (seconds > 0 ? total / seconds : 0.0)
+            << " samples/s)" << std::endl;
+}
+
+auto
+parse_options(int argc, char** argv, options& opts) -> bool
+{
+  if (argc < 6) {
+    return false;
+  }
+
+  opts.output_directory = argv[1];
+  opts.num_samples = std::strtoull(argv[2], nullptr, 10);
+  opts.num_workers = std::atoi(argv[3]);
+  opts.obj_path = argv[4];
+
+  for (int i = 5; i < argc; i++) {
+    opts.shapes.emplace_back(argv[i]);
+  }
+
+  if (const auto* range_size = std::getenv("MVZ_RANGE_SIZE")) {
+    opts.range_size = std::max<std::uint64_t>(1, std::strtoull(range_size, nullptr, 10));
+  }
+
+  if (const auto* seed = std::getenv("MVZ_SEED")) {
+    opts.seed = std::strtoull(seed, nullptr, 10);
+  }
+
+  return (opts.num_samples <= max_samples) && (opts.num_workers > 0) && (opts.num_workers <= max_workers);
+}
+
+} // namespace
+
+auto
+main(int argc, char** argv) -> int
+{
+  options opts;
+
+  if (!parse_options(argc, argv, opts)) {
+    std::cerr << "usage: " << argv[0] << " <output directory> <num samples> <num workers> <obj file> <shape>..."
+              << std::endl;
+    std::cerr << "The number of samples claimed at a time is read from MVZ_RANGE_SIZE (default "
+              << default_range_size << ") and the seed of the"
+              << " camera poses and skyboxes from MVZ_SEED (default 0)." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  range_table ranges;
+  ranges.size = (opts.num_samples + opts.range_size - 1) / opts.range_size;
+
+  const auto memory_size = sizeof(shared_state) + ranges.size * sizeof(std::atomic<std::uint16_t>);
+
+  // Anonymous shared memory survives the workers, which is what lets a restarted worker resume.
+  auto* memory = mmap(nullptr, memory_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    std::cerr << "Failed to map shared memory: " << std::strerror(errno) << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  auto* state = new (memory) shared_state();
+
+  ranges.owners = reinterpret_cast<std::atomic<std::uint16_t>*>(state + 1);
+
+  for (std::uint64_t range = 0; range < ranges.size; range++) {
+    new (ranges.owners + range) std::atomic<std::uint16_t>(range_free);
+  }
+
+  std::cout.flush();
+
+  std::vector<pid_t> pids(opts.num_workers);
+
+  for (int i = 0; i < opts.num_workers; i++) {
+    pids[i] = spawn_worker(opts, *state, ranges, i);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+
+  auto last_report = start;
+
+  auto num_running = opts.num_workers;
+
+  auto exit_code{ EXIT_SUCCESS };
+
+  while (num_running > 0) {
+
+    int status{};
+
+    const auto pid = waitpid(-1, &status, WNOHANG);
+
+    if (pid > 0) {
+
+      const auto it = std::find(pids.begin(), pids.end(), pid);
+
+      const auto index = static_cast<int>(it - pids.begin());
+
+      const auto clean_exit = WIFEXITED(status) && (WEXITSTATUS(status) == EXIT_SUCCESS);
+
+      auto& slot = state->workers[index];
+
+      if (clean_exit) {
+        num_running--;
+        *it = -1;
+      } else if (slot.num_restarts.load() < max_restarts_per_worker) {
+        slot.num_restarts.fetch_add(1);
+        std::cerr << "worker " << index << " failed, restarting from sample " << get_committed(slot.range.load())
+                  << std::endl;
+        std::cout.flush();
+        *it = spawn_worker(opts, *state, ranges, index);
+      } else {
+        const auto range = slot.range.load();
+        std::cerr << "worker " << index << " failed too often, giving up on samples " << get_committed(range) << " to "
+                  << get_range_end(range) << std::endl;
+        exit_code = EXIT_FAILURE;
+        num_running--;
+        *it = -1;
+      }
+
+      continue;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    const auto now = std::chrono::steady_clock::now();
+
+    if (now - last_report >= std::chrono::seconds(1)) {
+      print_stats(opts, *state, std::chrono::duration<double>(now - start).count());
+      last_report = now;
+    }
+  }
+
+  const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  print_stats(opts, *state, seconds);
+
+  std::uint64_t restarts{};
+
+  for (int i = 0; i < opts.num_workers; i++) {
+    restarts += state->workers[i].num_restarts.load();
+  }
+
+  std::cout << "restarts=" << restarts << std::endl;
+
+  munmap(memory, memory_size);
+
+  return exit_code;
+}